@@ -20,6 +20,7 @@
 #include <vector>
 #include <set>
 #include <list>
+#include <deque>
 #include <cstring>
 #include <unistd.h>
 #include <algorithm>
@@ -37,6 +38,10 @@
 #include <swarm/networkmanager.h>
 #include <swarm/url_finder.h>
 #include <swarm/url.hpp>
+#include <swarm/crawler/bounded_queue.hpp>
+#include <swarm/crawler/duplicate_detector.hpp>
+#include <swarm/crawler/page_store.hpp>
+#include <swarm/crawler/seen_set.hpp>
 
 struct queue_element
 {
@@ -48,23 +53,67 @@ struct queue_element
 
 struct crawler_scope
 {
+	enum {
+		// Pages above this number wait in the backlog, parsers take them first
+		queue_capacity = 1024,
+		// Every fetch brings at most one page, so the backlog never exceeds this number
+		fetch_limit = 1024
+	};
+
+	crawler_scope() : files(queue_capacity)
+	{
+	}
+
 	int need_to_load;
 	int active_threads;
 	int nm_limit;
-	bool done;
 	std::atomic_long in_progress;
 	std::atomic_long counter;
 
 	std::string base_host;
 	std::string base_directory;
-	std::list<queue_element> files;
-	std::set<std::string> used;
+	ioremap::swarm::bounded_queue<queue_element> files;
+	ioremap::swarm::seen_set used;
+	ioremap::swarm::duplicate_detector duplicates;
+	std::unique_ptr<ioremap::swarm::page_store> store;
 	std::vector<ioremap::swarm::network_manager*> managers;
 	std::vector<ev::async*> asyncs;
 	std::condition_variable condition;
-	std::condition_variable fs_condition;
 	std::mutex mutex;
-	std::mutex fs_mutex;
+	// Pages which didn't fit the queue, network threads never block on it
+	std::deque<queue_element> backlog;
+	std::mutex backlog_mutex;
+	std::atomic_long backlog_size;
+	// Requests waiting until parsers catch up, they are much smaller than pages
+	std::deque<std::pair<ioremap::swarm::http_request, int>> pending;
+	std::mutex pending_mutex;
+	std::atomic_long pending_size;
+	std::atomic_long fetching;
+
+	void fetch(const ioremap::swarm::http_request &request, int depth);
+	void submit_pending();
+
+	void enqueue(queue_element &&element) {
+		if (files.try_push(std::move(element)))
+			return;
+
+		std::lock_guard<std::mutex> lock(backlog_mutex);
+		backlog.push_back(std::move(element));
+		++backlog_size;
+	}
+
+	bool take_backlog(queue_element &element) {
+		if (backlog_size == 0)
+			return false;
+
+		std::lock_guard<std::mutex> lock(backlog_mutex);
+		if (backlog.empty())
+			return false;
+		element = std::move(backlog.front());
+		backlog.pop_front();
+		--backlog_size;
+		return true;
+	}
 
 	void check_end(int current_in_progress) {
 		if (current_in_progress == 0) {
@@ -74,9 +123,7 @@ struct crawler_scope
 
 	void force_end() {
 		std::for_each(asyncs.begin(), asyncs.end(), std::bind(&ev::async::send, std::placeholders::_1));
-		std::unique_lock<std::mutex> lock(fs_mutex);
-		done = true;
-		fs_condition.notify_all();
+		files.close();
 	}
 };
 
@@ -91,19 +138,49 @@ struct result_handler
 		if (reply.code() == 200 && !reply.error()) {
 			++scope.in_progress;
 			queue_element element = { reply.request(), reply.url().to_string(), reply.data(), depth - 1 };
-			std::unique_lock<std::mutex> lock(scope.fs_mutex);
-			scope.files.push_back(element);
-			scope.fs_condition.notify_all();
+			// It's called by the network thread, so it must not wait for parsers
+			if (scope.files.closed())
+				--scope.in_progress;
+			else
+				scope.enqueue(std::move(element));
 		}
 
 		if (reply.error()) {
 			std::cerr << "Error at \"" << reply.request().url().to_string() << "\": " << strerror(-reply.error()) << ": " << reply.error() << std::endl;
 		}
 
+		--scope.fetching;
 		scope.check_end(--scope.in_progress);
 	}
 };
 
+void crawler_scope::fetch(const ioremap::swarm::http_request &request, int depth)
+{
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		pending.emplace_back(request, depth);
+		++pending_size;
+	}
+	submit_pending();
+}
+
+/*
+ * Backpressure: new requests are not sent while parsers are behind, i.e. while there is any page
+ * in the backlog, or while too many pages are being fetched. It's called by parsing threads
+ * once they have finished the page, so requests are resumed as soon as parsers catch up.
+ */
+void crawler_scope::submit_pending()
+{
+	std::lock_guard<std::mutex> lock(pending_mutex);
+	while (!pending.empty() && backlog_size == 0 && fetching < fetch_limit) {
+		result_handler handler = { *this, pending.front().second };
+		++fetching;
+		managers[rand() % managers.size()]->get(handler, pending.front().first);
+		pending.pop_front();
+		--pending_size;
+	}
+}
+
 struct ev_loop_stopper
 {
 	ev::loop_ref &loop;
@@ -158,130 +235,124 @@ struct fs_thread
 			++scope.active_threads;
 			scope.condition.notify_all();
 		}
+		std::vector<queue_element> batch;
+		queue_element element;
 		for (;;) {
-			queue_element element;
-			{
-				std::unique_lock<std::mutex> fs_lock(scope.fs_mutex);
-				while (scope.files.empty() && !scope.done)
-					scope.fs_condition.wait(fs_lock);
-				if (!scope.files.empty()) {
-					element = scope.files.front();
-					scope.files.erase(scope.files.begin());
-				} else if (scope.done) {
-					break;
-				}
-			}
-			in_progress_guard guard = { scope };
+			// Backlog is parsed before new pages, so no new urls are fetched until parsers catch up
+			while (scope.take_backlog(element))
+				process(element);
+
+			if (!scope.files.pop_batch(batch, 16))
+				break;
+			for (auto it = batch.begin(); it != batch.end(); ++it)
+				process(*it);
+			batch.clear();
+		}
+
+		// Queue is closed, pages left in the backlog are just counted as finished
+		while (scope.take_backlog(element))
+			scope.check_end(--scope.in_progress);
+	}
+
+	void process(queue_element &element)
+	{
+		in_progress_guard guard = { scope };
+		process_page(element);
+		scope.submit_pending();
+	}
 
-			ioremap::swarm::url base_url;
-			ioremap::swarm::url_finder finder(element.data);
+	void process_page(queue_element &element)
+	{
+		// Mirrors and session-id variants are neither stored nor parsed for links
+		if (scope.duplicates.check(element.url, element.data) != ioremap::swarm::duplicate_detector::unique)
+			return;
 
-			if (!base_url.set_base(element.url))
-				continue;
+		ioremap::swarm::url base_url;
+		ioremap::swarm::url_finder finder(element.data);
 
-			element.url = base_url.normalized();
-			if (element.url.empty())
-				continue;
+		if (!base_url.set_base(element.url))
+			return;
 
-			result_handler handler = { scope, element.depth };
-			if (element.depth >= 0) {
-				for (auto it = finder.urls().begin(); it != finder.urls().end(); ++it) {
-					std::string url = *it;
+		element.url = base_url.normalized();
+		if (element.url.empty())
+			return;
 
-					if (url.compare(0, 7, "mailto:") == 0)
-						continue;
+		if (element.depth >= 0) {
+			for (auto it = finder.urls().begin(); it != finder.urls().end(); ++it) {
+				std::string url = *it;
 
-					std::string host;
-					element.request.set_url(base_url.relative(url, &host));
-					if (element.request.url().empty() || host.empty())
+				if (url.compare(0, 7, "mailto:") == 0)
+					continue;
+
+				std::string host;
+				element.request.set_url(base_url.relative(url, &host));
+				if (element.request.url().empty() || host.empty())
+					continue;
+
+				if (!scope.base_host.empty()) {
+					if (host.size() < scope.base_host.size())
 						continue;
 
-					if (!scope.base_host.empty()) {
-						if (host.size() < scope.base_host.size())
+					if (host.size() > scope.base_host.size()) {
+						if (host.find(scope.base_host) != host.size() - scope.base_host.size())
 							continue;
-
-						if (host.size() > scope.base_host.size()) {
-							if (host.find(scope.base_host) != host.size() - scope.base_host.size())
-								continue;
-							if (host[host.size() - scope.base_host.size() - 1] != '.')
-								continue;
-						} else if (host != scope.base_host) {
+						if (host[host.size() - scope.base_host.size() - 1] != '.')
 							continue;
-						}
-					}
-
-					bool inserted = false;
-					{
-						std::lock_guard<std::mutex> lock(scope.mutex);
-						if (scope.need_to_load > 0) {
-							inserted = scope.used.insert(element.request.url()).second;
-							if (inserted)
-								--scope.need_to_load;
-						}
-					}
-					if (inserted) {
-						++scope.in_progress;
-						scope.managers[rand() % scope.managers.size()]->get(handler, element.request);
+					} else if (host != scope.base_host) {
+						continue;
 					}
 				}
-			}
 
-			std::string filepath = scope.base_directory + "/" + element.url;
-			size_t index = 0;
-			while ((index = filepath.find("//", index)) != std::string::npos) {
-				filepath.erase(index, 1);
-			}
-			if (filepath[filepath.size() - 1] == '/')
-				filepath.resize(filepath.size() - 1);
-			filepath += "~file-tag";
-
-
-			index = 0;
-			int err = 0;
-			while ((index = filepath.find('/', index + 1)) != std::string::npos) {
-				std::string dir = filepath.substr(0, index);
-				err = mkdir(dir.c_str(), 0755);
-				if (err < 0) {
-					if (errno != EEXIST) {
-						err = errno;
-						std::cerr << "Can not create directory: \"" << scope.base_directory << "\": " << strerror(err) << std::endl;
-						break;
-					} else {
-						err = 0;
-					}
+				// Seen set is thread-safe, only the counter needs the lock
+				bool inserted = scope.used.insert(element.request.url());
+				if (inserted) {
+					std::lock_guard<std::mutex> lock(scope.mutex);
+					if (scope.need_to_load > 0)
+						--scope.need_to_load;
+					else
+						inserted = false;
+				}
+				if (inserted) {
+					++scope.in_progress;
+					scope.fetch(element.request, element.depth);
 				}
 			}
-			if (err != 0)
-				continue;
-
-			int oflags = O_RDWR | O_CREAT | O_LARGEFILE | O_CLOEXEC | O_TRUNC;
-			int fd = open(filepath.c_str(), oflags, 0644);
-			if (fd < 0) {
-				err = errno;
-				std::cerr << "Can not create file: \"" << filepath << "\": " << strerror(err) << std::endl;
-				continue;
-			}
-			ssize_t written = pwrite(fd, element.data.c_str(), element.data.size(), 0);
-			close(fd);
-			if (written != (ssize_t)element.data.size()) {
-				err = errno;
-				std::cerr << "Can not write data to : \"" << filepath << "\": " << strerror(err) << std::endl;
-				continue;
-			}
+		}
+
+		ioremap::swarm::page_record record;
+		record.url = element.url;
+		record.status = 200;
+		record.timestamp = time(NULL);
+		record.body = std::move(element.data);
+
+		try {
+			scope.store->append(record);
+		} catch (std::exception &e) {
+			std::cerr << "Can not store \"" << element.url << "\": " << e.what() << std::endl;
 		}
 	}
 };
 
 struct rps_counter
 {
+	crawler_scope &scope;
 	std::atomic_long &counter;
 	long previous_counter;
+	ioremap::swarm::bounded_queue<queue_element> &files;
+	uint64_t previous_parsed;
 
 	void operator() (ev::timer &, int) {
 		long new_counter = counter;
 		long delta = new_counter - previous_counter;
 		previous_counter = new_counter;
-		std::cout << "rps: " << delta << std::endl;
+
+		// Growing backlog means that parsers don't keep up with fetchers
+		const auto stats = files.statistics();
+		const uint64_t parsed = stats.popped - previous_parsed;
+		previous_parsed = stats.popped;
+
+		std::cout << "rps: " << delta << ", parsed: " << parsed << ", queued: " << files.size()
+			<< ", backlog: " << scope.backlog_size << ", pending: " << scope.pending_size << std::endl;
 	}
 };
 
@@ -305,9 +376,11 @@ int main(int argc, char **argv)
 
 	scope.nm_limit = 25;
 	scope.active_threads = 0;
-	scope.done = false;
 	scope.in_progress = 0;
 	scope.counter = 0;
+	scope.backlog_size = 0;
+	scope.pending_size = 0;
+	scope.fetching = 0;
 
 	std::string url = argv[1];
 	int max_depth = atoi(argv[2]);
@@ -342,13 +415,11 @@ int main(int argc, char **argv)
 	if (argc < 9 || !atoi(argv[8]))
 		scope.base_host = url_parser.host();
 
-	int err = mkdir(scope.base_directory.c_str(), 0755);
-	if (err < 0) {
-		if (errno != EEXIST) {
-			err = errno;
-			std::cerr << "Can not create directory: \"" << scope.base_directory << "\": " << strerror(err) << std::endl;
-			return err;
-		}
+	try {
+		scope.store.reset(new ioremap::swarm::page_store(scope.base_directory));
+	} catch (std::exception &e) {
+		std::cerr << "Can not open store: \"" << scope.base_directory << "\": " << e.what() << std::endl;
+		return 1;
 	}
 
 	ev::default_loop loop;
@@ -367,7 +438,7 @@ int main(int argc, char **argv)
 		sig_watcher.start();
 	}
 
-	rps_counter counter = { scope.counter, scope.counter };
+	rps_counter counter = { scope, scope.counter, scope.counter, scope.files, 0 };
 	network_manager_thread thread_handler = { scope };
 	fs_thread fs_thread_handler = { scope };
 	std::vector<std::thread> threads;
@@ -398,11 +469,10 @@ int main(int argc, char **argv)
 
 	ioremap::swarm::http_request request;
 	request.set_follow_location(true);
-	result_handler handler = { scope, max_depth };
 	request.set_url(url);
 	--scope.need_to_load;
 	++scope.in_progress;
-	scope.managers[rand() % scope.managers.size()]->get(handler, request);
+	scope.fetch(request, max_depth);
 
 	loop.loop();
 
@@ -16,16 +16,49 @@
 
 #include <swarm/http_request.hpp>
 #include <swarm/urlfetcher/url_fetcher.hpp>
+#include <swarm/urlfetcher/boost_event_loop.hpp>
 #include <thevoid/server.hpp>
 #include <thevoid/stream.hpp>
+#include <thevoid/mirror.hpp>
+
+#include <thread>
 
 using namespace ioremap;
 
 class http_server : public thevoid::server<http_server>
 {
 public:
+	http_server() : m_mirror_rate(0) {
+	}
+
+	~http_server() {
+		if (m_mirror_thread.joinable()) {
+			m_mirror_work.reset();
+			m_mirror_service.stop();
+			m_mirror_thread.join();
+		}
+	}
+
 	virtual bool initialize(const rapidjson::Value &config) {
-		(void) config;
+		/*
+		 * With "mirror": { "upstream": "http://localhost:8081", "rate": 1.0 } in application section
+		 * /get and /echo requests are copied to another server, see mirror's numbers at the monitor
+		 */
+		if (config.HasMember("mirror")) {
+			const rapidjson::Value &mirror = config["mirror"];
+			if (!mirror.HasMember("upstream")) {
+				logger().log(swarm::SWARM_LOG_ERROR, "\"mirror\" section must have \"upstream\"");
+				return false;
+			}
+
+			m_mirror_rate = mirror.HasMember("rate") ? mirror["rate"].GetDouble() : 1.0;
+
+			m_mirror_work.reset(new boost::asio::io_service::work(m_mirror_service));
+			m_mirror_loop.reset(new swarm::boost_event_loop(m_mirror_service));
+			m_fetcher.reset(new swarm::url_fetcher(*m_mirror_loop, logger()));
+			m_mirror = std::make_shared<thevoid::traffic_mirror>(*m_fetcher, mirror["upstream"].GetString());
+			m_mirror_thread = std::thread(std::bind(&http_server::run_mirror, this));
+		}
 
 		on<on_ping>(
 			options::exact_match("/ping"),
@@ -33,16 +66,21 @@ public:
 		);
 		on<on_timeout>(
 			options::exact_match("/timeout"),
-			options::methods("GET")
+			options::methods("GET"),
+			options::slow_request_threshold(500)
 		);
-		on<on_get>(
+		on_maybe_mirrored<on_get>(
 			options::exact_match("/get"),
 			options::methods("GET")
 		);
-		on<on_echo>(
+		on_maybe_mirrored<on_echo>(
 			options::exact_match("/echo"),
 			options::methods("GET")
 		);
+		on<on_counter>(
+			options::exact_match("/counter"),
+			options::methods("GET")
+		);
 		on<on_ping>(
 			options::exact_match("/header-check"),
 			options::methods("GET"),
@@ -52,6 +90,18 @@ public:
 		return true;
 	}
 
+	virtual std::map<std::string, std::string> get_statistics() const {
+		std::map<std::string, std::string> result;
+		if (m_mirror) {
+			result["mirror-mirrored"] = std::to_string(m_mirror->mirrored());
+			result["mirror-failed"] = std::to_string(m_mirror->failed());
+			result["mirror-dropped"] = std::to_string(m_mirror->dropped());
+			result["mirror-in-flight"] = std::to_string(m_mirror->in_flight());
+			result["mirror-queued-bytes"] = std::to_string(m_mirror->queued_bytes());
+		}
+		return result;
+	}
+
 	struct on_ping : public thevoid::simple_request_stream<http_server> {
 		virtual void on_request(const swarm::http_request &req, const boost::asio::const_buffer &buffer) {
 			(void) buffer;
@@ -106,6 +156,45 @@ public:
 			this->send_reply(std::move(reply), std::string(data, size));
 		}
 	};
+
+	// Counts requests handled by the current worker, it's counter is never touched by other threads
+	struct on_counter : public thevoid::simple_request_stream<http_server> {
+		virtual void on_request(const swarm::http_request &req, const boost::asio::const_buffer &buffer) {
+			(void) buffer;
+			(void) req;
+
+			unsigned long long &counter = server()->local<unsigned long long>();
+			std::string data = std::to_string(++counter);
+
+			swarm::http_response reply;
+			reply.set_code(swarm::http_response::ok);
+			reply.headers().set_content_length(data.size());
+
+			this->send_reply(std::move(reply), std::move(data));
+		}
+	};
+
+private:
+	template <typename T, typename... Options>
+	void on_maybe_mirrored(Options &&...args) {
+		if (m_mirror)
+			on_mirrored<T>(m_mirror, m_mirror_rate, std::forward<Options>(args)...);
+		else
+			on<T>(std::forward<Options>(args)...);
+	}
+
+	// Mirrored requests are sent by their own thread, not by the server's workers
+	void run_mirror() {
+		m_mirror_service.run();
+	}
+
+	boost::asio::io_service m_mirror_service;
+	std::unique_ptr<boost::asio::io_service::work> m_mirror_work;
+	std::unique_ptr<swarm::boost_event_loop> m_mirror_loop;
+	std::unique_ptr<swarm::url_fetcher> m_fetcher;
+	std::shared_ptr<thevoid::traffic_mirror> m_mirror;
+	std::thread m_mirror_thread;
+	double m_mirror_rate;
 };
 
 int main(int argc, char **argv)
@@ -80,6 +80,11 @@ struct request_handler_functor {
 	}
 };
 
+static void ignore_upload_error(const boost::system::error_code &error)
+{
+	(void) error;
+}
+
 struct io_service_runner
 {
 	boost::asio::io_service *service;
@@ -98,7 +103,9 @@ int main(int argc, char *argv[])
 
         std::string url;
 
-	long request_num, chunk_num, connections_limit;
+	long request_num, chunk_num, connections_limit, host_limit;
+	size_t body_size;
+	std::string http2;
 
         generic.add_options()
                 ("help", "This help message")
@@ -106,11 +113,20 @@ int main(int argc, char *argv[])
                 ("requests", bpo::value<long>(&request_num)->default_value(100000), "Number of test calls")
                 ("chunk", bpo::value<long>(&chunk_num)->default_value(1000), "Send this many requests and then synchronously wait for all of them to complete")
 		("connections", bpo::value<long>(&connections_limit)->default_value(100), "Number of connections limit")
+		("host-limit", bpo::value<long>(&host_limit)->default_value(std::numeric_limits<long>::max()), "Number of concurrent requests per host limit")
+		("http2", bpo::value<std::string>(&http2)->default_value("disabled"), "HTTP/2 mode: disabled, negotiate or prior-knowledge")
+		("multiplexing", "Multiplex HTTP/2 requests over single connection")
+		("open", "Send requests by url_fetcher::open instead of get")
+		("body", bpo::value<size_t>(&body_size)->default_value(0), "Size of the body uploaded by every PUT request, implies --open")
                 ;
 
         bpo::options_description cmdline_options;
         cmdline_options.add(generic);
 
+	bool multiplexing = false;
+	bool open = false;
+	swarm::url_fetcher::request::http2_mode http2_mode = swarm::url_fetcher::request::http2_disabled;
+
         try {
                 bpo::variables_map vm;
                 bpo::store(bpo::command_line_parser(argc, argv).options(cmdline_options).run(), vm);
@@ -120,6 +136,19 @@ int main(int argc, char *argv[])
                         std::cerr << cmdline_options << std::endl;
                         return -1;
                 }
+
+		multiplexing = vm.count("multiplexing") > 0;
+		open = vm.count("open") > 0 || body_size > 0;
+
+		if (http2 == "negotiate") {
+			http2_mode = swarm::url_fetcher::request::http2_negotiate;
+		} else if (http2 == "prior-knowledge") {
+			http2_mode = swarm::url_fetcher::request::http2_prior_knowledge;
+		} else if (http2 != "disabled") {
+			std::cerr << "Unknown HTTP/2 mode: " << http2 << std::endl;
+			std::cerr << cmdline_options << std::endl;
+			return -1;
+		}
         } catch (...) {
                 std::cerr << cmdline_options << std::endl;
                 return -1;
@@ -134,13 +163,17 @@ int main(int argc, char *argv[])
 
 	swarm::url_fetcher manager(loop, logger);
 	manager.set_total_limit(connections_limit);
-//	manager.set_host_limit(connections_limit);
+	manager.set_host_limit(host_limit);
+	manager.set_multiplexing(multiplexing);
 
 	io_service_runner runner = { &service };
 	boost::thread thread(runner);
 
 	ioremap::warp::timer tm, total, preparation;
 
+	// Body is shared by all requests, it lives until all of them are finished
+	const std::string body(body_size, 'x');
+
 	for (long i = 0; i < request_num;) {
 		preparation.restart();
 
@@ -151,8 +184,23 @@ int main(int argc, char *argv[])
 			swarm::url_fetcher::request request;
 			request.set_url(url);
 			request.set_timeout(500000);
-
-			manager.get(swarm::simple_stream::create(std::ref(handler)), std::move(request));
+			request.set_http2(http2_mode);
+
+			if (!open) {
+				manager.get(swarm::simple_stream::create(std::ref(handler)), std::move(request));
+				continue;
+			}
+
+			if (body_size > 0) {
+				request.set_method("PUT");
+				request.headers().set_content_length(body_size);
+			}
+
+			auto handle = manager.open(swarm::simple_stream::create(std::ref(handler)), std::move(request));
+			if (body_size > 0) {
+				handle->send_data(boost::asio::buffer(body), ignore_upload_error);
+				handle->finish();
+			}
 		}
 
 		auto preparation_usecs = preparation.elapsed();
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <swarm/xml/url_finder.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "timer.hpp"
+
+using namespace ioremap;
+
+static bool count_url(size_t *counter, const std::string &)
+{
+	++*counter;
+	return true;
+}
+
+struct result
+{
+	size_t urls;
+	int64_t time;
+};
+
+static result run(const std::vector<std::string> &pages, swarm::url_finder::parser_mode mode, long iterations, size_t chunk)
+{
+	result res = { 0, 0 };
+	warp::timer timer;
+
+	for (long i = 0; i < iterations; ++i) {
+		for (auto it = pages.begin(); it != pages.end(); ++it) {
+			swarm::url_finder_stream finder(std::bind(count_url, &res.urls, std::placeholders::_1), mode);
+
+			for (size_t offset = 0; offset < it->size(); offset += chunk)
+				finder.feed(it->c_str() + offset, std::min(chunk, it->size() - offset));
+			finder.finish();
+		}
+	}
+
+	res.time = timer.elapsed();
+	return res;
+}
+
+int main(int argc, char *argv[])
+{
+	namespace bpo = boost::program_options;
+
+	bpo::options_description generic("Url finder testing options");
+
+	std::vector<std::string> files;
+	long iterations;
+	size_t chunk;
+
+	generic.add_options()
+		("help", "This help message")
+		("iterations", bpo::value<long>(&iterations)->default_value(10), "Number of passes over the corpus")
+		("chunk", bpo::value<size_t>(&chunk)->default_value(16 * 1024), "Size of chunks pages are fed by")
+		("compare", "Print pages the parsers found different links in")
+		;
+
+	bpo::options_description hidden;
+	hidden.add_options()
+		("file", bpo::value<std::vector<std::string>>(&files), "HTML page")
+		;
+
+	bpo::positional_options_description positional;
+	positional.add("file", -1);
+
+	bpo::options_description cmdline_options;
+	cmdline_options.add(generic).add(hidden);
+
+	bool compare = false;
+
+	try {
+		bpo::variables_map vm;
+		bpo::store(bpo::command_line_parser(argc, argv).options(cmdline_options).positional(positional).run(), vm);
+		bpo::notify(vm);
+
+		if (vm.count("help") || files.empty() || chunk == 0) {
+			std::cerr << "Usage: " << argv[0] << " [options] page.html..." << std::endl;
+			std::cerr << generic << std::endl;
+			return -1;
+		}
+
+		compare = vm.count("compare") > 0;
+	} catch (const std::exception &e) {
+		std::cerr << "Invalid options: " << e.what() << "\n" << generic << std::endl;
+		return -1;
+	}
+
+	std::vector<std::string> pages;
+	size_t total_size = 0;
+
+	for (auto it = files.begin(); it != files.end(); ++it) {
+		std::ifstream in(it->c_str(), std::ios::binary);
+		if (!in) {
+			std::cerr << "Failed to open " << *it << std::endl;
+			return -1;
+		}
+
+		std::stringstream stream;
+		stream << in.rdbuf();
+		pages.push_back(stream.str());
+		total_size += pages.back().size();
+	}
+
+	std::cout << "pages: " << pages.size() << ", size: " << total_size << " bytes" << std::endl;
+
+	const struct {
+		const char *name;
+		swarm::url_finder::parser_mode mode;
+	} modes[] = {
+		{ "libxml", swarm::url_finder::libxml_parser },
+		{ "lexer", swarm::url_finder::lexer_parser }
+	};
+
+	for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+		const result res = run(pages, modes[i].mode, iterations, chunk);
+		const double megabytes = double(total_size) * iterations / (1024 * 1024);
+
+		std::cout << modes[i].name
+			<< ": links: " << res.urls / iterations
+			<< ", time: " << res.time / 1000 << " ms"
+			<< ", performance: " << megabytes * 1000000 / res.time << " MB/s"
+			<< std::endl;
+	}
+
+	if (compare) {
+		for (size_t i = 0; i < pages.size(); ++i) {
+			swarm::url_finder libxml(pages[i], swarm::url_finder::libxml_parser);
+			swarm::url_finder lexer(pages[i], swarm::url_finder::lexer_parser);
+
+			if (libxml.urls() != lexer.urls() || libxml.base_url() != lexer.base_url()) {
+				std::cout << files[i] << ": libxml found " << libxml.urls().size()
+					<< " links, lexer found " << lexer.urls().size() << std::endl;
+			}
+		}
+	}
+
+	return 0;
+}
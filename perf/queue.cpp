@@ -0,0 +1,155 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <swarm/crawler/bounded_queue.hpp>
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "timer.hpp"
+
+using namespace ioremap;
+
+/*
+ * Every producer pushes numbers from 1 to count, blocking ones wait on the full queue,
+ * non-blocking ones spin on try_push like event loop threads do
+ */
+static void produce(swarm::bounded_queue<uint64_t> *queue, uint64_t count, bool blocking)
+{
+	for (uint64_t i = 1; i <= count; ++i) {
+		if (blocking) {
+			queue->push(uint64_t(i));
+			continue;
+		}
+
+		while (!queue->try_push(uint64_t(i)))
+			std::this_thread::yield();
+	}
+}
+
+struct consumer_result
+{
+	uint64_t count;
+	uint64_t sum;
+};
+
+static void consume(swarm::bounded_queue<uint64_t> *queue, size_t batch_size, consumer_result *result)
+{
+	std::vector<uint64_t> batch;
+	while (queue->pop_batch(batch, batch_size)) {
+		for (auto it = batch.begin(); it != batch.end(); ++it) {
+			++result->count;
+			result->sum += *it;
+		}
+		batch.clear();
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	namespace bpo = boost::program_options;
+
+	bpo::options_description generic("Bounded queue testing options");
+
+	size_t producers;
+	size_t consumers;
+	uint64_t count;
+	size_t capacity;
+	size_t batch_size;
+
+	generic.add_options()
+		("help", "This help message")
+		("producers", bpo::value<size_t>(&producers)->default_value(4), "Number of producing threads")
+		("consumers", bpo::value<size_t>(&consumers)->default_value(4), "Number of consuming threads")
+		("count", bpo::value<uint64_t>(&count)->default_value(1000000), "Number of elements pushed by every producer")
+		("capacity", bpo::value<size_t>(&capacity)->default_value(1024), "Capacity of the queue")
+		("batch", bpo::value<size_t>(&batch_size)->default_value(16), "Maximum number of elements popped at once")
+		("try-push", "Producers spin on try_push instead of blocking push")
+		;
+
+	bool blocking = true;
+
+	try {
+		bpo::variables_map vm;
+		bpo::store(bpo::parse_command_line(argc, argv, generic), vm);
+		bpo::notify(vm);
+
+		if (vm.count("help") || producers == 0 || consumers == 0 || capacity == 0 || batch_size == 0) {
+			std::cerr << "Usage: " << argv[0] << " [options]" << std::endl;
+			std::cerr << generic << std::endl;
+			return -1;
+		}
+
+		blocking = vm.count("try-push") == 0;
+	} catch (const std::exception &e) {
+		std::cerr << "Invalid options: " << e.what() << "\n" << generic << std::endl;
+		return -1;
+	}
+
+	swarm::bounded_queue<uint64_t> queue(capacity);
+	std::vector<consumer_result> results(consumers);
+	std::vector<std::thread> producer_threads;
+	std::vector<std::thread> consumer_threads;
+
+	warp::timer timer;
+
+	for (size_t i = 0; i < consumers; ++i) {
+		results[i].count = 0;
+		results[i].sum = 0;
+		consumer_threads.emplace_back(std::bind(consume, &queue, batch_size, &results[i]));
+	}
+	for (size_t i = 0; i < producers; ++i)
+		producer_threads.emplace_back(std::bind(produce, &queue, count, blocking));
+
+	for (auto it = producer_threads.begin(); it != producer_threads.end(); ++it)
+		it->join();
+	/* Consumers take the rest of elements and leave once the queue is empty */
+	queue.close();
+	for (auto it = consumer_threads.begin(); it != consumer_threads.end(); ++it)
+		it->join();
+
+	const int64_t time = timer.elapsed();
+
+	uint64_t popped = 0;
+	uint64_t sum = 0;
+	for (auto it = results.begin(); it != results.end(); ++it) {
+		popped += it->count;
+		sum += it->sum;
+	}
+
+	const uint64_t expected_count = count * producers;
+	const uint64_t expected_sum = count * (count + 1) / 2 * producers;
+	const auto stats = queue.statistics();
+
+	std::cout << "elements: " << popped
+		<< ", time: " << time / 1000 << " ms"
+		<< ", performance: " << popped * 1000000 / time << " elements/s"
+		<< ", full waits: " << stats.full_waits
+		<< ", empty waits: " << stats.empty_waits
+		<< std::endl;
+
+	if (popped != expected_count || sum != expected_sum
+		|| stats.pushed != expected_count || stats.popped != expected_count) {
+		std::cerr << "Lost or duplicated elements: expected " << expected_count << " elements with sum " << expected_sum
+			<< ", got " << popped << " elements with sum " << sum << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <thevoid/statistics.hpp>
+
+#include <iostream>
+#include <map>
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+
+using namespace ioremap;
+
+struct snapshot
+{
+	std::map<std::string, uint64_t> counters;
+	std::map<std::string, thevoid::statistics_segment::histogram_info> histograms;
+};
+
+static snapshot read_snapshot(const thevoid::statistics_segment &segment)
+{
+	snapshot result;
+
+	for (size_t i = 0; i < segment.counters_count(); ++i)
+		result.counters[segment.counter_name(i)] = segment.counter_value(i);
+
+	for (size_t i = 0; i < segment.histograms_count(); ++i) {
+		auto info = segment.histogram_value(i);
+		result.histograms[info.name] = info;
+	}
+
+	return result;
+}
+
+// Returns the upper bound of the bucket which contains \a quantile of values
+static uint64_t histogram_quantile(const thevoid::statistics_segment::histogram_info &info, double quantile)
+{
+	const uint64_t limit = info.count * quantile;
+	uint64_t total = 0;
+
+	for (size_t i = 0; i < info.buckets.size(); ++i) {
+		total += info.buckets[i];
+		if (total > limit)
+			return 1ull << i;
+	}
+
+	return 1ull << info.buckets.size();
+}
+
+static void print_histogram(const thevoid::statistics_segment::histogram_info &info)
+{
+	std::cout << info.name
+		<< ": count: " << info.count
+		<< ", avg: " << (info.count ? info.sum / info.count : 0)
+		<< ", p50 < " << histogram_quantile(info, 0.5)
+		<< ", p99 < " << histogram_quantile(info, 0.99)
+		<< ", p999 < " << histogram_quantile(info, 0.999)
+		<< std::endl;
+}
+
+static void print_snapshot(const snapshot &current)
+{
+	for (auto it = current.counters.begin(); it != current.counters.end(); ++it)
+		std::cout << it->first << ": " << it->second << std::endl;
+
+	for (auto it = current.histograms.begin(); it != current.histograms.end(); ++it)
+		print_histogram(it->second);
+}
+
+static void print_difference(const snapshot &previous, const snapshot &current)
+{
+	for (auto it = current.counters.begin(); it != current.counters.end(); ++it) {
+		auto jt = previous.counters.find(it->first);
+		const uint64_t old_value = jt == previous.counters.end() ? 0 : jt->second;
+		std::cout << it->first << ": " << int64_t(it->second - old_value) << std::endl;
+	}
+
+	for (auto it = current.histograms.begin(); it != current.histograms.end(); ++it) {
+		thevoid::statistics_segment::histogram_info info = it->second;
+
+		auto jt = previous.histograms.find(it->first);
+		if (jt != previous.histograms.end()) {
+			info.count -= jt->second.count;
+			info.sum -= jt->second.sum;
+			for (size_t i = 0; i < info.buckets.size() && i < jt->second.buckets.size(); ++i)
+				info.buckets[i] -= jt->second.buckets[i];
+		}
+
+		print_histogram(info);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	namespace bpo = boost::program_options;
+
+	bpo::options_description generic("Statistics segment options");
+
+	std::string path;
+	long interval;
+
+	generic.add_options()
+		("help", "This help message")
+		("interval", bpo::value<long>(&interval)->default_value(0),
+			"Print differences every interval seconds instead of the single dump")
+		;
+
+	bpo::options_description hidden;
+	hidden.add_options()
+		("file", bpo::value<std::string>(&path), "Statistics segment")
+		;
+
+	bpo::positional_options_description positional;
+	positional.add("file", 1);
+
+	bpo::options_description cmdline_options;
+	cmdline_options.add(generic).add(hidden);
+
+	try {
+		bpo::variables_map vm;
+		bpo::store(bpo::command_line_parser(argc, argv).options(cmdline_options).positional(positional).run(), vm);
+		bpo::notify(vm);
+
+		if (vm.count("help") || path.empty() || interval < 0) {
+			std::cerr << "Usage: " << argv[0] << " [options] statistics-file" << std::endl;
+			std::cerr << generic << std::endl;
+			return -1;
+		}
+	} catch (const std::exception &e) {
+		std::cerr << "Invalid options: " << e.what() << "\n" << generic << std::endl;
+		return -1;
+	}
+
+	std::unique_ptr<thevoid::statistics_segment> segment;
+	try {
+		segment = thevoid::statistics_segment::open(path);
+	} catch (const std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return -1;
+	}
+
+	std::cout << "pid: " << segment->pid() << ", started: " << segment->start_time() << std::endl;
+
+	snapshot previous = read_snapshot(*segment);
+
+	if (interval == 0) {
+		print_snapshot(previous);
+		return 0;
+	}
+
+	for (;;) {
+		sleep(interval);
+
+		snapshot current = read_snapshot(*segment);
+		std::cout << "--- " << time(NULL) << std::endl;
+		print_difference(previous, current);
+		previous = std::move(current);
+	}
+
+	return 0;
+}
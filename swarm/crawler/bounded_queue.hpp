@@ -0,0 +1,443 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOREMAP_SWARM_CRAWLER_BOUNDED_QUEUE_HPP
+#define IOREMAP_SWARM_CRAWLER_BOUNDED_QUEUE_HPP
+
+#include "../c++config.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef SWARM_CSTDATOMIC
+#  include <cstdatomic>
+#else
+#  include <atomic>
+#endif
+
+namespace ioremap {
+namespace swarm {
+
+/*!
+ * \brief The bounded_queue class is bounded lock-free multi-producer multi-consumer queue.
+ *
+ * It's intended to pass work between stages of the pipeline, i.e. from fetching threads to
+ * parsing ones. Elements are moved in and out, so they may be move-only and are never copied,
+ * but they must be default constructible.
+ *
+ * Non-blocking try_push and try_pop are lock-free (it's the array-based queue by Dmitry Vyukov:
+ * every cell has sequence number which tells whether it's ready for the producer or for the consumer).
+ * Blocking push waits while the queue is full, so producers are slowed down once consumers fall
+ * behind; blocking pop waits while the queue is empty. Threads are put to sleep only after the
+ * lock-free attempt fails, so the mutex is not touched while the queue is neither full nor empty.
+ * Event loop threads must not use blocking push, they keep the element if try_push fails instead,
+ * it's left untouched then.
+ *
+ * Counters of pushed and popped elements and waits on full or empty queue are kept, so
+ * throughput and backpressure of the stage may be monitored.
+ *
+ * \code{.cpp}
+ * swarm::bounded_queue<page> pages(1024);
+ *
+ * // fetching thread
+ * if (!pages.try_push(std::move(fetched)))
+ *     backlog.push_back(std::move(fetched));
+ *
+ * // parsing thread
+ * std::vector<page> batch;
+ * while (pages.pop_batch(batch, 16)) {
+ *     for (auto it = batch.begin(); it != batch.end(); ++it)
+ *         parse(*it);
+ *     batch.clear();
+ * }
+ * \endcode
+ */
+template <typename T>
+class bounded_queue
+{
+public:
+	/*!
+	 * \brief The stats struct describes the number of operations done by the queue.
+	 */
+	struct stats
+	{
+		//! Number of pushed elements
+		uint64_t pushed;
+		//! Number of popped elements
+		uint64_t popped;
+		//! Number of times producers waited for the free space, it's the measure of backpressure
+		uint64_t full_waits;
+		//! Number of times consumers waited for elements
+		uint64_t empty_waits;
+	};
+
+	/*!
+	 * \brief Constructs queue for \a capacity elements, it's rounded up to the power of two.
+	 */
+	explicit bounded_queue(size_t capacity) :
+		m_mask(round_up(capacity) - 1), m_cells(new cell[m_mask + 1]),
+		m_closed(false), m_waiting_producers(0), m_waiting_consumers(0)
+	{
+		for (size_t i = 0; i <= m_mask; ++i)
+			m_cells[i].sequence.store(i, std::memory_order_relaxed);
+
+		m_enqueue_position.store(0, std::memory_order_relaxed);
+		m_dequeue_position.store(0, std::memory_order_relaxed);
+		m_pushed.store(0, std::memory_order_relaxed);
+		m_popped.store(0, std::memory_order_relaxed);
+		m_full_waits.store(0, std::memory_order_relaxed);
+		m_empty_waits.store(0, std::memory_order_relaxed);
+	}
+
+	bounded_queue(const bounded_queue &other) = delete;
+
+	~bounded_queue()
+	{
+		T value;
+		while (try_pop_impl(value))
+			;
+	}
+
+	bounded_queue &operator =(const bounded_queue &other) = delete;
+
+	/*!
+	 * \brief Pushes \a value to the queue if there is free space.
+	 *
+	 * Returns false if the queue is full or closed, \a value is left untouched then.
+	 */
+	bool try_push(T &&value)
+	{
+		if (m_closed.load(std::memory_order_relaxed) || !try_push_impl(value))
+			return false;
+
+		notify(m_waiting_consumers, m_not_empty);
+		return true;
+	}
+
+	/*!
+	 * \brief Pushes \a value to the queue, waits while the queue is full.
+	 *
+	 * Returns false if the queue is closed.
+	 */
+	bool push(T &&value)
+	{
+		if (try_push(std::move(value)))
+			return true;
+		if (m_closed.load(std::memory_order_relaxed))
+			return false;
+
+		m_full_waits.fetch_add(1, std::memory_order_relaxed);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_waiting_producers.fetch_add(1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		bool result = false;
+		for (;;) {
+			if (m_closed.load(std::memory_order_relaxed))
+				break;
+			if (try_push_impl(value)) {
+				result = true;
+				break;
+			}
+			m_not_full.wait(lock);
+		}
+
+		m_waiting_producers.fetch_sub(1);
+		lock.unlock();
+
+		if (result)
+			notify(m_waiting_consumers, m_not_empty);
+		return result;
+	}
+
+	/*!
+	 * \brief Pops the element to \a value if the queue is not empty.
+	 */
+	bool try_pop(T &value)
+	{
+		if (!try_pop_impl(value))
+			return false;
+
+		notify(m_waiting_producers, m_not_full);
+		return true;
+	}
+
+	/*!
+	 * \brief Pops the element to \a value, waits while the queue is empty.
+	 *
+	 * Returns false if the queue is closed and there are no elements left.
+	 */
+	bool pop(T &value)
+	{
+		if (try_pop(value))
+			return true;
+
+		if (!wait_not_empty(value))
+			return false;
+
+		notify(m_waiting_producers, m_not_full);
+		return true;
+	}
+
+	/*!
+	 * \brief Pops up to \a limit elements to the end of \a values without waiting.
+	 *
+	 * Returns number of popped elements.
+	 */
+	size_t try_pop_batch(std::vector<T> &values, size_t limit)
+	{
+		size_t count = 0;
+		T value;
+		for (; count < limit && try_pop_impl(value); ++count)
+			values.push_back(std::move(value));
+
+		if (count > 0)
+			notify(m_waiting_producers, m_not_full, count > 1);
+		return count;
+	}
+
+	/*!
+	 * \brief Pops up to \a limit elements to the end of \a values, waits for at least one.
+	 *
+	 * Returns number of popped elements, zero if the queue is closed and there are no elements left.
+	 */
+	size_t pop_batch(std::vector<T> &values, size_t limit)
+	{
+		if (limit == 0)
+			return 0;
+
+		size_t count = try_pop_batch(values, limit);
+		if (count > 0)
+			return count;
+
+		T value;
+		if (!wait_not_empty(value))
+			return 0;
+
+		values.push_back(std::move(value));
+		count = 1;
+		for (; count < limit && try_pop_impl(value); ++count)
+			values.push_back(std::move(value));
+
+		notify(m_waiting_producers, m_not_full, count > 1);
+		return count;
+	}
+
+	/*!
+	 * \brief Closes the queue, all waiting threads are woken up.
+	 *
+	 * Pushes fail after the queue is closed, elements left in the queue may still be popped.
+	 */
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closed.store(true);
+		m_not_full.notify_all();
+		m_not_empty.notify_all();
+	}
+
+	/*!
+	 * \brief Returns true if the queue is closed.
+	 */
+	bool closed() const
+	{
+		return m_closed.load();
+	}
+
+	/*!
+	 * \brief Returns approximate number of elements in the queue.
+	 */
+	size_t size() const
+	{
+		const size_t enqueued = m_enqueue_position.load(std::memory_order_relaxed);
+		const size_t dequeued = m_dequeue_position.load(std::memory_order_relaxed);
+		return enqueued > dequeued ? enqueued - dequeued : 0;
+	}
+
+	/*!
+	 * \brief Returns the maximum number of elements in the queue.
+	 */
+	size_t capacity() const
+	{
+		return m_mask + 1;
+	}
+
+	/*!
+	 * \brief Returns counters of the queue.
+	 */
+	stats statistics() const
+	{
+		stats result;
+		result.pushed = m_pushed.load(std::memory_order_relaxed);
+		result.popped = m_popped.load(std::memory_order_relaxed);
+		result.full_waits = m_full_waits.load(std::memory_order_relaxed);
+		result.empty_waits = m_empty_waits.load(std::memory_order_relaxed);
+		return result;
+	}
+
+private:
+	struct cell
+	{
+		std::atomic<size_t> sequence;
+		typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage;
+	};
+
+	// Positions are kept on different cache lines, so producers and consumers don't share them
+	struct padded_position
+	{
+		std::atomic<size_t> value;
+		char padding[64 - sizeof(std::atomic<size_t>)];
+
+		size_t load(std::memory_order order) const { return value.load(order); }
+		void store(size_t position, std::memory_order order) { value.store(position, order); }
+		bool compare_exchange_weak(size_t &expected, size_t desired, std::memory_order order)
+		{
+			return value.compare_exchange_weak(expected, desired, order);
+		}
+	};
+
+	static size_t round_up(size_t capacity)
+	{
+		size_t result = 2;
+		while (result < capacity)
+			result *= 2;
+		return result;
+	}
+
+	bool try_push_impl(T &value)
+	{
+		cell *target;
+		size_t position = m_enqueue_position.load(std::memory_order_relaxed);
+
+		for (;;) {
+			target = &m_cells[position & m_mask];
+			const size_t sequence = target->sequence.load(std::memory_order_acquire);
+			const intptr_t difference = intptr_t(sequence) - intptr_t(position);
+
+			if (difference == 0) {
+				if (m_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			} else if (difference < 0) {
+				// Consumer hasn't freed the cell yet, the queue is full
+				return false;
+			} else {
+				position = m_enqueue_position.load(std::memory_order_relaxed);
+			}
+		}
+
+		new (&target->storage) T(std::move(value));
+		target->sequence.store(position + 1, std::memory_order_release);
+		m_pushed.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	bool try_pop_impl(T &value)
+	{
+		cell *target;
+		size_t position = m_dequeue_position.load(std::memory_order_relaxed);
+
+		for (;;) {
+			target = &m_cells[position & m_mask];
+			const size_t sequence = target->sequence.load(std::memory_order_acquire);
+			const intptr_t difference = intptr_t(sequence) - intptr_t(position + 1);
+
+			if (difference == 0) {
+				if (m_dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			} else if (difference < 0) {
+				// Producer hasn't filled the cell yet, the queue is empty
+				return false;
+			} else {
+				position = m_dequeue_position.load(std::memory_order_relaxed);
+			}
+		}
+
+		T *element = reinterpret_cast<T *>(&target->storage);
+		value = std::move(*element);
+		element->~T();
+		target->sequence.store(position + m_mask + 1, std::memory_order_release);
+		m_popped.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	bool wait_not_empty(T &value)
+	{
+		m_empty_waits.fetch_add(1, std::memory_order_relaxed);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_waiting_consumers.fetch_add(1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		bool result = false;
+		for (;;) {
+			if (try_pop_impl(value)) {
+				result = true;
+				break;
+			}
+			if (m_closed.load(std::memory_order_relaxed))
+				break;
+			m_not_empty.wait(lock);
+		}
+
+		m_waiting_consumers.fetch_sub(1);
+		return result;
+	}
+
+	/*
+	 * Wakes up threads waiting for the opposite side, the mutex is taken only if there are any.
+	 * Fence pairs with the one made by the waiting thread after it's counter is incremented,
+	 * so either the waiter sees the change or the counter is seen here
+	 */
+	void notify(std::atomic<int> &waiting, std::condition_variable &condition, bool all = false)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiting.load(std::memory_order_relaxed) == 0)
+			return;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (all)
+			condition.notify_all();
+		else
+			condition.notify_one();
+	}
+
+	const size_t m_mask;
+	std::unique_ptr<cell[]> m_cells;
+	padded_position m_enqueue_position;
+	padded_position m_dequeue_position;
+
+	std::atomic<bool> m_closed;
+	std::atomic<int> m_waiting_producers;
+	std::atomic<int> m_waiting_consumers;
+	std::mutex m_mutex;
+	std::condition_variable m_not_full;
+	std::condition_variable m_not_empty;
+
+	std::atomic<uint64_t> m_pushed;
+	std::atomic<uint64_t> m_popped;
+	std::atomic<uint64_t> m_full_waits;
+	std::atomic<uint64_t> m_empty_waits;
+};
+
+}} // namespace ioremap::swarm
+
+#endif // IOREMAP_SWARM_CRAWLER_BOUNDED_QUEUE_HPP
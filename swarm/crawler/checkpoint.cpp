@@ -0,0 +1,63 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "checkpoint_p.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace ioremap {
+namespace swarm {
+
+int commit_checkpoint(FILE *file, bool ok, int err, const std::string &tmp_path, const std::string &path)
+{
+	// Without sync rename may reach the disk before the data and the checkpoint is empty after the crash
+	if (ok && (fflush(file) != 0 || fsync(fileno(file)) != 0)) {
+		err = errno;
+		ok = false;
+	}
+
+	if (fclose(file) != 0 && ok) {
+		err = errno;
+		ok = false;
+	}
+
+	if (ok && rename(tmp_path.c_str(), path.c_str()) != 0) {
+		err = errno;
+		ok = false;
+	}
+
+	if (!ok) {
+		unlink(tmp_path.c_str());
+		return err ? err : EIO;
+	}
+
+	// Rename itself is durable only once the directory is synced
+	const size_t slash = path.find_last_of('/');
+	const std::string directory = slash == std::string::npos ? "." : path.substr(0, slash ? slash : 1);
+
+	const int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return errno;
+
+	const int result = fsync(fd) != 0 ? errno : 0;
+	close(fd);
+	return result;
+}
+
+}} // namespace ioremap::swarm
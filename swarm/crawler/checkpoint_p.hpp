@@ -0,0 +1,39 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef IOREMAP_SWARM_CRAWLER_CHECKPOINT_P_HPP
+#define IOREMAP_SWARM_CRAWLER_CHECKPOINT_P_HPP
+
+#include <string>
+#include <stdio.h>
+
+namespace ioremap {
+namespace swarm {
+
+/*
+ * Finishes the checkpoint written to \a file at \a tmp_path and atomically replaces \a path by it.
+ *
+ * \a ok tells if all data was written, \a err is errno of the failed write otherwise.
+ * The file is synced to the disk before rename and the directory is synced after it,
+ * so after the crash there is either the previous checkpoint or the complete new one.
+ * Returns zero on success and errno otherwise, the temporary file is removed on error.
+ */
+int commit_checkpoint(FILE *file, bool ok, int err, const std::string &tmp_path, const std::string &path);
+
+}} // namespace ioremap::swarm
+
+#endif // IOREMAP_SWARM_CRAWLER_CHECKPOINT_P_HPP
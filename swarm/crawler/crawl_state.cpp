@@ -0,0 +1,293 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "crawl_state.hpp"
+#include "checkpoint_p.hpp"
+#include "frontier.hpp"
+#include "hash.hpp"
+#include "seen_set.hpp"
+
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ioremap {
+namespace swarm {
+
+// "SWSTAT01" in little endian
+static const uint64_t checkpoint_magic = 0x3130544154535753ULL;
+
+/*
+ * Validators are written to the disk as this header followed by ETag and Last-Modified values
+ */
+struct validators_header
+{
+	uint64_t fingerprint;
+	uint64_t content_hash;
+	int64_t timestamp;
+	uint32_t etag_size;
+	uint32_t last_modified_size;
+};
+
+static std::runtime_error make_error(const std::string &message, int err)
+{
+	return std::runtime_error(message + ": " + strerror(err));
+}
+
+class crawl_state_private
+{
+public:
+	mutable std::mutex mutex;
+	// Keyed by url's fingerprint in the seen set
+	std::unordered_map<uint64_t, page_validators> validators;
+};
+
+crawl_state::crawl_state() : m_data(new crawl_state_private)
+{
+}
+
+crawl_state::~crawl_state()
+{
+}
+
+bool crawl_state::update(const std::string &url, const http_headers &headers, const std::string &body)
+{
+	page_validators validators;
+	if (auto etag = headers.etag())
+		validators.etag = *etag;
+	if (auto last_modified = headers.last_modified_string())
+		validators.last_modified = *last_modified;
+	validators.content_hash = hash64(body);
+	validators.timestamp = time(NULL);
+
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+
+	page_validators &current = m_data->validators[seen_set::fingerprint(url)];
+	const bool changed = current.timestamp == 0 || current.content_hash != validators.content_hash;
+	current = std::move(validators);
+
+	return changed;
+}
+
+void crawl_state::update(const std::string &url, const page_validators &validators)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->validators[seen_set::fingerprint(url)] = validators;
+}
+
+bool crawl_state::find(const std::string &url, page_validators &validators) const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+
+	auto it = m_data->validators.find(seen_set::fingerprint(url));
+	if (it == m_data->validators.end())
+		return false;
+
+	validators = it->second;
+	return true;
+}
+
+bool crawl_state::prepare_request(const std::string &url, http_request &request) const
+{
+	page_validators validators;
+	if (!find(url, validators))
+		return false;
+
+	// Values are sent back exactly as the server has given them
+	if (!validators.etag.empty())
+		request.headers().set_if_none_match(validators.etag);
+	if (!validators.last_modified.empty())
+		request.headers().set_if_modified_since(validators.last_modified);
+
+	return !validators.etag.empty() || !validators.last_modified.empty();
+}
+
+size_t crawl_state::size() const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	return m_data->validators.size();
+}
+
+void crawl_state::save(const std::string &path) const
+{
+	const std::string tmp_path = path + ".tmp";
+	FILE *file = fopen(tmp_path.c_str(), "wb");
+	if (!file)
+		throw make_error("can not create crawl state's checkpoint \"" + tmp_path + "\"", errno);
+
+	bool ok = fwrite(&checkpoint_magic, sizeof(checkpoint_magic), 1, file) == 1;
+
+	{
+		std::lock_guard<std::mutex> lock(m_data->mutex);
+
+		for (auto it = m_data->validators.begin(); ok && it != m_data->validators.end(); ++it) {
+			const page_validators &validators = it->second;
+
+			validators_header header;
+			header.fingerprint = it->first;
+			header.content_hash = validators.content_hash;
+			header.timestamp = validators.timestamp;
+			header.etag_size = validators.etag.size();
+			header.last_modified_size = validators.last_modified.size();
+
+			ok = fwrite(&header, sizeof(header), 1, file) == 1
+				&& fwrite(validators.etag.c_str(), 1, header.etag_size, file) == header.etag_size
+				&& fwrite(validators.last_modified.c_str(), 1, header.last_modified_size, file) == header.last_modified_size;
+		}
+	}
+
+	const int err = commit_checkpoint(file, ok, errno, tmp_path, path);
+	if (err)
+		throw make_error("can not write crawl state's checkpoint \"" + path + "\"", err);
+}
+
+bool crawl_state::load(const std::string &path)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file) {
+		if (errno == ENOENT)
+			return false;
+		throw make_error("can not open crawl state's checkpoint \"" + path + "\"", errno);
+	}
+
+	uint64_t magic = 0;
+	bool ok = fread(&magic, sizeof(magic), 1, file) == 1 && magic == checkpoint_magic;
+
+	std::unordered_map<uint64_t, page_validators> loaded;
+	validators_header header;
+	while (ok && fread(&header, sizeof(header), 1, file) == 1) {
+		page_validators &validators = loaded[header.fingerprint];
+		validators.content_hash = header.content_hash;
+		validators.timestamp = header.timestamp;
+		validators.etag.resize(header.etag_size);
+		validators.last_modified.resize(header.last_modified_size);
+
+		ok = (header.etag_size == 0 || fread(&validators.etag[0], 1, header.etag_size, file) == header.etag_size)
+			&& (header.last_modified_size == 0
+				|| fread(&validators.last_modified[0], 1, header.last_modified_size, file) == header.last_modified_size);
+	}
+
+	fclose(file);
+
+	if (!ok)
+		throw std::runtime_error("invalid crawl state's checkpoint \"" + path + "\"");
+
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	for (auto it = loaded.begin(); it != loaded.end(); ++it)
+		m_data->validators[it->first] = std::move(it->second);
+
+	return true;
+}
+
+static const char *checkpoint_files[] = { "seen.bin", "frontier.bin", "state.bin" };
+
+static std::string generation_directory(const std::string &directory, unsigned long long generation)
+{
+	return directory + "/generation-" + std::to_string(generation);
+}
+
+/*
+ * Returns the generation the "current" file of \a directory points to, zero if there is no checkpoint
+ */
+static unsigned long long current_generation(const std::string &directory)
+{
+	const std::string path = directory + "/current";
+	FILE *file = fopen(path.c_str(), "r");
+	if (!file) {
+		if (errno == ENOENT)
+			return 0;
+		throw make_error("can not open checkpoint's pointer \"" + path + "\"", errno);
+	}
+
+	unsigned long long generation = 0;
+	const bool ok = fscanf(file, "%llu", &generation) == 1 && generation > 0;
+	fclose(file);
+
+	if (!ok)
+		throw std::runtime_error("invalid checkpoint's pointer \"" + path + "\"");
+	return generation;
+}
+
+/*
+ * Removes files of the generation, errors are ignored as the generation is not used anymore
+ */
+static void remove_generation(const std::string &directory)
+{
+	for (size_t i = 0; i < sizeof(checkpoint_files) / sizeof(checkpoint_files[0]); ++i) {
+		const std::string path = directory + "/" + checkpoint_files[i];
+		unlink(path.c_str());
+		unlink((path + ".tmp").c_str());
+	}
+	rmdir(directory.c_str());
+}
+
+void crawl_state::checkpoint(const std::string &directory, const crawl_frontier &frontier, const seen_set &seen) const
+{
+	if (mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST)
+		throw make_error("can not create checkpoint's directory \"" + directory + "\"", errno);
+
+	/*
+	 * All parts are written to the new generation's directory which is committed by the single
+	 * rename of "current" pointer, so after the crash seen set, frontier and validators are always
+	 * of the same checkpoint. Otherwise new seen set with the old frontier would lose urls found since
+	 * the previous checkpoint: they are seen, but are not in any frontier.
+	 */
+	const unsigned long long previous = current_generation(directory);
+	const std::string generation = generation_directory(directory, previous + 1);
+
+	// It may be left by the checkpoint interrupted by the crash
+	remove_generation(generation);
+	if (mkdir(generation.c_str(), 0755) < 0)
+		throw make_error("can not create checkpoint's directory \"" + generation + "\"", errno);
+
+	seen.save(generation + "/seen.bin");
+	frontier.save(generation + "/frontier.bin");
+	save(generation + "/state.bin");
+
+	const std::string path = directory + "/current";
+	const std::string tmp_path = path + ".tmp";
+	FILE *file = fopen(tmp_path.c_str(), "w");
+	if (!file)
+		throw make_error("can not create checkpoint's pointer \"" + tmp_path + "\"", errno);
+
+	const bool ok = fprintf(file, "%llu\n", previous + 1) > 0;
+	const int err = commit_checkpoint(file, ok, errno, tmp_path, path);
+	if (err)
+		throw make_error("can not write checkpoint's pointer \"" + path + "\"", err);
+
+	if (previous > 0)
+		remove_generation(generation_directory(directory, previous));
+}
+
+bool crawl_state::restore(const std::string &directory, crawl_frontier &frontier, seen_set &seen)
+{
+	const unsigned long long generation = current_generation(directory);
+	if (generation == 0)
+		return false;
+
+	const std::string path = generation_directory(directory, generation);
+	if (!seen.load(path + "/seen.bin") || !frontier.load(path + "/frontier.bin") || !load(path + "/state.bin"))
+		throw std::runtime_error("incomplete checkpoint \"" + path + "\"");
+	return true;
+}
+
+}} // namespace ioremap::swarm
@@ -0,0 +1,156 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOREMAP_SWARM_CRAWLER_CRAWL_STATE_HPP
+#define IOREMAP_SWARM_CRAWLER_CRAWL_STATE_HPP
+
+#include "../http_request.hpp"
+
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+
+namespace ioremap {
+namespace swarm {
+
+class crawl_state_private;
+class crawl_frontier;
+class seen_set;
+
+/*!
+ * \brief The page_validators struct describes what is known about the last fetched version of the document.
+ */
+struct page_validators
+{
+	page_validators() : content_hash(0), timestamp(0)
+	{
+	}
+
+	//! Value of the document's ETag header, empty if there was no one
+	std::string etag;
+	//! Value of the document's Last-Modified header, empty if there was no one
+	std::string last_modified;
+	//! Hash of the document's body
+	uint64_t content_hash;
+	//! Time the document was fetched at
+	time_t timestamp;
+};
+
+/*!
+ * \brief The crawl_state class keeps per-url validators and checkpoints the whole crawl.
+ *
+ * Validators of fetched documents are used on re-crawl to send conditional requests,
+ * so unchanged documents cost 304 Not Modified reply instead of the full body. If the
+ * server doesn't support validators content hash still tells whether the document is changed.
+ *
+ * The whole crawl, i.e. frontier, seen set and validators, may be checkpointed to the directory
+ * and restored from it after restart. Checkpoint is expected to be done periodically by the timer.
+ *
+ * The state is thread-safe.
+ *
+ * \code{.cpp}
+ * swarm::crawl_state state;
+ * state.restore("/var/lib/crawler/state", frontier, seen);
+ *
+ * // before the request is sent
+ * state.prepare_request(entry.url, request);
+ *
+ * // once the reply is received
+ * if (reply.code() == 304 || !state.update(url, reply.headers(), data))
+ *     return; // nothing changed
+ *
+ * // every few minutes
+ * state.checkpoint("/var/lib/crawler/state", frontier, seen);
+ * \endcode
+ */
+class crawl_state
+{
+public:
+	/*!
+	 * \brief Constructs empty state.
+	 */
+	crawl_state();
+	crawl_state(const crawl_state &other) = delete;
+	~crawl_state();
+
+	crawl_state &operator =(const crawl_state &other) = delete;
+
+	/*!
+	 * \brief Remembers validators of the fetched document at \a url with reply's \a headers and \a body.
+	 *
+	 * Returns true if the document is new or it's body is changed since the last fetch.
+	 */
+	bool update(const std::string &url, const http_headers &headers, const std::string &body);
+	/*!
+	 * \brief Remembers \a validators of the document at \a url.
+	 */
+	void update(const std::string &url, const page_validators &validators);
+	/*!
+	 * \brief Finds validators of the document at \a url.
+	 *
+	 * Returns false if the document was never fetched.
+	 */
+	bool find(const std::string &url, page_validators &validators) const;
+	/*!
+	 * \brief Makes \a request for \a url conditional if the document was already fetched.
+	 *
+	 * If-None-Match header is set if the document had ETag, If-Modified-Since is set
+	 * if it had Last-Modified. Returns true if any of them is set.
+	 */
+	bool prepare_request(const std::string &url, http_request &request) const;
+
+	/*!
+	 * \brief Returns number of known documents.
+	 */
+	size_t size() const;
+
+	/*!
+	 * \brief Saves validators of all documents to \a path.
+	 *
+	 * Throws std::runtime_error on error.
+	 */
+	void save(const std::string &path) const;
+	/*!
+	 * \brief Loads validators saved to \a path.
+	 *
+	 * Returns false if there is no such file. Throws std::runtime_error if the file is broken.
+	 */
+	bool load(const std::string &path);
+
+	/*!
+	 * \brief Saves \a frontier, \a seen set and the state itself to \a directory.
+	 *
+	 * All parts are written to the new generation's subdirectory which is committed by atomic
+	 * replace of the "current" file, so the previous checkpoint is kept intact on failure or crash
+	 * and parts of different checkpoints are never mixed. Throws std::runtime_error on error.
+	 */
+	void checkpoint(const std::string &directory, const crawl_frontier &frontier, const seen_set &seen) const;
+	/*!
+	 * \brief Restores \a frontier, \a seen set and the state itself from \a directory.
+	 *
+	 * Only the generation "current" file points to is read. Returns false if there is no checkpoint
+	 * in the directory. Throws std::runtime_error if it's broken.
+	 */
+	bool restore(const std::string &directory, crawl_frontier &frontier, seen_set &seen);
+
+private:
+	std::unique_ptr<crawl_state_private> m_data;
+};
+
+}} // namespace ioremap::swarm
+
+#endif // IOREMAP_SWARM_CRAWLER_CRAWL_STATE_HPP
@@ -0,0 +1,250 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "dns_resolver.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+
+namespace ioremap {
+namespace swarm {
+
+typedef std::chrono::steady_clock dns_clock;
+
+enum {
+	// Expired entries are removed from the cache once per this number of prefetches
+	cleanup_period = 4096,
+	// Host is not resolved again for this number of seconds after temporary failure
+	retry_delay = 5
+};
+
+struct dns_entry
+{
+	dns_entry() : state(dns_resolver::pending)
+	{
+	}
+
+	dns_resolver::status state;
+	std::string address;
+	dns_clock::time_point expires;
+};
+
+/*
+ * Only these errors say that the host doesn't exist, the rest of them like EAI_AGAIN may be temporary
+ */
+static bool is_permanent_error(int error)
+{
+#ifdef EAI_NODATA
+	if (error == EAI_NODATA)
+		return true;
+#endif
+	return error == EAI_NONAME;
+}
+
+/*
+ * Returns the first address of \a host, empty string if it can not be resolved,
+ * \a error is set to getaddrinfo's error code then
+ */
+static std::string resolve_host(const std::string &host, int &error)
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_ADDRCONFIG;
+
+	struct addrinfo *result = NULL;
+	error = getaddrinfo(host.c_str(), NULL, &hints, &result);
+	if (error != 0 || !result)
+		return std::string();
+
+	char buffer[INET6_ADDRSTRLEN] = { 0 };
+	const void *address = NULL;
+	if (result->ai_family == AF_INET)
+		address = &reinterpret_cast<struct sockaddr_in *>(result->ai_addr)->sin_addr;
+	else if (result->ai_family == AF_INET6)
+		address = &reinterpret_cast<struct sockaddr_in6 *>(result->ai_addr)->sin6_addr;
+
+	if (!address || !inet_ntop(result->ai_family, address, buffer, sizeof(buffer)))
+		buffer[0] = '\0';
+
+	freeaddrinfo(result);
+	return buffer;
+}
+
+class dns_resolver_private
+{
+public:
+	dns_resolver_private() : ttl(300), negative_ttl(600), stopped(false), prefetches(0)
+	{
+	}
+
+	void cleanup()
+	{
+		const dns_clock::time_point now = dns_clock::now();
+		for (auto it = cache.begin(); it != cache.end();) {
+			if (it->second.state != dns_resolver::pending && it->second.expires <= now)
+				it = cache.erase(it);
+			else
+				++it;
+		}
+	}
+
+	void run()
+	{
+		prctl(PR_SET_NAME, "swarm-dns");
+
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;) {
+			while (queue.empty() && !stopped)
+				condition.wait(lock);
+			if (stopped)
+				break;
+
+			const std::string host = queue.front();
+			queue.pop_front();
+
+			lock.unlock();
+			int error = 0;
+			const std::string address = resolve_host(host, error);
+			lock.lock();
+
+			dns_entry &entry = cache[host];
+			if (address.empty() && is_permanent_error(error)) {
+				entry.state = dns_resolver::failed;
+				entry.expires = dns_clock::now() + std::chrono::seconds(negative_ttl);
+			} else if (address.empty()) {
+				// Nothing is known, so curl resolves the host itself until the retry
+				entry.state = dns_resolver::unknown;
+				entry.expires = dns_clock::now() + std::chrono::seconds(retry_delay);
+			} else {
+				entry.state = dns_resolver::resolved;
+				entry.address = address;
+				entry.expires = dns_clock::now() + std::chrono::seconds(ttl);
+			}
+		}
+	}
+
+	long ttl;
+	long negative_ttl;
+	bool stopped;
+	size_t prefetches;
+
+	mutable std::mutex mutex;
+	std::condition_variable condition;
+	std::deque<std::string> queue;
+	std::unordered_map<std::string, dns_entry> cache;
+	std::vector<std::thread> threads;
+};
+
+dns_resolver::dns_resolver(size_t threads) : m_data(new dns_resolver_private)
+{
+	if (threads == 0)
+		threads = 1;
+
+	for (size_t i = 0; i < threads; ++i)
+		m_data->threads.emplace_back(std::bind(&dns_resolver_private::run, m_data.get()));
+}
+
+dns_resolver::~dns_resolver()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_data->mutex);
+		m_data->stopped = true;
+		m_data->condition.notify_all();
+	}
+
+	for (auto it = m_data->threads.begin(); it != m_data->threads.end(); ++it)
+		it->join();
+}
+
+void dns_resolver::set_ttl(long ttl)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->ttl = ttl;
+}
+
+void dns_resolver::set_negative_ttl(long ttl)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->negative_ttl = ttl;
+}
+
+void dns_resolver::prefetch(const std::string &host)
+{
+	if (host.empty())
+		return;
+
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+
+	if (++m_data->prefetches % cleanup_period == 0)
+		m_data->cleanup();
+
+	auto it = m_data->cache.find(host);
+	if (it != m_data->cache.end()) {
+		if (it->second.state == pending || it->second.expires > dns_clock::now())
+			return;
+		it->second.state = pending;
+	} else {
+		m_data->cache[host];
+	}
+
+	m_data->queue.push_back(host);
+	m_data->condition.notify_one();
+}
+
+dns_resolver::status dns_resolver::lookup(const std::string &host, std::string &address) const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+
+	auto it = m_data->cache.find(host);
+	if (it == m_data->cache.end())
+		return unknown;
+
+	const dns_entry &entry = it->second;
+	if (entry.state != pending && entry.expires <= dns_clock::now())
+		return unknown;
+
+	if (entry.state == resolved)
+		address = entry.address;
+	return entry.state;
+}
+
+size_t dns_resolver::size() const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	return m_data->cache.size();
+}
+
+size_t dns_resolver::queued() const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	return m_data->queue.size();
+}
+
+}} // namespace ioremap::swarm
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOREMAP_SWARM_CRAWLER_DNS_RESOLVER_HPP
+#define IOREMAP_SWARM_CRAWLER_DNS_RESOLVER_HPP
+
+#include <memory>
+#include <string>
+
+namespace ioremap {
+namespace swarm {
+
+class dns_resolver_private;
+
+/*!
+ * \brief The dns_resolver class resolves host names in advance by the pool of threads.
+ *
+ * Hosts are resolved by getaddrinfo as soon as they are prefetched, so by the time the first
+ * request to the host is started it's address is usually known and may be passed to the
+ * url fetcher by url_fetcher::request::set_resolve, curl doesn't block on DNS then.
+ *
+ * Both successful and failed lookups are cached, so dead domains are not resolved again until
+ * the negative TTL is expired. Only lookups which tell that the host doesn't exist (EAI_NONAME
+ * and EAI_NODATA) are cached as failed, temporary errors like EAI_AGAIN leave the host unknown
+ * and it's resolved again a few seconds later.
+ *
+ * The resolver is thread-safe.
+ *
+ * \code{.cpp}
+ * swarm::dns_resolver resolver(8);
+ * frontier.set_resolver(&resolver);
+ * \endcode
+ *
+ * \sa url_fetcher::request::set_resolve
+ */
+class dns_resolver
+{
+public:
+	/*!
+	 * \brief The status enum describes what is known about the host.
+	 */
+	enum status {
+		//! Host was never prefetched, it's result is expired or it's lookup has failed temporarily
+		unknown,
+		//! Host is being resolved right now
+		pending,
+		//! Host is resolved
+		resolved,
+		//! Host doesn't exist
+		failed
+	};
+
+	/*!
+	 * \brief Constructs resolver with \a threads resolving threads.
+	 */
+	dns_resolver(size_t threads = 4);
+	dns_resolver(const dns_resolver &other) = delete;
+	/*!
+	 * \brief Stops resolving threads, hosts in the queue are not resolved.
+	 */
+	~dns_resolver();
+
+	dns_resolver &operator =(const dns_resolver &other) = delete;
+
+	/*!
+	 * \brief Sets the time resolved addresses are cached to \a ttl seconds.
+	 *
+	 * By default this property is set to 300 seconds.
+	 */
+	void set_ttl(long ttl);
+	/*!
+	 * \brief Sets the time failed lookups are cached to \a ttl seconds.
+	 *
+	 * By default this property is set to 600 seconds.
+	 */
+	void set_negative_ttl(long ttl);
+
+	/*!
+	 * \brief Starts resolving of \a host in background unless it's already known or pending.
+	 */
+	void prefetch(const std::string &host);
+	/*!
+	 * \brief Returns what is known about \a host, it's address is written to \a address if it's resolved.
+	 *
+	 * It never blocks.
+	 */
+	status lookup(const std::string &host, std::string &address) const;
+
+	/*!
+	 * \brief Returns number of hosts in the cache, including failed ones.
+	 */
+	size_t size() const;
+	/*!
+	 * \brief Returns number of hosts waiting to be resolved.
+	 */
+	size_t queued() const;
+
+private:
+	std::unique_ptr<dns_resolver_private> m_data;
+};
+
+}} // namespace ioremap::swarm
+
+#endif // IOREMAP_SWARM_CRAWLER_DNS_RESOLVER_HPP
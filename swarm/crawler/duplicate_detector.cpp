@@ -0,0 +1,344 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "duplicate_detector.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include <string.h>
+#include <strings.h>
+
+namespace ioremap {
+namespace swarm {
+
+static bool is_word_char(char c)
+{
+	// Bytes of UTF-8 sequences are considered to be parts of words
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || (c & 0x80);
+}
+
+static bool starts_with(const char *it, const char *end, const char *prefix, size_t size)
+{
+	return size_t(end - it) >= size && strncasecmp(it, prefix, size) == 0;
+}
+
+/*
+ * Skips the tag starting at \a it, content of scripts, styles and comments is skipped too
+ */
+static const char *skip_tag(const char *it, const char *end)
+{
+	if (starts_with(it, end, "<!--", 4)) {
+		for (it += 4; it < end; ++it) {
+			if (starts_with(it, end, "-->", 3))
+				return it + 3;
+		}
+		return end;
+	}
+
+	const char *closing = NULL;
+	size_t closing_size = 0;
+	if (starts_with(it, end, "<script", 7)) {
+		closing = "</script";
+		closing_size = 8;
+	} else if (starts_with(it, end, "<style", 6)) {
+		closing = "</style";
+		closing_size = 7;
+	}
+
+	it = reinterpret_cast<const char *>(memchr(it, '>', end - it));
+	if (!it)
+		return end;
+	++it;
+
+	if (!closing)
+		return it;
+
+	for (; it < end; ++it) {
+		if (*it == '<' && starts_with(it, end, closing, closing_size))
+			return skip_tag(it, end);
+	}
+
+	return end;
+}
+
+/*
+ * Accumulates hashes of shingles into SimHash's counters
+ */
+class simhash_builder
+{
+public:
+	simhash_builder(size_t shingle_size) : m_window(std::max<size_t>(1, shingle_size)), m_words(0)
+	{
+		memset(m_counters, 0, sizeof(m_counters));
+	}
+
+	void add_word(const char *word, size_t size)
+	{
+		// FNV-1a of the lowercased word, so "Page" and "page" are the same
+		uint64_t hash = 0xcbf29ce484222325ULL;
+		for (size_t i = 0; i < size; ++i) {
+			char c = word[i];
+			if (c >= 'A' && c <= 'Z')
+				c += 'a' - 'A';
+			hash = (hash ^ uint8_t(c)) * 0x100000001b3ULL;
+		}
+
+		m_window[m_words % m_window.size()] = hash;
+		++m_words;
+
+		if (m_words >= m_window.size())
+			add_shingle(m_window.size());
+	}
+
+	uint64_t result()
+	{
+		if (m_words == 0)
+			return 0;
+
+		// Too short text is a single shingle
+		if (m_words < m_window.size())
+			add_shingle(m_words);
+
+		uint64_t result = 0;
+		for (size_t i = 0; i < 64; ++i) {
+			if (m_counters[i] > 0)
+				result |= uint64_t(1) << i;
+		}
+		return result;
+	}
+
+private:
+	void add_shingle(size_t size)
+	{
+		uint64_t shingle[16];
+		size = std::min(size, sizeof(shingle) / sizeof(shingle[0]));
+
+		for (size_t i = 0; i < size; ++i)
+			shingle[i] = m_window[(m_words - size + i) % m_window.size()];
+
+		const uint64_t hash = hash64(reinterpret_cast<const char *>(shingle), size * sizeof(uint64_t));
+		for (size_t i = 0; i < 64; ++i)
+			m_counters[i] += (hash >> i) & 1 ? 1 : -1;
+	}
+
+	std::vector<uint64_t> m_window;
+	size_t m_words;
+	long m_counters[64];
+};
+
+static int hamming_distance(uint64_t first, uint64_t second)
+{
+	return __builtin_popcountll(first ^ second);
+}
+
+struct known_document
+{
+	uint64_t simhash;
+	std::string url;
+};
+
+class duplicate_detector_private
+{
+public:
+	duplicate_detector_private() :
+		max_distance(3), shingle_size(3), near_duplicates_enabled(true),
+		exact_duplicates(0), near_duplicates(0)
+	{
+		tables.resize(max_distance + 1);
+	}
+
+	/*
+	 * Returns the key of \a index-th block of \a simhash, blocks split 64 bits evenly
+	 */
+	uint64_t block(uint64_t simhash, size_t index) const
+	{
+		const size_t width = 64 / tables.size();
+		const size_t shift = index * width;
+		const size_t size = index + 1 == tables.size() ? 64 - shift : width;
+		const uint64_t mask = size == 64 ? ~uint64_t(0) : (uint64_t(1) << size) - 1;
+		return (simhash >> shift) & mask;
+	}
+
+	bool find_near(uint64_t simhash, uint32_t &id) const
+	{
+		for (size_t i = 0; i < tables.size(); ++i) {
+			auto it = tables[i].find(block(simhash, i));
+			if (it == tables[i].end())
+				continue;
+
+			const std::vector<uint32_t> &bucket = it->second;
+			for (auto jt = bucket.begin(); jt != bucket.end(); ++jt) {
+				if (hamming_distance(documents[*jt].simhash, simhash) <= max_distance) {
+					id = *jt;
+					return true;
+				}
+			}
+		}
+
+		return false;
+	}
+
+	mutable std::mutex mutex;
+	int max_distance;
+	size_t shingle_size;
+	bool near_duplicates_enabled;
+
+	std::vector<known_document> documents;
+	std::unordered_map<uint64_t, uint32_t> hashes;
+	std::vector<std::unordered_map<uint64_t, std::vector<uint32_t>>> tables;
+
+	size_t exact_duplicates;
+	size_t near_duplicates;
+};
+
+duplicate_detector::duplicate_detector() : m_data(new duplicate_detector_private)
+{
+}
+
+duplicate_detector::~duplicate_detector()
+{
+}
+
+void duplicate_detector::set_max_distance(int distance)
+{
+	if (distance < 0 || distance > 7)
+		throw std::invalid_argument("duplicate_detector::set_max_distance: distance must be in [0, 7]");
+
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->max_distance = distance;
+	m_data->tables.clear();
+	m_data->tables.resize(distance + 1);
+}
+
+void duplicate_detector::set_shingle_size(size_t size)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->shingle_size = std::max<size_t>(1, size);
+}
+
+void duplicate_detector::set_near_duplicates(bool enabled)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->near_duplicates_enabled = enabled;
+}
+
+uint64_t duplicate_detector::content_hash(const char *data, size_t size)
+{
+	return hash64(data, size);
+}
+
+uint64_t duplicate_detector::simhash(const char *data, size_t size, size_t shingle_size)
+{
+	simhash_builder builder(shingle_size);
+
+	const char *it = data;
+	const char *end = data + size;
+
+	while (it < end) {
+		if (*it == '<') {
+			it = skip_tag(it, end);
+		} else if (*it == '&') {
+			// Entities are not words
+			const char *semicolon = reinterpret_cast<const char *>(memchr(it, ';', std::min<size_t>(end - it, 10)));
+			it = semicolon ? semicolon + 1 : it + 1;
+		} else if (is_word_char(*it)) {
+			const char *word = it;
+			while (it < end && is_word_char(*it))
+				++it;
+			builder.add_word(word, it - word);
+		} else {
+			++it;
+		}
+	}
+
+	return builder.result();
+}
+
+duplicate_detector::result duplicate_detector::check(const std::string &url, const char *data, size_t size, std::string *original)
+{
+	size_t shingle_size;
+	bool near_duplicates_enabled;
+	{
+		std::lock_guard<std::mutex> lock(m_data->mutex);
+		shingle_size = m_data->shingle_size;
+		near_duplicates_enabled = m_data->near_duplicates_enabled;
+	}
+
+	// Hashes are calculated without the lock
+	const uint64_t hash = content_hash(data, size);
+	const uint64_t fingerprint = near_duplicates_enabled ? simhash(data, size, shingle_size) : 0;
+
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+
+	auto it = m_data->hashes.find(hash);
+	if (it != m_data->hashes.end()) {
+		if (original)
+			*original = m_data->documents[it->second].url;
+		++m_data->exact_duplicates;
+		return exact_duplicate;
+	}
+
+	uint32_t id;
+	// Documents without text are compared only by content
+	if (fingerprint != 0 && m_data->find_near(fingerprint, id)) {
+		if (original)
+			*original = m_data->documents[id].url;
+		++m_data->near_duplicates;
+		return near_duplicate;
+	}
+
+	id = m_data->documents.size();
+	known_document document = { fingerprint, url };
+	m_data->documents.emplace_back(std::move(document));
+	m_data->hashes[hash] = id;
+
+	if (fingerprint != 0) {
+		for (size_t i = 0; i < m_data->tables.size(); ++i)
+			m_data->tables[i][m_data->block(fingerprint, i)].push_back(id);
+	}
+
+	return unique;
+}
+
+duplicate_detector::result duplicate_detector::check(const std::string &url, const std::string &data, std::string *original)
+{
+	return check(url, data.c_str(), data.size(), original);
+}
+
+size_t duplicate_detector::size() const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	return m_data->documents.size();
+}
+
+size_t duplicate_detector::exact_duplicates() const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	return m_data->exact_duplicates;
+}
+
+size_t duplicate_detector::near_duplicates() const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	return m_data->near_duplicates;
+}
+
+}} // namespace ioremap::swarm
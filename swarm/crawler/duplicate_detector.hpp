@@ -0,0 +1,141 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOREMAP_SWARM_CRAWLER_DUPLICATE_DETECTOR_HPP
+#define IOREMAP_SWARM_CRAWLER_DUPLICATE_DETECTOR_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace ioremap {
+namespace swarm {
+
+class duplicate_detector_private;
+
+/*!
+ * \brief The duplicate_detector class finds exact and near duplicates among crawled documents.
+ *
+ * Exact duplicates are found by 64-bit hash of the document's body. Near duplicates are
+ * found by SimHash of the document's text: tags, scripts and styles are skipped, words
+ * are grouped into overlapping shingles and their hashes are folded into single 64-bit
+ * fingerprint, so documents which differ only by small parts (session ids, dates, counters)
+ * have fingerprints which differ only by few bits.
+ *
+ * Fingerprints are indexed by max_distance + 1 tables keyed by disjoint bit blocks, so
+ * by pigeonhole principle every fingerprint within the distance shares at least one block
+ * and only documents from matching buckets are compared.
+ *
+ * It's intended to be placed between fetch and storage, links of duplicates need not to be extracted.
+ *
+ * The detector is thread-safe.
+ *
+ * \code{.cpp}
+ * swarm::duplicate_detector detector;
+ *
+ * std::string original;
+ * if (detector.check(url, data, &original) != swarm::duplicate_detector::unique)
+ *     return; // neither store nor extract links
+ * \endcode
+ */
+class duplicate_detector
+{
+public:
+	/*!
+	 * \brief The result enum describes whether the document is a duplicate.
+	 */
+	enum result {
+		//! Document is not similar to any known one
+		unique,
+		//! Document is byte-identical to the known one
+		exact_duplicate,
+		//! Document's text is almost the same as the text of known one
+		near_duplicate
+	};
+
+	/*!
+	 * \brief Constructs empty detector.
+	 */
+	duplicate_detector();
+	duplicate_detector(const duplicate_detector &other) = delete;
+	~duplicate_detector();
+
+	duplicate_detector &operator =(const duplicate_detector &other) = delete;
+
+	/*!
+	 * \brief Sets maximum Hamming distance between near duplicates' fingerprints to \a distance bits.
+	 *
+	 * It must be called before the first check. Distance must be in [0, 7] range.
+	 * By default this property is set to 3.
+	 */
+	void set_max_distance(int distance);
+	/*!
+	 * \brief Sets the number of words in the shingle to \a size.
+	 *
+	 * It must be called before the first check. By default this property is set to 3.
+	 */
+	void set_shingle_size(size_t size);
+	/*!
+	 * \brief Disables search of near duplicates if \a enabled is false, only exact ones are found then.
+	 *
+	 * By default this property is set to true.
+	 */
+	void set_near_duplicates(bool enabled);
+
+	/*!
+	 * \brief Returns hash of the document's \a data of \a size bytes.
+	 */
+	static uint64_t content_hash(const char *data, size_t size);
+	/*!
+	 * \brief Returns SimHash of the text of HTML document \a data of \a size bytes with \a shingle_size words shingles.
+	 *
+	 * Zero is returned if there is no text in the document.
+	 */
+	static uint64_t simhash(const char *data, size_t size, size_t shingle_size = 3);
+
+	/*!
+	 * \brief Checks if document \a data of \a size bytes at \a url is duplicate of some known one.
+	 *
+	 * If it's unique it's remembered, otherwise url of the known document is written to \a original.
+	 */
+	result check(const std::string &url, const char *data, size_t size, std::string *original = NULL);
+	/*!
+	 * \brief Checks if document \a data at \a url is duplicate of some known one.
+	 *
+	 * If it's unique it's remembered, otherwise url of the known document is written to \a original.
+	 */
+	result check(const std::string &url, const std::string &data, std::string *original = NULL);
+
+	/*!
+	 * \brief Returns number of unique documents.
+	 */
+	size_t size() const;
+	/*!
+	 * \brief Returns number of exact duplicates found.
+	 */
+	size_t exact_duplicates() const;
+	/*!
+	 * \brief Returns number of near duplicates found.
+	 */
+	size_t near_duplicates() const;
+
+private:
+	std::unique_ptr<duplicate_detector_private> m_data;
+};
+
+}} // namespace ioremap::swarm
+
+#endif // IOREMAP_SWARM_CRAWLER_DUPLICATE_DETECTOR_HPP
@@ -0,0 +1,792 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "frontier.hpp"
+#include "checkpoint_p.hpp"
+#include "dns_resolver.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ioremap {
+namespace swarm {
+
+typedef crawl_frontier::clock clock;
+
+enum {
+	// Host's queue is never spilled below this size, so there is always something to fetch
+	min_memory_queue = 16,
+	// Number of entries read back from the disk at once
+	reload_batch = 64
+};
+
+/*
+ * Entry inside of the host's queue, sequence keeps FIFO order of equal entries
+ */
+struct queued_entry
+{
+	std::string url;
+	int priority;
+	int depth;
+	int redirects;
+	uint64_t sequence;
+
+	bool operator <(const queued_entry &other) const
+	{
+		// std::priority_queue returns the largest element first
+		if (priority != other.priority)
+			return priority < other.priority;
+		if (depth != other.depth)
+			return depth > other.depth;
+		return sequence > other.sequence;
+	}
+};
+
+// "SWFRNT02" in little endian
+static const uint64_t checkpoint_magic = 0x3230544e52465753ULL;
+
+/*
+ * Splits host key "scheme://host[:port]" to host name and port, returns false if port is unknown
+ */
+static bool split_host_key(const std::string &key, std::string &name, int &port)
+{
+	const size_t scheme_end = key.find("://");
+	if (scheme_end == std::string::npos)
+		return false;
+
+	const size_t begin = scheme_end + 3;
+	size_t colon = std::string::npos;
+
+	if (key.compare(begin, 1, "[") == 0) {
+		const size_t bracket = key.find(']', begin);
+		if (bracket == std::string::npos)
+			return false;
+		name = key.substr(begin + 1, bracket - begin - 1);
+		if (bracket + 1 < key.size() && key[bracket + 1] == ':')
+			colon = bracket + 1;
+	} else {
+		colon = key.find(':', begin);
+		name = key.substr(begin, colon == std::string::npos ? std::string::npos : colon - begin);
+	}
+
+	if (colon != std::string::npos) {
+		port = atoi(key.c_str() + colon + 1);
+	} else if (key.compare(0, scheme_end, "http") == 0) {
+		port = 80;
+	} else if (key.compare(0, scheme_end, "https") == 0) {
+		port = 443;
+	} else {
+		return false;
+	}
+
+	return !name.empty() && port > 0;
+}
+
+/*
+ * Entry is written to the disk as priority, depth, redirects and url's size followed by the url
+ */
+static bool write_entry(FILE *file, const queued_entry &entry)
+{
+	const int32_t header[4] = { entry.priority, entry.depth, entry.redirects, int32_t(entry.url.size()) };
+	return fwrite(header, sizeof(header), 1, file) == 1
+		&& fwrite(entry.url.c_str(), 1, entry.url.size(), file) == entry.url.size();
+}
+
+static bool read_entry(FILE *file, queued_entry &entry)
+{
+	int32_t header[4];
+	if (fread(header, sizeof(header), 1, file) != 1 || header[3] < 0)
+		return false;
+
+	entry.priority = header[0];
+	entry.depth = header[1];
+	entry.redirects = header[2];
+	entry.url.resize(header[3]);
+	return header[3] == 0 || fread(&entry.url[0], 1, header[3], file) == size_t(header[3]);
+}
+
+/*
+ * Tail of host's queue written to the disk, entries are read back in FIFO order
+ */
+class host_spill
+{
+public:
+	host_spill(const std::string &path) : path(path), file(NULL), read_offset(0), count(0)
+	{
+	}
+
+	~host_spill()
+	{
+		if (file) {
+			fclose(file);
+			unlink(path.c_str());
+		}
+	}
+
+	void write(const queued_entry &entry)
+	{
+		if (!file) {
+			file = fopen(path.c_str(), "w+b");
+			if (!file)
+				throw std::runtime_error("can not create frontier's file \"" + path + "\": " + strerror(errno));
+		}
+
+		if (fseek(file, 0, SEEK_END) != 0 || !write_entry(file, entry)) {
+			throw std::runtime_error("can not write frontier's file \"" + path + "\": " + strerror(errno));
+		}
+
+		++count;
+	}
+
+	bool read(queued_entry &entry)
+	{
+		if (count == 0)
+			return false;
+
+		if (fseek(file, read_offset, SEEK_SET) != 0 || !read_entry(file, entry))
+			throw std::runtime_error("can not read frontier's file \"" + path + "\": " + strerror(errno));
+
+		read_offset = ftell(file);
+		--count;
+		return true;
+	}
+
+	/*
+	 * Copies entries not read yet to \a output
+	 */
+	bool copy(FILE *output)
+	{
+		if (count == 0)
+			return true;
+
+		if (fseek(file, read_offset, SEEK_SET) != 0)
+			return false;
+
+		queued_entry entry;
+		for (size_t i = 0; i < count; ++i) {
+			if (!read_entry(file, entry) || !write_entry(output, entry))
+				return false;
+		}
+		return true;
+	}
+
+	std::string path;
+	FILE *file;
+	long read_offset;
+	size_t count;
+};
+
+struct host_state
+{
+	host_state() : delay(-1), in_heap(false)
+	{
+	}
+
+	std::string key;
+	std::priority_queue<queued_entry> queue;
+	std::unique_ptr<host_spill> spill;
+	// Popped entries which are not completed yet
+	std::vector<queued_entry> in_flight;
+	long delay;
+	bool in_heap;
+	clock::time_point next_allowed;
+
+	bool has_entries() const
+	{
+		return !queue.empty() || (spill && spill->count > 0);
+	}
+};
+
+/*
+ * Element of the timing heap, the earliest time is on the top
+ */
+struct scheduled_host
+{
+	clock::time_point time;
+	host_state *host;
+
+	bool operator <(const scheduled_host &other) const
+	{
+		return time > other.time;
+	}
+};
+
+/*
+ * Stream wrapper which returns the entry back to the frontier once the request is finished,
+ * target of the redirect is pushed to the frontier as the new entry
+ */
+class frontier_stream : public base_stream
+{
+public:
+	frontier_stream(crawl_frontier *frontier, const frontier_entry &entry, int max_redirects,
+			const std::shared_ptr<base_stream> &stream) :
+		m_frontier(frontier), m_entry(entry), m_max_redirects(max_redirects), m_stream(stream)
+	{
+	}
+
+	void on_headers(url_fetcher::response &&response)
+	{
+		const int code = response.code();
+		if (code >= 300 && code < 400 && code != 304 && m_entry.redirects < m_max_redirects) {
+			if (auto location = response.headers().get("Location")) {
+				const swarm::url target = swarm::url(m_entry.url).resolved(swarm::url(*location));
+				if (target.is_valid())
+					m_frontier->push(frontier_entry(target.to_string(), m_entry.priority, m_entry.depth, m_entry.redirects + 1));
+			}
+		}
+
+		m_stream->on_headers(std::move(response));
+	}
+
+	void on_data(const boost::asio::const_buffer &data)
+	{
+		m_stream->on_data(data);
+	}
+
+	void on_close(const boost::system::error_code &error)
+	{
+		m_frontier->complete(m_entry);
+		m_stream->on_close(error);
+	}
+
+private:
+	crawl_frontier *m_frontier;
+	frontier_entry m_entry;
+	int m_max_redirects;
+	std::shared_ptr<base_stream> m_stream;
+};
+
+class crawl_frontier_private
+{
+public:
+	crawl_frontier_private() :
+		host_concurrency(1), default_delay(1000), rate(0), tokens(0), max_redirects(5),
+		memory_limit(std::numeric_limits<size_t>::max()),
+		in_memory(0), spilled(0), active(0), unresolved(0), sequence(0), next_fetcher(0), next_spill(0),
+		resolver(NULL)
+	{
+	}
+
+	host_state &host(const std::string &key)
+	{
+		host_state &result = hosts[key];
+		if (result.key.empty()) {
+			result.key = key;
+			auto it = delays.find(key);
+			if (it != delays.end())
+				result.delay = it->second;
+
+			// New host is resolved while it's urls are waiting for their turn
+			std::string name;
+			int port;
+			if (resolver && split_host_key(key, name, port))
+				resolver->prefetch(name);
+		}
+		return result;
+	}
+
+	clock::duration delay(const host_state &host) const
+	{
+		return std::chrono::milliseconds(host.delay >= 0 ? host.delay : default_delay);
+	}
+
+	void schedule(host_state &host, clock::time_point now)
+	{
+		if (host.in_heap)
+			return;
+
+		host.in_heap = true;
+		scheduled_host item = { std::max(host.next_allowed, now), &host };
+		heap.push(item);
+	}
+
+	void push(frontier_entry &&entry)
+	{
+		entry.host = crawl_frontier::host_key(entry.url);
+		if (entry.host.empty())
+			return;
+
+		host_state &state = host(entry.host);
+		queued_entry item = { std::move(entry.url), entry.priority, entry.depth, entry.redirects, sequence++ };
+
+		if (in_memory >= memory_limit && state.queue.size() >= min_memory_queue) {
+			if (!state.spill) {
+				char buffer[64];
+				snprintf(buffer, sizeof(buffer), "/frontier-%d-%zu.bin", int(getpid()), next_spill++);
+				state.spill.reset(new host_spill(directory + buffer));
+			}
+			state.spill->write(item);
+			++spilled;
+		} else {
+			state.queue.push(std::move(item));
+			++in_memory;
+		}
+
+		if (state.in_flight.size() < host_concurrency)
+			schedule(state, clock::now());
+	}
+
+	void reload(host_state &state)
+	{
+		queued_entry item;
+		for (size_t i = 0; i < reload_batch && state.spill->read(item); ++i) {
+			item.sequence = sequence++;
+			state.queue.push(item);
+			++in_memory;
+			--spilled;
+		}
+
+		if (state.spill->count == 0)
+			state.spill.reset();
+	}
+
+	bool pop(frontier_entry &entry, clock::time_point now)
+	{
+		while (!heap.empty()) {
+			scheduled_host item = heap.top();
+			if (item.time > now)
+				return false;
+
+			heap.pop();
+			host_state &state = *item.host;
+			state.in_heap = false;
+
+			if (state.next_allowed > item.time) {
+				// Host's delay was changed since it was scheduled
+				if (state.has_entries() && state.in_flight.size() < host_concurrency)
+					schedule(state, now);
+				continue;
+			}
+
+			if (state.in_flight.size() >= host_concurrency)
+				continue;
+
+			if (state.queue.size() < min_memory_queue && state.spill)
+				reload(state);
+
+			if (state.queue.empty()) {
+				if (state.in_flight.empty()) {
+					// Idle host without urls is forgotten once it's delay is passed
+					const std::string key = state.key;
+					hosts.erase(key);
+				}
+				continue;
+			}
+
+			state.in_flight.push_back(state.queue.top());
+			state.queue.pop();
+			--in_memory;
+
+			const queued_entry &queued = state.in_flight.back();
+			entry.url = queued.url;
+			entry.priority = queued.priority;
+			entry.depth = queued.depth;
+			entry.redirects = queued.redirects;
+			entry.host = state.key;
+
+			++active;
+			state.next_allowed = now + delay(state);
+
+			if (state.has_entries() && state.in_flight.size() < host_concurrency)
+				schedule(state, now);
+
+			return true;
+		}
+
+		return false;
+	}
+
+	void complete(const frontier_entry &entry)
+	{
+		auto it = hosts.find(entry.host);
+		if (it == hosts.end())
+			return;
+
+		host_state &state = it->second;
+		for (auto jt = state.in_flight.begin(); jt != state.in_flight.end(); ++jt) {
+			if (jt->url == entry.url) {
+				state.in_flight.erase(jt);
+				--active;
+				break;
+			}
+		}
+
+		// Host without urls is scheduled too, so it's erased once it's delay is passed
+		if (state.has_entries() || state.in_flight.empty())
+			schedule(state, clock::now());
+	}
+
+	bool save(FILE *file)
+	{
+		if (fwrite(&checkpoint_magic, sizeof(checkpoint_magic), 1, file) != 1)
+			return false;
+
+		for (auto it = hosts.begin(); it != hosts.end(); ++it) {
+			host_state &state = it->second;
+
+			// Entries in flight are saved too, so they are fetched again after restart
+			for (auto jt = state.in_flight.begin(); jt != state.in_flight.end(); ++jt) {
+				if (!write_entry(file, *jt))
+					return false;
+			}
+
+			std::priority_queue<queued_entry> queue = state.queue;
+			for (; !queue.empty(); queue.pop()) {
+				if (!write_entry(file, queue.top()))
+					return false;
+			}
+
+			if (state.spill && !state.spill->copy(file))
+				return false;
+		}
+
+		return true;
+	}
+
+	bool take_token(clock::time_point now)
+	{
+		if (rate <= 0)
+			return true;
+
+		const double elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(now - last_refill).count();
+		last_refill = now;
+		tokens = std::min(std::max(rate, 1.), tokens + elapsed * rate);
+
+		if (tokens < 1)
+			return false;
+
+		tokens -= 1;
+		return true;
+	}
+
+	mutable std::mutex mutex;
+	std::unordered_map<std::string, host_state> hosts;
+	std::unordered_map<std::string, long> delays;
+	std::priority_queue<scheduled_host> heap;
+	size_t host_concurrency;
+	long default_delay;
+	double rate;
+	double tokens;
+	clock::time_point last_refill;
+	int max_redirects;
+	size_t memory_limit;
+	std::string directory;
+	size_t in_memory;
+	size_t spilled;
+	size_t active;
+	size_t unresolved;
+	uint64_t sequence;
+	size_t next_fetcher;
+	size_t next_spill;
+	dns_resolver *resolver;
+};
+
+crawl_frontier::crawl_frontier() : m_data(new crawl_frontier_private)
+{
+}
+
+crawl_frontier::~crawl_frontier()
+{
+}
+
+void crawl_frontier::set_host_concurrency(size_t concurrency)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->host_concurrency = std::max<size_t>(1, concurrency);
+}
+
+void crawl_frontier::set_default_delay(long delay)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->default_delay = std::max(0L, delay);
+}
+
+void crawl_frontier::set_host_delay(const std::string &host, long delay)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+
+	if (delay < 0)
+		m_data->delays.erase(host);
+	else
+		m_data->delays[host] = delay;
+
+	auto it = m_data->hosts.find(host);
+	if (it != m_data->hosts.end()) {
+		host_state &state = it->second;
+		const clock::time_point previous = state.next_allowed - m_data->delay(state);
+		state.delay = delay;
+		// Already scheduled host is moved by pop if it's allowed time becomes later
+		state.next_allowed = std::max(state.next_allowed, previous + m_data->delay(state));
+	}
+}
+
+void crawl_frontier::set_rate(double rate)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->rate = rate;
+	m_data->tokens = std::max(1., rate > 0 ? 1. : 0.);
+	m_data->last_refill = clock::now();
+}
+
+void crawl_frontier::set_max_redirects(int redirects)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->max_redirects = redirects;
+}
+
+void crawl_frontier::set_resolver(dns_resolver *resolver)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->resolver = resolver;
+}
+
+void crawl_frontier::set_memory_limit(size_t limit, const std::string &directory)
+{
+	struct stat st;
+	if (stat(directory.c_str(), &st) != 0)
+		throw std::runtime_error("crawl_frontier::set_memory_limit: invalid directory \"" + directory + "\": " + strerror(errno));
+
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->memory_limit = limit;
+	m_data->directory = directory;
+}
+
+std::string crawl_frontier::host_key(const std::string &url)
+{
+	const size_t scheme_end = url.find("://");
+	if (scheme_end == std::string::npos)
+		return std::string();
+
+	size_t begin = scheme_end + 3;
+	size_t end = url.find_first_of("/?#", begin);
+	if (end == std::string::npos)
+		end = url.size();
+
+	// User info is not a part of the host
+	const size_t at = url.rfind('@', end);
+	if (at != std::string::npos && at >= begin)
+		begin = at + 1;
+
+	if (begin == end)
+		return std::string();
+
+	std::string key;
+	key.reserve(scheme_end + 3 + end - begin);
+	for (size_t i = 0; i < scheme_end; ++i)
+		key += tolower(url[i]);
+	key += "://";
+	for (size_t i = begin; i < end; ++i)
+		key += tolower(url[i]);
+
+	return key;
+}
+
+void crawl_frontier::push(frontier_entry &&entry)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->push(std::move(entry));
+}
+
+void crawl_frontier::push(const frontier_entry &entry)
+{
+	frontier_entry copy = entry;
+	push(std::move(copy));
+}
+
+bool crawl_frontier::pop(frontier_entry &entry)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	return m_data->pop(entry, clock::now());
+}
+
+void crawl_frontier::complete(const frontier_entry &entry)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->complete(entry);
+}
+
+size_t crawl_frontier::dispatch(const std::vector<url_fetcher *> &fetchers, const stream_factory &factory)
+{
+	if (fetchers.empty())
+		return 0;
+
+	size_t count = 0;
+
+	for (;;) {
+		frontier_entry entry;
+		size_t fetcher_index;
+		dns_resolver *resolver;
+		int max_redirects;
+
+		{
+			std::lock_guard<std::mutex> lock(m_data->mutex);
+			const clock::time_point now = clock::now();
+
+			if (m_data->heap.empty() || m_data->heap.top().time > now)
+				break;
+			if (!m_data->take_token(now))
+				break;
+			if (!m_data->pop(entry, now)) {
+				// Token is not used
+				if (m_data->rate > 0)
+					m_data->tokens += 1;
+				break;
+			}
+
+			fetcher_index = m_data->next_fetcher++ % fetchers.size();
+			resolver = m_data->resolver;
+			max_redirects = m_data->max_redirects;
+		}
+
+		url_fetcher::request request;
+		request.set_url(entry.url);
+		// Redirects are pushed back to the frontier, so politeness applies to their hosts
+		request.set_follow_location(false);
+
+		std::string name;
+		std::string address;
+		int port;
+		if (resolver && split_host_key(entry.host, name, port)) {
+			const dns_resolver::status status = resolver->lookup(name, address);
+			if (status == dns_resolver::failed) {
+				// Dead domain costs nothing but the lookup in the negative cache
+				{
+					std::lock_guard<std::mutex> lock(m_data->mutex);
+					++m_data->unresolved;
+				}
+				complete(entry);
+				continue;
+			}
+
+			// Otherwise curl resolves the host itself, so temporary DNS failures don't lose entries
+			if (status == dns_resolver::resolved)
+				request.set_resolve(name, port, address);
+		}
+
+		auto stream = factory(entry, request);
+		if (!stream) {
+			complete(entry);
+			continue;
+		}
+
+		fetchers[fetcher_index]->get(std::make_shared<frontier_stream>(this, entry, max_redirects, stream), std::move(request));
+		++count;
+	}
+
+	return count;
+}
+
+void crawl_frontier::save(const std::string &path) const
+{
+	const std::string tmp_path = path + ".tmp";
+	FILE *file = fopen(tmp_path.c_str(), "wb");
+	if (!file)
+		throw std::runtime_error("can not create frontier's checkpoint \"" + tmp_path + "\": " + strerror(errno));
+
+	bool ok;
+	{
+		std::lock_guard<std::mutex> lock(m_data->mutex);
+		ok = m_data->save(file);
+	}
+
+	const int err = commit_checkpoint(file, ok, errno, tmp_path, path);
+	if (err)
+		throw std::runtime_error("can not write frontier's checkpoint \"" + path + "\": " + strerror(err));
+}
+
+bool crawl_frontier::load(const std::string &path)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file) {
+		if (errno == ENOENT)
+			return false;
+		throw std::runtime_error("can not open frontier's checkpoint \"" + path + "\": " + strerror(errno));
+	}
+
+	uint64_t magic = 0;
+	if (fread(&magic, sizeof(magic), 1, file) != 1 || magic != checkpoint_magic) {
+		fclose(file);
+		throw std::runtime_error("invalid frontier's checkpoint \"" + path + "\"");
+	}
+
+	queued_entry entry;
+	while (read_entry(file, entry))
+		push(frontier_entry(entry.url, entry.priority, entry.depth, entry.redirects));
+
+	fclose(file);
+	return true;
+}
+
+long crawl_frontier::next_timeout() const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+
+	if (m_data->heap.empty())
+		return -1;
+
+	const clock::time_point now = clock::now();
+	clock::time_point time = std::max(now, m_data->heap.top().time);
+
+	if (m_data->rate > 0 && m_data->tokens < 1) {
+		const double wait = (1 - m_data->tokens) / m_data->rate;
+		time = std::max(time, m_data->last_refill + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(wait)));
+	}
+
+	return std::chrono::duration_cast<std::chrono::milliseconds>(time - now).count();
+}
+
+size_t crawl_frontier::size() const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	return m_data->in_memory + m_data->spilled;
+}
+
+size_t crawl_frontier::spilled() const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	return m_data->spilled;
+}
+
+size_t crawl_frontier::hosts_count() const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	return m_data->hosts.size();
+}
+
+size_t crawl_frontier::active() const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	return m_data->active;
+}
+
+size_t crawl_frontier::unresolved() const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	return m_data->unresolved;
+}
+
+}} // namespace ioremap::swarm
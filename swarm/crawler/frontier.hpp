@@ -0,0 +1,251 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOREMAP_SWARM_CRAWLER_FRONTIER_HPP
+#define IOREMAP_SWARM_CRAWLER_FRONTIER_HPP
+
+#include "../urlfetcher/url_fetcher.hpp"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ioremap {
+namespace swarm {
+
+class crawl_frontier_private;
+class dns_resolver;
+
+/*!
+ * \brief The frontier_entry struct describes url waiting in the frontier.
+ */
+struct frontier_entry
+{
+	frontier_entry() : priority(0), depth(0), redirects(0)
+	{
+	}
+
+	frontier_entry(const std::string &url, int priority = 0, int depth = 0, int redirects = 0) :
+		url(url), priority(priority), depth(depth), redirects(redirects)
+	{
+	}
+
+	//! Absolute url
+	std::string url;
+	//! Urls with higher priority of the same host are fetched first
+	int priority;
+	//! Distance from the crawl's seed, urls with less depth are fetched first at equal priority
+	int depth;
+	//! Number of redirects which led to the url
+	int redirects;
+	//! Host key of the url, it's filled by the frontier
+	std::string host;
+};
+
+/*!
+ * \brief The crawl_frontier class keeps urls to be crawled and decides when they may be fetched.
+ *
+ * Urls are kept in per-host queues ordered by priority and depth. Requests to the same host are
+ * started not more often than once per host's delay and there are never more than
+ * host_concurrency requests to the host in flight. Hosts are picked by the timing heap of
+ * the moments they are allowed to be fetched at, so picking of the next url is O(log hosts).
+ *
+ * Redirects are not followed by the fetcher, target of 3xx reply is pushed back to the frontier
+ * with the same priority and depth instead, so it's host's limits apply to it too.
+ *
+ * The total rate of started requests may be limited too. Once the number of urls kept in
+ * memory exceeds memory limit, tails of long host queues are spilled to the disk and read
+ * back as the queues drain.
+ *
+ * The frontier is thread-safe.
+ *
+ * \code{.cpp}
+ * swarm::crawl_frontier frontier;
+ * frontier.set_default_delay(500);
+ * frontier.set_rate(200);
+ * frontier.push(swarm::frontier_entry("http://example.com/"));
+ *
+ * // called by the timer in the next_timeout() milliseconds
+ * frontier.dispatch(fetchers, factory);
+ * \endcode
+ */
+class crawl_frontier
+{
+public:
+	typedef std::chrono::steady_clock clock;
+	/*!
+	 * \brief Returns stream for the \a entry, \a request may be modified before it's sent.
+	 *
+	 * If null pointer is returned the entry is skipped.
+	 */
+	typedef std::function<std::shared_ptr<base_stream> (const frontier_entry &entry, url_fetcher::request &request)> stream_factory;
+
+	/*!
+	 * \brief Constructs empty frontier.
+	 */
+	crawl_frontier();
+	crawl_frontier(const crawl_frontier &other) = delete;
+	/*!
+	 * \brief Destroys the frontier.
+	 *
+	 * \attention There must be no requests dispatched by the frontier in flight.
+	 */
+	~crawl_frontier();
+
+	crawl_frontier &operator =(const crawl_frontier &other) = delete;
+
+	/*!
+	 * \brief Sets the maximum number of simultaneous requests to the single host to \a concurrency.
+	 *
+	 * By default this property is set to 1.
+	 */
+	void set_host_concurrency(size_t concurrency);
+	/*!
+	 * \brief Sets the minimal interval between starts of requests to the same host to \a delay milliseconds.
+	 *
+	 * By default this property is set to 1000 milliseconds.
+	 */
+	void set_default_delay(long delay);
+	/*!
+	 * \brief Sets the minimal interval between requests to \a host to \a delay milliseconds.
+	 *
+	 * It's intended for host-specific limits like Crawl-delay of robots.txt.
+	 * If \a delay is negative the default delay is used for the host again.
+	 *
+	 * \sa host_key
+	 */
+	void set_host_delay(const std::string &host, long delay);
+	/*!
+	 * \brief Sets the limit of started requests to \a rate per second in total.
+	 *
+	 * By default there is no limit.
+	 */
+	void set_rate(double rate);
+	/*!
+	 * \brief Sets the maximum number of redirects followed from the pushed url to \a redirects.
+	 *
+	 * Targets of redirects above the limit are dropped. By default this property is set to 5.
+	 */
+	void set_max_redirects(int redirects);
+	/*!
+	 * \brief Makes the frontier to prefetch addresses of new hosts by \a resolver.
+	 *
+	 * Hosts are prefetched once they are pushed first time. Dispatched requests to resolved hosts
+	 * skip DNS lookup, entries of hosts which don't exist are dropped without fetching.
+	 * Hosts which are not resolved yet or whose lookup has failed temporarily are resolved by curl.
+	 */
+	void set_resolver(dns_resolver *resolver);
+	/*!
+	 * \brief Makes the frontier to spill urls to \a directory once there are more than \a limit of them in memory.
+	 *
+	 * It must be called before the first push. By default there is no limit.
+	 */
+	void set_memory_limit(size_t limit, const std::string &directory);
+
+	/*!
+	 * \brief Returns the host key of \a url, i.e. "http://example.com:8080".
+	 *
+	 * Urls with the same key share politeness limits.
+	 */
+	static std::string host_key(const std::string &url);
+
+	/*!
+	 * \brief Adds \a entry to the frontier.
+	 *
+	 * Entry is ignored if it's url has no host.
+	 */
+	void push(frontier_entry &&entry);
+	/*!
+	 * \brief Adds \a entry to the frontier.
+	 */
+	void push(const frontier_entry &entry);
+	/*!
+	 * \brief Takes the entry which may be fetched right now to \a entry.
+	 *
+	 * Returns false if there is no such entry. The returned entry is considered in flight
+	 * and it's host is busy until complete is called for it.
+	 *
+	 * \sa complete
+	 */
+	bool pop(frontier_entry &entry);
+	/*!
+	 * \brief Notifies the frontier that request for popped \a entry is finished.
+	 */
+	void complete(const frontier_entry &entry);
+
+	/*!
+	 * \brief Starts requests for all entries allowed to be fetched right now.
+	 *
+	 * Requests are distributed between \a fetchers in round-robin, streams for them are created by \a factory.
+	 * Entries are completed automatically once the requests are finished.
+	 *
+	 * Returns number of started requests.
+	 *
+	 * \sa next_timeout
+	 */
+	size_t dispatch(const std::vector<url_fetcher *> &fetchers, const stream_factory &factory);
+	/*!
+	 * \brief Returns number of milliseconds until the next entry may be fetched.
+	 *
+	 * Returns -1 if there is nothing to wait for.
+	 */
+	long next_timeout() const;
+
+	/*!
+	 * \brief Saves all entries of the frontier to \a path.
+	 *
+	 * Entries in flight are saved too, so they are fetched again after the restart.
+	 * File is written under the temporary name and renamed, so the previous checkpoint is kept
+	 * intact on failure. Throws std::runtime_error on error.
+	 */
+	void save(const std::string &path) const;
+	/*!
+	 * \brief Pushes all entries saved to \a path to the frontier.
+	 *
+	 * Returns false if there is no such file. Throws std::runtime_error if the file is broken.
+	 */
+	bool load(const std::string &path);
+
+	/*!
+	 * \brief Returns number of entries in the frontier, including spilled ones.
+	 */
+	size_t size() const;
+	/*!
+	 * \brief Returns number of entries spilled to the disk.
+	 */
+	size_t spilled() const;
+	/*!
+	 * \brief Returns number of known hosts.
+	 */
+	size_t hosts_count() const;
+	/*!
+	 * \brief Returns number of popped entries which are not completed yet.
+	 */
+	size_t active() const;
+	/*!
+	 * \brief Returns number of entries dropped by dispatch because their hosts don't exist.
+	 */
+	size_t unresolved() const;
+
+private:
+	std::unique_ptr<crawl_frontier_private> m_data;
+};
+
+}} // namespace ioremap::swarm
+
+#endif // IOREMAP_SWARM_CRAWLER_FRONTIER_HPP
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hash.hpp"
+
+#include <string.h>
+
+namespace ioremap {
+namespace swarm {
+
+static const uint64_t prime1 = 11400714785074694791ULL;
+static const uint64_t prime2 = 14029467366897019727ULL;
+static const uint64_t prime3 = 1609587929392839161ULL;
+static const uint64_t prime4 = 9650029242287828579ULL;
+static const uint64_t prime5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl(uint64_t value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t read64(const char *data)
+{
+	uint64_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+static inline uint32_t read32(const char *data)
+{
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+static inline uint64_t round(uint64_t acc, uint64_t input)
+{
+	acc += input * prime2;
+	acc = rotl(acc, 31);
+	return acc * prime1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t value)
+{
+	acc ^= round(0, value);
+	return acc * prime1 + prime4;
+}
+
+// Little-endian byte order is assumed, as on all supported platforms
+uint64_t hash64(const char *data, size_t size, uint64_t seed)
+{
+	const char *end = data + size;
+	uint64_t result;
+
+	if (size >= 32) {
+		const char *limit = end - 32;
+		uint64_t v1 = seed + prime1 + prime2;
+		uint64_t v2 = seed + prime2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - prime1;
+
+		do {
+			v1 = round(v1, read64(data));
+			v2 = round(v2, read64(data + 8));
+			v3 = round(v3, read64(data + 16));
+			v4 = round(v4, read64(data + 24));
+			data += 32;
+		} while (data <= limit);
+
+		result = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		result = merge_round(result, v1);
+		result = merge_round(result, v2);
+		result = merge_round(result, v3);
+		result = merge_round(result, v4);
+	} else {
+		result = seed + prime5;
+	}
+
+	result += size;
+
+	for (; data + 8 <= end; data += 8) {
+		result ^= round(0, read64(data));
+		result = rotl(result, 27) * prime1 + prime4;
+	}
+
+	if (data + 4 <= end) {
+		result ^= uint64_t(read32(data)) * prime1;
+		result = rotl(result, 23) * prime2 + prime3;
+		data += 4;
+	}
+
+	for (; data < end; ++data) {
+		result ^= uint64_t(static_cast<unsigned char>(*data)) * prime5;
+		result = rotl(result, 11) * prime1;
+	}
+
+	result ^= result >> 33;
+	result *= prime2;
+	result ^= result >> 29;
+	result *= prime3;
+	result ^= result >> 32;
+
+	return result;
+}
+
+}} // namespace ioremap::swarm
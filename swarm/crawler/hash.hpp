@@ -0,0 +1,47 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOREMAP_SWARM_CRAWLER_HASH_HPP
+#define IOREMAP_SWARM_CRAWLER_HASH_HPP
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace ioremap {
+namespace swarm {
+
+/*!
+ * \brief Returns 64-bit hash of \a size bytes at \a data with \a seed.
+ *
+ * It's an implementation of xxHash64, which is fast and has good distribution,
+ * so it's suitable for fingerprints of urls and documents.
+ */
+uint64_t hash64(const char *data, size_t size, uint64_t seed = 0);
+
+/*!
+ * \brief Returns 64-bit hash of \a data with \a seed.
+ *
+ * \sa hash64(const char *, size_t, uint64_t)
+ */
+inline uint64_t hash64(const std::string &data, uint64_t seed = 0)
+{
+	return hash64(data.c_str(), data.size(), seed);
+}
+
+}} // namespace ioremap::swarm
+
+#endif // IOREMAP_SWARM_CRAWLER_HASH_HPP
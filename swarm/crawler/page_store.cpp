@@ -0,0 +1,506 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "page_store.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ioremap {
+namespace swarm {
+
+// "SWPG" in little endian
+static const uint32_t record_magic = 0x47505753;
+
+/*
+ * Record in the segment file is the header followed by url, headers and body,
+ * headers are written in HTTP form, i.e. "Name: value\r\n" per header
+ */
+struct record_header
+{
+	uint32_t magic;
+	uint32_t url_size;
+	uint32_t headers_size;
+	int32_t status;
+	uint64_t body_size;
+	int64_t timestamp;
+};
+
+/*
+ * Index file of the segment is the array of these entries
+ */
+struct index_entry
+{
+	uint64_t hash;
+	uint64_t offset;
+	uint64_t size;
+};
+
+static std::runtime_error make_error(const std::string &message, int err)
+{
+	return std::runtime_error(message + ": " + strerror(err));
+}
+
+static void write_all(int fd, const char *data, size_t size, const std::string &path)
+{
+	while (size > 0) {
+		ssize_t written = ::write(fd, data, size);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			throw make_error("can not write page store's file \"" + path + "\"", errno);
+		}
+		data += written;
+		size -= written;
+	}
+}
+
+static std::string segment_path(const std::string &directory, uint32_t id, const char *suffix)
+{
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "/%08u.%s", id, suffix);
+	return directory + buffer;
+}
+
+/*
+ * Segment file mapped to memory for reads, the mapping grows lazily
+ */
+class store_segment
+{
+public:
+	store_segment(const std::string &path) : path(path), size(0), m_data(NULL), m_mapped(0)
+	{
+	}
+
+	~store_segment()
+	{
+		if (m_data)
+			munmap(m_data, m_mapped);
+	}
+
+	/*
+	 * Returns pointer to the segment's data which is valid at least up to \a end,
+	 * at least \a reserve bytes are mapped so the growing segment is not remapped on every read
+	 */
+	const char *data(uint64_t end, uint64_t reserve)
+	{
+		if (end <= m_mapped)
+			return m_data;
+
+		int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			throw make_error("can not open page store's file \"" + path + "\"", errno);
+
+		// Pages past the end of file are never touched, only records already written are read
+		const size_t length = std::max(std::max(end, reserve), size);
+		void *result = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+		int err = errno;
+		close(fd);
+
+		if (result == MAP_FAILED)
+			throw make_error("can not map page store's file \"" + path + "\"", err);
+
+		if (m_data)
+			munmap(m_data, m_mapped);
+		m_data = reinterpret_cast<char *>(result);
+		m_mapped = length;
+
+		return m_data;
+	}
+
+	std::string path;
+	// Number of bytes written to the disk
+	uint64_t size;
+
+private:
+	char *m_data;
+	size_t m_mapped;
+};
+
+class page_store_private
+{
+public:
+	page_store_private(const std::string &directory) :
+		directory(directory), segment_size(1024 * 1024 * 1024), batch_size(1024 * 1024),
+		active_id(0), active(NULL), segment_fd(-1), index_fd(-1)
+	{
+	}
+
+	~page_store_private()
+	{
+		close_active();
+	}
+
+	void open_store()
+	{
+		if (mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST)
+			throw make_error("can not create page store's directory \"" + directory + "\"", errno);
+
+		DIR *dir = opendir(directory.c_str());
+		if (!dir)
+			throw make_error("can not open page store's directory \"" + directory + "\"", errno);
+
+		std::vector<uint32_t> ids;
+		while (struct dirent *entry = readdir(dir)) {
+			char *end = NULL;
+			const unsigned long id = strtoul(entry->d_name, &end, 10);
+			if (end != entry->d_name && strcmp(end, ".seg") == 0)
+				ids.push_back(id);
+		}
+		closedir(dir);
+
+		std::sort(ids.begin(), ids.end());
+
+		for (size_t i = 0; i < ids.size(); ++i)
+			load_segment(ids[i], i + 1 == ids.size());
+
+		if (!ids.empty() && segments[ids.back()]->size < segment_size)
+			open_active(ids.back());
+		else
+			open_active(ids.empty() ? 0 : ids.back() + 1);
+	}
+
+	void load_segment(uint32_t id, bool last)
+	{
+		std::unique_ptr<store_segment> segment(new store_segment(segment_path(directory, id, "seg")));
+		const std::string index_path = segment_path(directory, id, "idx");
+
+		struct stat st;
+		if (stat(segment->path.c_str(), &st) < 0)
+			throw make_error("can not stat page store's file \"" + segment->path + "\"", errno);
+		segment->size = st.st_size;
+
+		std::vector<index_entry> entries;
+		uint64_t index_size = 0;
+		int fd = open(index_path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd >= 0) {
+			if (fstat(fd, &st) == 0) {
+				index_size = st.st_size;
+				entries.resize(st.st_size / sizeof(index_entry));
+				const ssize_t size = entries.size() * sizeof(index_entry);
+				if (pread(fd, entries.data(), size, 0) != size)
+					entries.clear();
+			}
+			close(fd);
+		} else if (errno != ENOENT) {
+			throw make_error("can not open page store's file \"" + index_path + "\"", errno);
+		}
+
+		// Entries are appended after records, so only the tail may point past the end of the segment
+		uint64_t indexed_end = 0;
+		size_t valid = 0;
+		for (; valid < entries.size(); ++valid) {
+			const index_entry &entry = entries[valid];
+			if (entry.offset + entry.size > segment->size)
+				break;
+
+			page_store::location position = { id, entry.offset, entry.size };
+			index[entry.hash] = position;
+			indexed_end = std::max(indexed_end, entry.offset + entry.size);
+		}
+
+		if (last) {
+			/*
+			 * Drop records and index entries written partially before the crash, including the torn
+			 * trailing entry, otherwise the next appended entry would be misaligned
+			 */
+			if (indexed_end < segment->size && truncate(segment->path.c_str(), indexed_end) < 0)
+				throw make_error("can not truncate page store's file \"" + segment->path + "\"", errno);
+			if (valid * sizeof(index_entry) != index_size && truncate(index_path.c_str(), valid * sizeof(index_entry)) < 0)
+				throw make_error("can not truncate page store's file \"" + index_path + "\"", errno);
+			segment->size = indexed_end;
+		}
+
+		segments[id] = std::move(segment);
+	}
+
+	void open_active(uint32_t id)
+	{
+		std::unique_ptr<store_segment> &segment = segments[id];
+		if (!segment)
+			segment.reset(new store_segment(segment_path(directory, id, "seg")));
+
+		const std::string index_path = segment_path(directory, id, "idx");
+
+		segment_fd = open(segment->path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (segment_fd < 0)
+			throw make_error("can not open page store's file \"" + segment->path + "\"", errno);
+
+		index_fd = open(index_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (index_fd < 0) {
+			int err = errno;
+			close(segment_fd);
+			segment_fd = -1;
+			throw make_error("can not open page store's file \"" + index_path + "\"", err);
+		}
+
+		active_id = id;
+		active = segment.get();
+	}
+
+	void close_active()
+	{
+		if (segment_fd >= 0)
+			close(segment_fd);
+		if (index_fd >= 0)
+			close(index_fd);
+		segment_fd = -1;
+		index_fd = -1;
+	}
+
+	uint64_t active_size() const
+	{
+		return active->size + buffer.size();
+	}
+
+	void flush()
+	{
+		if (buffer.empty())
+			return;
+
+		write_all(segment_fd, buffer.data(), buffer.size(), active->path);
+		active->size += buffer.size();
+		buffer.clear();
+
+		write_all(index_fd, reinterpret_cast<const char *>(index_buffer.data()),
+			index_buffer.size() * sizeof(index_entry), segment_path(directory, active_id, "idx"));
+		index_buffer.clear();
+	}
+
+	void rotate()
+	{
+		flush();
+		close_active();
+		open_active(active_id + 1);
+	}
+
+	page_store::location append(const page_record &record)
+	{
+		std::string headers;
+		const std::vector<headers_entry> &all = record.headers.all();
+		for (auto it = all.begin(); it != all.end(); ++it) {
+			headers += it->first;
+			headers += ": ";
+			headers += it->second;
+			headers += "\r\n";
+		}
+
+		record_header header;
+		header.magic = record_magic;
+		header.url_size = record.url.size();
+		header.headers_size = headers.size();
+		header.status = record.status;
+		header.body_size = record.body.size();
+		header.timestamp = record.timestamp;
+
+		const uint64_t size = sizeof(header) + record.url.size() + headers.size() + record.body.size();
+		if (active_size() > 0 && active_size() + size > segment_size)
+			rotate();
+
+		page_store::location position = { active_id, active_size(), size };
+
+		buffer.append(reinterpret_cast<const char *>(&header), sizeof(header));
+		buffer.append(record.url);
+		buffer.append(headers);
+		buffer.append(record.body);
+
+		const uint64_t hash = hash64(record.url);
+		index_entry entry = { hash, position.offset, position.size };
+		index_buffer.push_back(entry);
+		index[hash] = position;
+
+		if (buffer.size() >= batch_size)
+			flush();
+
+		return position;
+	}
+
+	bool read(const page_store::location &position, page_record &record)
+	{
+		auto it = segments.find(position.segment);
+		if (it == segments.end() || position.size < sizeof(record_header))
+			return false;
+
+		store_segment &segment = *it->second;
+		const char *data;
+
+		if (&segment == active && position.offset >= segment.size) {
+			// Record is not written yet
+			const uint64_t offset = position.offset - segment.size;
+			if (offset + position.size > buffer.size())
+				return false;
+			data = buffer.data() + offset;
+		} else {
+			if (position.offset + position.size > segment.size)
+				return false;
+			data = segment.data(position.offset + position.size, &segment == active ? segment_size : 0);
+			data += position.offset;
+		}
+
+		record_header header;
+		memcpy(&header, data, sizeof(header));
+		if (header.magic != record_magic
+			|| sizeof(header) + header.url_size + header.headers_size + header.body_size != position.size) {
+			return false;
+		}
+
+		const char *url = data + sizeof(header);
+		const char *headers = url + header.url_size;
+		const char *headers_end = headers + header.headers_size;
+		const char *body = headers_end;
+
+		record.url.assign(url, header.url_size);
+		record.status = header.status;
+		record.timestamp = header.timestamp;
+		record.body.assign(body, header.body_size);
+
+		std::vector<headers_entry> entries;
+		while (headers < headers_end) {
+			const char *line_end = std::search(headers, headers_end, "\r\n", "\r\n" + 2);
+			const char *colon = std::find(headers, line_end, ':');
+			if (colon != line_end) {
+				const char *value = colon + 1;
+				if (value != line_end && *value == ' ')
+					++value;
+				entries.push_back(headers_entry(std::string(headers, colon), std::string(value, line_end)));
+			}
+			headers = std::min(line_end + 2, headers_end);
+		}
+		record.headers.assign(std::move(entries));
+
+		return true;
+	}
+
+	std::mutex mutex;
+	std::string directory;
+	uint64_t segment_size;
+	size_t batch_size;
+
+	std::map<uint32_t, std::unique_ptr<store_segment>> segments;
+	std::unordered_map<uint64_t, page_store::location> index;
+
+	uint32_t active_id;
+	store_segment *active;
+	int segment_fd;
+	int index_fd;
+	std::string buffer;
+	std::vector<index_entry> index_buffer;
+};
+
+page_store::page_store(const std::string &directory) : m_data(new page_store_private(directory))
+{
+	m_data->open_store();
+}
+
+page_store::~page_store()
+{
+	try {
+		m_data->flush();
+	} catch (...) {
+	}
+}
+
+void page_store::set_segment_size(uint64_t size)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->segment_size = size;
+}
+
+void page_store::set_batch_size(size_t size)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->batch_size = size;
+}
+
+page_store::location page_store::append(const page_record &record)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	return m_data->append(record);
+}
+
+void page_store::flush()
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->flush();
+}
+
+void page_store::sync()
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->flush();
+
+	if (fdatasync(m_data->segment_fd) < 0 || fdatasync(m_data->index_fd) < 0)
+		throw make_error("can not sync page store \"" + m_data->directory + "\"", errno);
+}
+
+bool page_store::find(const std::string &url, location &result) const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+
+	auto it = m_data->index.find(hash64(url));
+	if (it == m_data->index.end())
+		return false;
+
+	result = it->second;
+	return true;
+}
+
+bool page_store::read(const std::string &url, page_record &record) const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+
+	auto it = m_data->index.find(hash64(url));
+	if (it == m_data->index.end())
+		return false;
+
+	// Index is keyed by url's hash, so make sure it's really the same url
+	return m_data->read(it->second, record) && record.url == url;
+}
+
+bool page_store::read(const location &position, page_record &record) const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	return m_data->read(position, record);
+}
+
+size_t page_store::size() const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	return m_data->index.size();
+}
+
+size_t page_store::segments_count() const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	return m_data->segments.size();
+}
+
+}} // namespace ioremap::swarm
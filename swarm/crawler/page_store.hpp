@@ -0,0 +1,173 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOREMAP_SWARM_CRAWLER_PAGE_STORE_HPP
+#define IOREMAP_SWARM_CRAWLER_PAGE_STORE_HPP
+
+#include "../http_headers.hpp"
+
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+
+namespace ioremap {
+namespace swarm {
+
+class page_store_private;
+
+/*!
+ * \brief The page_record struct describes the crawled document.
+ */
+struct page_record
+{
+	page_record() : status(0), timestamp(0)
+	{
+	}
+
+	//! Url of the document
+	std::string url;
+	//! HTTP status code of the reply
+	int status;
+	//! Time the document was fetched at
+	time_t timestamp;
+	//! Headers of the reply
+	http_headers headers;
+	//! Body of the reply
+	std::string body;
+};
+
+/*!
+ * \brief The page_store class keeps crawled documents in large append-only segment files.
+ *
+ * Records are appended to the memory buffer and written to the current segment by batches,
+ * once the segment exceeds it's size limit the next one is started. Every segment has
+ * an index file with positions of it's records, indexes are loaded to memory on open,
+ * so the document may be found by it's url. Segments are read by mmap, so random reads
+ * cost no system calls.
+ *
+ * Index entry is written only after the record itself is, so after the crash the store
+ * is consistent up to the last flush, the unindexed tail of the last segment is truncated on open.
+ *
+ * If the same url is appended several times the latest record is returned by read.
+ *
+ * The store is thread-safe.
+ *
+ * \code{.cpp}
+ * swarm::page_store store("/var/lib/crawler/pages");
+ *
+ * swarm::page_record record;
+ * record.url = url;
+ * record.status = reply.code();
+ * record.timestamp = time(NULL);
+ * record.headers = reply.headers();
+ * record.body = std::move(data);
+ * store.append(record);
+ * \endcode
+ */
+class page_store
+{
+public:
+	/*!
+	 * \brief The location struct describes position of the record in the store.
+	 */
+	struct location
+	{
+		//! Number of the segment
+		uint32_t segment;
+		//! Offset of the record in the segment
+		uint64_t offset;
+		//! Size of the record in bytes
+		uint64_t size;
+	};
+
+	/*!
+	 * \brief Opens the store at \a directory, it's created if it doesn't exist.
+	 *
+	 * Throws std::runtime_error if the store can not be opened.
+	 */
+	page_store(const std::string &directory);
+	page_store(const page_store &other) = delete;
+	/*!
+	 * \brief Flushes buffered records and closes the store.
+	 */
+	~page_store();
+
+	page_store &operator =(const page_store &other) = delete;
+
+	/*!
+	 * \brief Sets size of the segment after which the next one is started to \a size bytes.
+	 *
+	 * By default this property is set to 1 GiB.
+	 */
+	void set_segment_size(uint64_t size);
+	/*!
+	 * \brief Sets size of the write buffer to \a size bytes, records are written once it's full.
+	 *
+	 * By default this property is set to 1 MiB.
+	 */
+	void set_batch_size(size_t size);
+
+	/*!
+	 * \brief Appends \a record to the store.
+	 *
+	 * Returns location of the record. Throws std::runtime_error on write error.
+	 */
+	location append(const page_record &record);
+	/*!
+	 * \brief Writes all buffered records to the disk.
+	 */
+	void flush();
+	/*!
+	 * \brief Writes all buffered records to the disk and waits until they are on the storage.
+	 */
+	void sync();
+
+	/*!
+	 * \brief Finds the location of the latest record for \a url.
+	 *
+	 * Returns false if there is no such record.
+	 */
+	bool find(const std::string &url, location &result) const;
+	/*!
+	 * \brief Reads the latest record for \a url to \a record.
+	 *
+	 * Returns false if there is no such record.
+	 */
+	bool read(const std::string &url, page_record &record) const;
+	/*!
+	 * \brief Reads the record at \a position to \a record.
+	 *
+	 * Returns false if there is no valid record at this location.
+	 */
+	bool read(const location &position, page_record &record) const;
+
+	/*!
+	 * \brief Returns number of distinct urls in the store.
+	 */
+	size_t size() const;
+	/*!
+	 * \brief Returns number of segments in the store.
+	 */
+	size_t segments_count() const;
+
+private:
+	std::unique_ptr<page_store_private> m_data;
+};
+
+}} // namespace ioremap::swarm
+
+#endif // IOREMAP_SWARM_CRAWLER_PAGE_STORE_HPP
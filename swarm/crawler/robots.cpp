@@ -0,0 +1,595 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "robots.hpp"
+#include "frontier.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace ioremap {
+namespace swarm {
+
+enum {
+	// Longer robots.txt are truncated as specification allows
+	max_robots_size = 500 * 1024,
+	robots_timeout = 30 * 1000
+};
+
+static std::string trim(const std::string &value)
+{
+	const size_t begin = value.find_first_not_of(" \t");
+	if (begin == std::string::npos)
+		return std::string();
+	const size_t end = value.find_last_not_of(" \t");
+	return value.substr(begin, end - begin + 1);
+}
+
+static std::string to_lower(std::string value)
+{
+	for (auto it = value.begin(); it != value.end(); ++it) {
+		if (*it >= 'A' && *it <= 'Z')
+			*it += 'a' - 'A';
+	}
+	return value;
+}
+
+/*
+ * Returns product token of the user agent, i.e. "swarm" for "Swarm/2.0 (+http://example.com)"
+ */
+static std::string product_token(const std::string &user_agent)
+{
+	const std::string value = trim(user_agent);
+	return to_lower(value.substr(0, value.find_first_of("/ \t")));
+}
+
+robots_rules::robots_rules() : m_crawl_delay(-1), m_disallow_all(false)
+{
+	m_nodes.resize(1);
+}
+
+robots_rules::robots_rules(const std::string &text, const std::string &user_agent) :
+	m_crawl_delay(-1), m_disallow_all(false)
+{
+	m_nodes.resize(1);
+
+	const std::string token = product_token(user_agent);
+
+	struct parsed_rule
+	{
+		std::string pattern;
+		bool allow;
+	};
+
+	/*
+	 * Rules of all groups for our agent are merged, rules of '*' groups are used
+	 * only if there is no group for our agent
+	 */
+	std::vector<parsed_rule> specific_rules;
+	std::vector<parsed_rule> common_rules;
+	double specific_delay = -1;
+	double common_delay = -1;
+	bool has_specific = false;
+
+	bool group_specific = false;
+	bool group_common = false;
+	bool in_agents = false;
+
+	size_t position = 0;
+	while (position < text.size()) {
+		size_t end = text.find_first_of("\r\n", position);
+		if (end == std::string::npos)
+			end = text.size();
+
+		std::string line = text.substr(position, end - position);
+		position = end + 1;
+
+		const size_t comment = line.find('#');
+		if (comment != std::string::npos)
+			line.resize(comment);
+
+		const size_t colon = line.find(':');
+		if (colon == std::string::npos)
+			continue;
+
+		const std::string key = to_lower(trim(line.substr(0, colon)));
+		const std::string value = trim(line.substr(colon + 1));
+
+		if (key == "user-agent") {
+			// User-agent after rules starts the new group
+			if (!in_agents) {
+				group_specific = false;
+				group_common = false;
+				in_agents = true;
+			}
+
+			const std::string agent = product_token(value);
+			if (agent == "*") {
+				group_common = true;
+			} else if (!agent.empty() && agent == token) {
+				group_specific = true;
+				has_specific = true;
+			}
+			continue;
+		}
+
+		if (key == "sitemap") {
+			if (!value.empty())
+				m_sitemaps.push_back(value);
+			continue;
+		}
+
+		in_agents = false;
+
+		if (key == "allow" || key == "disallow") {
+			// Empty Disallow means there are no restrictions
+			if (value.empty())
+				continue;
+
+			parsed_rule rule = { value, key == "allow" };
+			if (group_specific)
+				specific_rules.push_back(rule);
+			if (group_common)
+				common_rules.push_back(rule);
+		} else if (key == "crawl-delay") {
+			char *delay_end = NULL;
+			const double delay = strtod(value.c_str(), &delay_end);
+			if (delay_end == value.c_str() || delay < 0)
+				continue;
+
+			if (group_specific)
+				specific_delay = delay;
+			if (group_common)
+				common_delay = delay;
+		}
+	}
+
+	const std::vector<parsed_rule> &rules = has_specific ? specific_rules : common_rules;
+	m_crawl_delay = has_specific ? specific_delay : common_delay;
+
+	for (auto it = rules.begin(); it != rules.end(); ++it)
+		add_rule(it->pattern, it->allow);
+}
+
+robots_rules robots_rules::disallow_all()
+{
+	robots_rules result;
+	result.m_disallow_all = true;
+	return result;
+}
+
+void robots_rules::add_rule(const std::string &pattern, bool allow)
+{
+	rule value = { allow, pattern.size() };
+	const int rule_index = m_rules.size();
+	m_rules.push_back(value);
+
+	int index = 0;
+	for (size_t i = 0; i < pattern.size(); ++i) {
+		const char c = pattern[i];
+
+		if (c == '$' && i + 1 == pattern.size()) {
+			if (m_nodes[index].end_rule < 0 || better(rule_index, m_nodes[index].end_rule))
+				m_nodes[index].end_rule = rule_index;
+			return;
+		}
+
+		if (c == '*') {
+			// Sequence of wildcards is the same as single one
+			if (m_nodes[index].wildcard)
+				continue;
+
+			if (m_nodes[index].star < 0) {
+				m_nodes[index].star = m_nodes.size();
+				m_nodes.push_back(node());
+				m_nodes.back().wildcard = true;
+			}
+			index = m_nodes[index].star;
+			continue;
+		}
+
+		int next = child(index, c);
+		if (next < 0) {
+			next = m_nodes.size();
+			m_nodes.push_back(node());
+
+			std::vector<std::pair<char, int>> &children = m_nodes[index].children;
+			const std::pair<char, int> item(c, next);
+			children.insert(std::lower_bound(children.begin(), children.end(), item), item);
+		}
+		index = next;
+	}
+
+	if (m_nodes[index].rule < 0 || better(rule_index, m_nodes[index].rule))
+		m_nodes[index].rule = rule_index;
+}
+
+int robots_rules::child(int index, char c) const
+{
+	const std::vector<std::pair<char, int>> &children = m_nodes[index].children;
+	auto it = std::lower_bound(children.begin(), children.end(), std::make_pair(c, -1));
+	if (it != children.end() && it->first == c)
+		return it->second;
+	return -1;
+}
+
+bool robots_rules::better(int first, int second) const
+{
+	if (second < 0)
+		return true;
+
+	const rule &a = m_rules[first];
+	const rule &b = m_rules[second];
+
+	// The longest rule wins, Allow wins among the equal ones
+	return a.length > b.length || (a.length == b.length && a.allow && !b.allow);
+}
+
+/*
+ * Nodes of the trie have the single parent, so duplicates appear only by wildcards
+ * and there are few of them, it's much cheaper than a visited set as large as the trie
+ */
+static void remove_duplicates(std::vector<int> &nodes)
+{
+	std::sort(nodes.begin(), nodes.end());
+	nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+}
+
+bool robots_rules::allowed(const std::string &path) const
+{
+	if (m_disallow_all)
+		return path == "/robots.txt";
+	if (m_rules.empty())
+		return true;
+
+	/*
+	 * The trie is walked as nondeterministic automaton, all reachable nodes are kept
+	 * for every position of the path, so wildcards never cause exponential backtracking
+	 */
+	std::vector<int> current;
+	std::vector<int> next;
+	int best = -1;
+
+	current.push_back(0);
+
+	for (size_t position = 0; ; ++position) {
+		// Wildcard matches empty sequence too
+		for (size_t i = 0; i < current.size(); ++i) {
+			const int star = m_nodes[current[i]].star;
+			if (star >= 0)
+				current.push_back(star);
+		}
+		remove_duplicates(current);
+
+		for (auto it = current.begin(); it != current.end(); ++it) {
+			const node &item = m_nodes[*it];
+			if (item.rule >= 0 && better(item.rule, best))
+				best = item.rule;
+			if (item.end_rule >= 0 && position == path.size() && better(item.end_rule, best))
+				best = item.end_rule;
+		}
+
+		if (position == path.size() || current.empty())
+			break;
+
+		next.clear();
+		for (auto it = current.begin(); it != current.end(); ++it) {
+			const int target = child(*it, path[position]);
+			if (target >= 0)
+				next.push_back(target);
+			if (m_nodes[*it].wildcard)
+				next.push_back(*it);
+		}
+		remove_duplicates(next);
+		current.swap(next);
+	}
+
+	return best < 0 || m_rules[best].allow || path == "/robots.txt";
+}
+
+double robots_rules::crawl_delay() const
+{
+	return m_crawl_delay;
+}
+
+const std::vector<std::string> &robots_rules::sitemaps() const
+{
+	return m_sitemaps;
+}
+
+size_t robots_rules::rules_count() const
+{
+	return m_rules.size();
+}
+
+typedef std::chrono::steady_clock robots_clock;
+
+struct robots_entry
+{
+	std::string host;
+	std::shared_ptr<const robots_rules> rules;
+	robots_clock::time_point expires;
+};
+
+struct robots_waiter
+{
+	std::string path;
+	robots_cache::handler_func handler;
+};
+
+/*
+ * Returns path and query of \a url
+ */
+static std::string robots_path(const std::string &url)
+{
+	const size_t scheme_end = url.find("://");
+	const size_t begin = url.find_first_of("/?#", scheme_end + 3);
+	if (begin == std::string::npos)
+		return "/";
+
+	const size_t end = url.find('#', begin);
+	std::string path = url.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+	if (path.empty() || path[0] != '/')
+		path.insert(0, "/");
+
+	return path;
+}
+
+class robots_cache_private
+{
+public:
+	robots_cache_private(url_fetcher &fetcher, const std::string &user_agent) :
+		fetcher(fetcher), user_agent(user_agent), capacity(100000), ttl(86400), error_ttl(600), frontier(NULL)
+	{
+	}
+
+	std::shared_ptr<const robots_rules> find(const std::string &host)
+	{
+		auto it = index.find(host);
+		if (it == index.end())
+			return std::shared_ptr<const robots_rules>();
+
+		if (it->second->expires < robots_clock::now()) {
+			lru.erase(it->second);
+			index.erase(it);
+			return std::shared_ptr<const robots_rules>();
+		}
+
+		lru.splice(lru.begin(), lru, it->second);
+		return it->second->rules;
+	}
+
+	void insert(const std::string &host, const std::shared_ptr<const robots_rules> &rules, long entry_ttl)
+	{
+		auto it = index.find(host);
+		if (it != index.end()) {
+			lru.erase(it->second);
+			index.erase(it);
+		}
+
+		robots_entry entry = { host, rules, robots_clock::now() + std::chrono::seconds(entry_ttl) };
+		lru.push_front(entry);
+		index[host] = lru.begin();
+
+		while (lru.size() > capacity) {
+			index.erase(lru.back().host);
+			lru.pop_back();
+		}
+	}
+
+	void fetch(const std::string &host);
+	void on_fetched(const std::string &host, int code, const std::string &body, const boost::system::error_code &error);
+
+	url_fetcher &fetcher;
+	std::string user_agent;
+	size_t capacity;
+	long ttl;
+	long error_ttl;
+	crawl_frontier *frontier;
+
+	mutable std::mutex mutex;
+	std::list<robots_entry> lru;
+	std::unordered_map<std::string, std::list<robots_entry>::iterator> index;
+	std::unordered_map<std::string, std::vector<robots_waiter>> pending;
+};
+
+/*
+ * Receives robots.txt, body is truncated by max_robots_size
+ */
+class robots_stream : public base_stream
+{
+public:
+	robots_stream(robots_cache_private *cache, const std::string &host) : m_cache(cache), m_host(host), m_code(0)
+	{
+	}
+
+	void on_headers(url_fetcher::response &&response)
+	{
+		m_code = response.code();
+	}
+
+	void on_data(const boost::asio::const_buffer &buffer)
+	{
+		const size_t size = std::min<size_t>(boost::asio::buffer_size(buffer), max_robots_size - m_body.size());
+		m_body.append(boost::asio::buffer_cast<const char *>(buffer), size);
+	}
+
+	void on_close(const boost::system::error_code &error)
+	{
+		m_cache->on_fetched(m_host, m_code, m_body, error);
+	}
+
+private:
+	robots_cache_private *m_cache;
+	std::string m_host;
+	int m_code;
+	std::string m_body;
+};
+
+void robots_cache_private::fetch(const std::string &host)
+{
+	url_fetcher::request request;
+	request.set_url(host + "/robots.txt");
+	request.set_follow_location(true);
+	request.set_timeout(robots_timeout);
+	request.headers().set("User-Agent", user_agent);
+
+	fetcher.get(std::make_shared<robots_stream>(this, host), std::move(request));
+}
+
+void robots_cache_private::on_fetched(const std::string &host, int code, const std::string &body,
+	const boost::system::error_code &error)
+{
+	std::shared_ptr<const robots_rules> rules;
+	long entry_ttl = ttl;
+
+	if (error || code == 0 || code >= 500 || code == 429) {
+		// Server is unreachable or overloaded, so it's safer to crawl nothing for a while
+		rules = std::make_shared<robots_rules>(robots_rules::disallow_all());
+		entry_ttl = error_ttl;
+	} else if (code >= 200 && code < 300) {
+		rules = std::make_shared<robots_rules>(body, user_agent);
+	} else {
+		// There is no robots.txt, everything is allowed
+		rules = std::make_shared<robots_rules>();
+	}
+
+	std::vector<robots_waiter> waiters;
+	crawl_frontier *host_frontier;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		insert(host, rules, entry_ttl);
+
+		auto it = pending.find(host);
+		if (it != pending.end()) {
+			waiters.swap(it->second);
+			pending.erase(it);
+		}
+		host_frontier = frontier;
+	}
+
+	if (host_frontier && rules->crawl_delay() >= 0)
+		host_frontier->set_host_delay(host, long(rules->crawl_delay() * 1000));
+
+	for (auto it = waiters.begin(); it != waiters.end(); ++it)
+		it->handler(rules->allowed(it->path));
+}
+
+robots_cache::robots_cache(url_fetcher &fetcher, const std::string &user_agent) :
+	m_data(new robots_cache_private(fetcher, user_agent))
+{
+}
+
+robots_cache::~robots_cache()
+{
+}
+
+void robots_cache::set_capacity(size_t capacity)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->capacity = std::max<size_t>(1, capacity);
+}
+
+void robots_cache::set_ttl(long ttl)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->ttl = ttl;
+}
+
+void robots_cache::set_error_ttl(long ttl)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->error_ttl = ttl;
+}
+
+void robots_cache::set_frontier(crawl_frontier *frontier)
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	m_data->frontier = frontier;
+}
+
+void robots_cache::check(const std::string &url, const handler_func &handler)
+{
+	const std::string host = crawl_frontier::host_key(url);
+	if (host.empty()) {
+		handler(false);
+		return;
+	}
+
+	const std::string path = robots_path(url);
+	std::shared_ptr<const robots_rules> rules;
+	bool need_fetch = false;
+
+	{
+		std::lock_guard<std::mutex> lock(m_data->mutex);
+		rules = m_data->find(host);
+
+		if (!rules) {
+			// Only the first check of the host starts the fetch, others wait for it
+			std::vector<robots_waiter> &waiters = m_data->pending[host];
+			need_fetch = waiters.empty();
+
+			robots_waiter waiter = { path, handler };
+			waiters.push_back(waiter);
+		}
+	}
+
+	if (rules)
+		handler(rules->allowed(path));
+	else if (need_fetch)
+		m_data->fetch(host);
+}
+
+bool robots_cache::check_cached(const std::string &url, bool &allowed)
+{
+	const std::string host = crawl_frontier::host_key(url);
+	if (host.empty()) {
+		allowed = false;
+		return true;
+	}
+
+	std::shared_ptr<const robots_rules> rules;
+	{
+		std::lock_guard<std::mutex> lock(m_data->mutex);
+		rules = m_data->find(host);
+	}
+
+	if (!rules)
+		return false;
+
+	allowed = rules->allowed(robots_path(url));
+	return true;
+}
+
+size_t robots_cache::size() const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	return m_data->lru.size();
+}
+
+size_t robots_cache::pending() const
+{
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+	return m_data->pending.size();
+}
+
+}} // namespace ioremap::swarm
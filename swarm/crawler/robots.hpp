@@ -0,0 +1,215 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOREMAP_SWARM_CRAWLER_ROBOTS_HPP
+#define IOREMAP_SWARM_CRAWLER_ROBOTS_HPP
+
+#include "../urlfetcher/url_fetcher.hpp"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ioremap {
+namespace swarm {
+
+class robots_cache_private;
+class crawl_frontier;
+
+/*!
+ * \brief The robots_rules class is compiled set of robots.txt rules for the single user agent.
+ *
+ * Rules are compiled to the prefix trie, '*' wildcards are nodes of the trie matching any
+ * sequence and '$' marks the end of the path. As robots.txt specification requires the longest
+ * matching rule wins, Allow wins on equal length.
+ *
+ * \code{.cpp}
+ * swarm::robots_rules rules(text, "swarm-crawler");
+ * if (rules.allowed("/private/page.html?id=1"))
+ *     fetch();
+ * \endcode
+ */
+class robots_rules
+{
+public:
+	/*!
+	 * \brief Constructs rules which allow everything.
+	 */
+	robots_rules();
+	/*!
+	 * \brief Constructs rules by robots.txt \a text for \a user_agent.
+	 *
+	 * Group of the most specific user agent matching \a user_agent is used, group for '*' otherwise.
+	 */
+	robots_rules(const std::string &text, const std::string &user_agent);
+
+	/*!
+	 * \brief Constructs rules which disallow everything.
+	 *
+	 * It's used when robots.txt can not be fetched because of server errors.
+	 */
+	static robots_rules disallow_all();
+
+	/*!
+	 * \brief Returns true if \a path is allowed, path may contain query part.
+	 */
+	bool allowed(const std::string &path) const;
+	/*!
+	 * \brief Returns Crawl-delay in seconds or negative number if it's not specified.
+	 */
+	double crawl_delay() const;
+	/*!
+	 * \brief Returns Sitemap urls listed in robots.txt.
+	 */
+	const std::vector<std::string> &sitemaps() const;
+	/*!
+	 * \brief Returns number of rules.
+	 */
+	size_t rules_count() const;
+
+private:
+	struct node
+	{
+		node() : star(-1), rule(-1), end_rule(-1), wildcard(false)
+		{
+		}
+
+		// Sorted by character
+		std::vector<std::pair<char, int>> children;
+		// Child for '*' wildcard
+		int star;
+		// Rule which ends at this node
+		int rule;
+		// Rule which ends at this node with '$'
+		int end_rule;
+		// Node is reached by '*', so it matches any sequence of characters
+		bool wildcard;
+	};
+
+	struct rule
+	{
+		bool allow;
+		size_t length;
+	};
+
+	void add_rule(const std::string &pattern, bool allow);
+	int child(int index, char c) const;
+	bool better(int first, int second) const;
+
+	std::vector<node> m_nodes;
+	std::vector<rule> m_rules;
+	std::vector<std::string> m_sitemaps;
+	double m_crawl_delay;
+	bool m_disallow_all;
+};
+
+/*!
+ * \brief The robots_cache class fetches, caches and checks robots.txt of crawled hosts.
+ *
+ * Robots.txt of the host is fetched by url_fetcher on the first check of it's url, all checks
+ * for the host made while it's in flight wait for the same fetch. Compiled rules are kept
+ * in LRU cache of limited size and are fetched again once their TTL is expired.
+ *
+ * If the frontier is set Crawl-delay of the host is passed to it as host's delay.
+ *
+ * Missing robots.txt (4xx replies) allows everything. Server and network errors, as well as
+ * 429 Too Many Requests, disallow everything for the shorter error TTL.
+ *
+ * The cache is thread-safe. Handlers are called either immediately or from the url_fetcher's thread.
+ *
+ * \code{.cpp}
+ * swarm::robots_cache robots(fetcher, "swarm-crawler");
+ * robots.set_frontier(&frontier);
+ *
+ * robots.check(url, [&frontier, url] (bool allowed) {
+ *     if (allowed)
+ *         frontier.push(swarm::frontier_entry(url));
+ * });
+ * \endcode
+ */
+class robots_cache
+{
+public:
+	typedef std::function<void (bool allowed)> handler_func;
+
+	/*!
+	 * \brief Constructs cache which fetches robots.txt by \a fetcher for \a user_agent.
+	 */
+	robots_cache(url_fetcher &fetcher, const std::string &user_agent);
+	robots_cache(const robots_cache &other) = delete;
+	/*!
+	 * \brief Destroys the cache.
+	 *
+	 * \attention There must be no robots.txt fetches in flight.
+	 */
+	~robots_cache();
+
+	robots_cache &operator =(const robots_cache &other) = delete;
+
+	/*!
+	 * \brief Sets the maximum number of hosts in the cache to \a capacity.
+	 *
+	 * By default this property is set to 100000.
+	 */
+	void set_capacity(size_t capacity);
+	/*!
+	 * \brief Sets the time rules are kept in cache to \a ttl seconds.
+	 *
+	 * By default this property is set to 86400 seconds.
+	 */
+	void set_ttl(long ttl);
+	/*!
+	 * \brief Sets the time rules are kept in cache after fetch error to \a ttl seconds.
+	 *
+	 * By default this property is set to 600 seconds.
+	 */
+	void set_error_ttl(long ttl);
+	/*!
+	 * \brief Sets the \a frontier which receives Crawl-delay of the hosts.
+	 */
+	void set_frontier(crawl_frontier *frontier);
+
+	/*!
+	 * \brief Checks if \a url is allowed and calls \a handler with the result.
+	 *
+	 * Handler is called immediately if rules of the host are cached, otherwise once robots.txt is fetched.
+	 * Urls without host are never allowed.
+	 */
+	void check(const std::string &url, const handler_func &handler);
+	/*!
+	 * \brief Checks if \a url is allowed by cached rules without any fetches.
+	 *
+	 * Returns false if rules of the host are not cached, \a allowed is set otherwise.
+	 */
+	bool check_cached(const std::string &url, bool &allowed);
+
+	/*!
+	 * \brief Returns number of hosts in the cache.
+	 */
+	size_t size() const;
+	/*!
+	 * \brief Returns number of robots.txt fetches in flight.
+	 */
+	size_t pending() const;
+
+private:
+	std::unique_ptr<robots_cache_private> m_data;
+};
+
+}} // namespace ioremap::swarm
+
+#endif // IOREMAP_SWARM_CRAWLER_ROBOTS_HPP
@@ -0,0 +1,533 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "seen_set.hpp"
+#include "checkpoint_p.hpp"
+#include "hash.hpp"
+#include "../c++config.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#ifdef SWARM_CSTDATOMIC
+#  include <cstdatomic>
+#else
+#  include <atomic>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ioremap {
+namespace swarm {
+
+// "SWSEEN01" in little endian
+static const uint64_t checkpoint_magic = 0x31304e4545535753ULL;
+
+enum {
+	shard_bits = 6,
+	shards_count = 1 << shard_bits,
+	min_table_size = 1024,
+	// Runs are merged once there are too many of them to check on every lookup
+	max_runs_count = 8
+};
+
+static std::runtime_error make_error(const std::string &message, int err)
+{
+	return std::runtime_error(message + ": " + strerror(err));
+}
+
+/*
+ * Sorted array of fingerprints written to the disk, it's read by mmap
+ */
+class spill_run
+{
+public:
+	spill_run(const std::string &path) : path(path), data(NULL), count(0)
+	{
+	}
+
+	~spill_run()
+	{
+		if (data)
+			munmap(const_cast<uint64_t *>(data), count * sizeof(uint64_t));
+		unlink(path.c_str());
+	}
+
+	void write(const uint64_t *begin, size_t size)
+	{
+		int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0)
+			throw make_error("can not create seen set's file \"" + path + "\"", errno);
+
+		const char *buffer = reinterpret_cast<const char *>(begin);
+		size_t left = size * sizeof(uint64_t);
+		while (left > 0) {
+			ssize_t written = ::write(fd, buffer, left);
+			if (written < 0) {
+				if (errno == EINTR)
+					continue;
+				int err = errno;
+				close(fd);
+				throw make_error("can not write seen set's file \"" + path + "\"", err);
+			}
+			buffer += written;
+			left -= written;
+		}
+
+		map(fd, size);
+		close(fd);
+	}
+
+	bool contains(uint64_t fingerprint) const
+	{
+		return std::binary_search(data, data + count, fingerprint);
+	}
+
+	std::string path;
+	const uint64_t *data;
+	size_t count;
+
+private:
+	void map(int fd, size_t size)
+	{
+		count = size;
+		if (size == 0)
+			return;
+
+		void *result = mmap(NULL, size * sizeof(uint64_t), PROT_READ, MAP_SHARED, fd, 0);
+		if (result == MAP_FAILED) {
+			int err = errno;
+			close(fd);
+			throw make_error("can not map seen set's file \"" + path + "\"", err);
+		}
+
+		data = reinterpret_cast<const uint64_t *>(result);
+	}
+};
+
+/*
+ * Open-addressing hash table of fingerprints, zero marks empty slot
+ */
+struct seen_shard
+{
+	seen_shard() : count(0), spilled(0), next_run(0)
+	{
+	}
+
+	std::mutex mutex;
+	std::vector<uint64_t> table;
+	size_t count;
+	size_t spilled;
+	size_t next_run;
+	std::vector<std::unique_ptr<spill_run>> runs;
+};
+
+/*
+ * Bloom filter with atomic words, so it's used without any locks
+ */
+class bloom_filter
+{
+public:
+	bloom_filter(size_t expected_count, double false_positive_rate)
+	{
+		const double ln2 = std::log(2.);
+		const double bits = -double(std::max<size_t>(expected_count, 1)) * std::log(false_positive_rate) / (ln2 * ln2);
+
+		words_count = std::max<size_t>(1, size_t(bits / 64) + 1);
+		hashes = std::max(1, int(bits / std::max<size_t>(expected_count, 1) * ln2 + 0.5));
+		words.reset(new std::atomic<uint64_t>[words_count]);
+		for (size_t i = 0; i < words_count; ++i)
+			words[i] = 0;
+	}
+
+	/*
+	 * Returns true if all bits were already set, so the fingerprint is probably known
+	 */
+	bool test_and_set(uint64_t fingerprint)
+	{
+		bool known = true;
+		for (int i = 0; i < hashes; ++i) {
+			const uint64_t bit = bit_index(fingerprint, i);
+			std::atomic<uint64_t> &word = words[bit / 64];
+			const uint64_t mask = uint64_t(1) << (bit % 64);
+
+			if (!(word.load(std::memory_order_relaxed) & mask) && !(word.fetch_or(mask) & mask))
+				known = false;
+		}
+		return known;
+	}
+
+	bool test(uint64_t fingerprint) const
+	{
+		for (int i = 0; i < hashes; ++i) {
+			const uint64_t bit = bit_index(fingerprint, i);
+			if (!(words[bit / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (bit % 64))))
+				return false;
+		}
+		return true;
+	}
+
+	size_t memory_usage() const
+	{
+		return words_count * sizeof(uint64_t);
+	}
+
+private:
+	/*
+	 * Double hashing by Kirsch and Mitzenmacher
+	 */
+	uint64_t bit_index(uint64_t fingerprint, int index) const
+	{
+		const uint64_t second = ((fingerprint >> 32) | (fingerprint << 32)) * 0x9e3779b97f4a7c15ULL | 1;
+		return (fingerprint + index * second) % (words_count * 64);
+	}
+
+	std::unique_ptr<std::atomic<uint64_t>[]> words;
+	size_t words_count;
+	int hashes;
+};
+
+class seen_set_private
+{
+public:
+	seen_set_private() : memory_limit(0), count(0)
+	{
+	}
+
+	seen_shard &shard(uint64_t fingerprint)
+	{
+		return shards[fingerprint >> (64 - shard_bits)];
+	}
+
+	static bool table_contains(const seen_shard &shard, uint64_t fingerprint)
+	{
+		if (shard.table.empty())
+			return false;
+
+		const size_t mask = shard.table.size() - 1;
+		for (size_t i = fingerprint & mask; shard.table[i]; i = (i + 1) & mask) {
+			if (shard.table[i] == fingerprint)
+				return true;
+		}
+
+		return false;
+	}
+
+	static bool runs_contain(const seen_shard &shard, uint64_t fingerprint)
+	{
+		for (auto it = shard.runs.begin(); it != shard.runs.end(); ++it) {
+			if ((*it)->contains(fingerprint))
+				return true;
+		}
+
+		return false;
+	}
+
+	static void table_insert(std::vector<uint64_t> &table, uint64_t fingerprint)
+	{
+		const size_t mask = table.size() - 1;
+		size_t i = fingerprint & mask;
+		while (table[i])
+			i = (i + 1) & mask;
+		table[i] = fingerprint;
+	}
+
+	void reserve(seen_shard &shard)
+	{
+		if (!shard.table.empty() && (shard.count + 1) * 4 <= shard.table.size() * 3)
+			return;
+
+		const size_t new_size = std::max<size_t>(min_table_size, shard.table.size() * 2);
+
+		if (!directory.empty() && shard.count > 0 && new_size * sizeof(uint64_t) > memory_limit / shards_count) {
+			spill(shard);
+			return;
+		}
+
+		std::vector<uint64_t> table(new_size, 0);
+		for (auto it = shard.table.begin(); it != shard.table.end(); ++it) {
+			if (*it)
+				table_insert(table, *it);
+		}
+		shard.table.swap(table);
+	}
+
+	void spill(seen_shard &shard)
+	{
+		std::vector<uint64_t> sorted;
+		sorted.reserve(shard.count);
+		for (auto it = shard.table.begin(); it != shard.table.end(); ++it) {
+			if (*it)
+				sorted.push_back(*it);
+		}
+		std::sort(sorted.begin(), sorted.end());
+
+		std::unique_ptr<spill_run> run(new spill_run(run_path(shard)));
+		run->write(sorted.data(), sorted.size());
+		shard.runs.emplace_back(std::move(run));
+
+		shard.spilled += shard.count;
+		shard.count = 0;
+		std::fill(shard.table.begin(), shard.table.end(), 0);
+
+		if (shard.runs.size() >= max_runs_count)
+			merge(shard);
+	}
+
+	void merge(seen_shard &shard)
+	{
+		std::vector<uint64_t> merged;
+		merged.reserve(shard.spilled);
+
+		// Runs are disjoint as every fingerprint was checked against all of them before insertion
+		std::vector<const uint64_t *> heads;
+		std::vector<const uint64_t *> ends;
+		for (auto it = shard.runs.begin(); it != shard.runs.end(); ++it) {
+			heads.push_back((*it)->data);
+			ends.push_back((*it)->data + (*it)->count);
+		}
+
+		for (;;) {
+			size_t best = heads.size();
+			for (size_t i = 0; i < heads.size(); ++i) {
+				if (heads[i] != ends[i] && (best == heads.size() || *heads[i] < *heads[best]))
+					best = i;
+			}
+
+			if (best == heads.size())
+				break;
+
+			merged.push_back(*heads[best]++);
+		}
+
+		std::unique_ptr<spill_run> run(new spill_run(run_path(shard)));
+		run->write(merged.data(), merged.size());
+
+		shard.runs.clear();
+		shard.runs.emplace_back(std::move(run));
+	}
+
+	std::string run_path(seen_shard &shard)
+	{
+		char buffer[64];
+		snprintf(buffer, sizeof(buffer), "/seen-%d-%02zu-%zu.bin", int(getpid()), size_t(&shard - shards), shard.next_run++);
+		return directory + buffer;
+	}
+
+	seen_shard shards[shards_count];
+	std::unique_ptr<bloom_filter> bloom;
+	size_t memory_limit;
+	std::string directory;
+	std::atomic<size_t> count;
+};
+
+seen_set::seen_set(size_t expected_count) : m_data(new seen_set_private)
+{
+	if (expected_count == 0)
+		return;
+
+	size_t size = min_table_size;
+	while (size * 3 / 4 < expected_count / shards_count)
+		size *= 2;
+
+	for (size_t i = 0; i < shards_count; ++i)
+		m_data->shards[i].table.resize(size, 0);
+}
+
+seen_set::~seen_set()
+{
+}
+
+void seen_set::set_bloom_filter(size_t expected_count, double false_positive_rate)
+{
+	if (false_positive_rate <= 0 || false_positive_rate >= 1)
+		throw std::invalid_argument("seen_set::set_bloom_filter: false positive rate must be in (0, 1)");
+
+	m_data->bloom.reset(new bloom_filter(expected_count, false_positive_rate));
+}
+
+void seen_set::set_memory_limit(size_t limit, const std::string &directory)
+{
+	struct stat st;
+	if (stat(directory.c_str(), &st) != 0)
+		throw make_error("seen_set::set_memory_limit: invalid directory \"" + directory + "\"", errno);
+
+	m_data->memory_limit = limit;
+	m_data->directory = directory;
+}
+
+uint64_t seen_set::fingerprint(const char *url, size_t size)
+{
+	const char *end = reinterpret_cast<const char *>(memchr(url, '#', size));
+	if (end)
+		size = end - url;
+
+	const uint64_t result = hash64(url, size);
+	// Zero marks empty slots of the table
+	return result ? result : 1;
+}
+
+uint64_t seen_set::fingerprint(const std::string &url)
+{
+	return fingerprint(url.c_str(), url.size());
+}
+
+bool seen_set::insert(const std::string &url)
+{
+	return insert_fingerprint(fingerprint(url));
+}
+
+bool seen_set::insert_fingerprint(uint64_t fingerprint)
+{
+	if (!fingerprint)
+		fingerprint = 1;
+
+	seen_shard &shard = m_data->shard(fingerprint);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+
+	/*
+	 * If Bloom filter hasn't seen it, it's certainly new, so disk is not touched.
+	 * It's checked under the shard's lock, so the same fingerprint can't be inserted twice concurrently
+	 */
+	const bool maybe_known = !m_data->bloom || m_data->bloom->test_and_set(fingerprint);
+
+	if (maybe_known) {
+		if (seen_set_private::table_contains(shard, fingerprint))
+			return false;
+		if (seen_set_private::runs_contain(shard, fingerprint))
+			return false;
+	}
+
+	m_data->reserve(shard);
+	seen_set_private::table_insert(shard.table, fingerprint);
+	++shard.count;
+	++m_data->count;
+
+	return true;
+}
+
+bool seen_set::contains(const std::string &url) const
+{
+	return contains_fingerprint(fingerprint(url));
+}
+
+bool seen_set::contains_fingerprint(uint64_t fingerprint) const
+{
+	if (!fingerprint)
+		fingerprint = 1;
+
+	if (m_data->bloom && !m_data->bloom->test(fingerprint))
+		return false;
+
+	seen_shard &shard = m_data->shard(fingerprint);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+
+	return seen_set_private::table_contains(shard, fingerprint)
+		|| seen_set_private::runs_contain(shard, fingerprint);
+}
+
+size_t seen_set::size() const
+{
+	return m_data->count;
+}
+
+size_t seen_set::spilled() const
+{
+	size_t result = 0;
+	for (size_t i = 0; i < shards_count; ++i) {
+		seen_shard &shard = m_data->shards[i];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		result += shard.spilled;
+	}
+	return result;
+}
+
+size_t seen_set::memory_usage() const
+{
+	size_t result = m_data->bloom ? m_data->bloom->memory_usage() : 0;
+	for (size_t i = 0; i < shards_count; ++i) {
+		seen_shard &shard = m_data->shards[i];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		result += shard.table.size() * sizeof(uint64_t);
+	}
+	return result;
+}
+
+void seen_set::save(const std::string &path) const
+{
+	const std::string tmp_path = path + ".tmp";
+	FILE *file = fopen(tmp_path.c_str(), "wb");
+	if (!file)
+		throw make_error("can not create seen set's checkpoint \"" + tmp_path + "\"", errno);
+
+	bool ok = fwrite(&checkpoint_magic, sizeof(checkpoint_magic), 1, file) == 1;
+
+	// Shards are saved one by one, so urls inserted concurrently may be missed
+	for (size_t i = 0; ok && i < shards_count; ++i) {
+		seen_shard &shard = m_data->shards[i];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		for (auto it = shard.table.begin(); ok && it != shard.table.end(); ++it) {
+			if (*it)
+				ok = fwrite(&*it, sizeof(uint64_t), 1, file) == 1;
+		}
+
+		for (auto it = shard.runs.begin(); ok && it != shard.runs.end(); ++it) {
+			const spill_run &run = **it;
+			ok = run.count == 0 || fwrite(run.data, sizeof(uint64_t), run.count, file) == run.count;
+		}
+	}
+
+	const int err = commit_checkpoint(file, ok, errno, tmp_path, path);
+	if (err)
+		throw make_error("can not write seen set's checkpoint \"" + path + "\"", err);
+}
+
+bool seen_set::load(const std::string &path)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file) {
+		if (errno == ENOENT)
+			return false;
+		throw make_error("can not open seen set's checkpoint \"" + path + "\"", errno);
+	}
+
+	uint64_t magic = 0;
+	if (fread(&magic, sizeof(magic), 1, file) != 1 || magic != checkpoint_magic) {
+		fclose(file);
+		throw std::runtime_error("invalid seen set's checkpoint \"" + path + "\"");
+	}
+
+	uint64_t buffer[1024];
+	size_t count;
+	while ((count = fread(buffer, sizeof(uint64_t), sizeof(buffer) / sizeof(buffer[0]), file)) > 0) {
+		for (size_t i = 0; i < count; ++i)
+			insert_fingerprint(buffer[i]);
+	}
+
+	fclose(file);
+	return true;
+}
+
+}} // namespace ioremap::swarm
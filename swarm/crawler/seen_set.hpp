@@ -0,0 +1,147 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOREMAP_SWARM_CRAWLER_SEEN_SET_HPP
+#define IOREMAP_SWARM_CRAWLER_SEEN_SET_HPP
+
+#include <memory>
+#include <string>
+#include <cstdint>
+
+namespace ioremap {
+namespace swarm {
+
+class seen_set_private;
+
+/*!
+ * \brief The seen_set class is a thread-safe set of urls already known to the crawler.
+ *
+ * Urls are not stored, only their 64-bit fingerprints are, so every url takes about
+ * 11 bytes of memory. Probability of fingerprints collision is negligible for billions of urls.
+ *
+ * The set is split to shards by fingerprint, each shard has it's own lock, so concurrent
+ * inserts from many threads almost never contend.
+ *
+ * Optionally the set may be fronted by the Bloom filter with lock-free atomic words, most of new urls
+ * are recognized as new by it only. It makes especially sense together with spilling to disk:
+ * once memory limit is reached shards are written to the disk as sorted runs, which
+ * are read only for urls the Bloom filter is not sure about.
+ *
+ * Urls should be normalized before, i.e. by url_resolver, fragment part of the url is ignored.
+ *
+ * \code{.cpp}
+ * swarm::seen_set seen;
+ * seen.set_bloom_filter(100 * 1000 * 1000, 0.01);
+ * seen.set_memory_limit(1024 * 1024 * 1024, "/var/tmp/crawler");
+ *
+ * if (seen.insert(url))
+ *     frontier.push(url);
+ * \endcode
+ *
+ * \sa url_resolver
+ */
+class seen_set
+{
+public:
+	/*!
+	 * \brief Constructs empty set, which expects about \a expected_count urls.
+	 */
+	seen_set(size_t expected_count = 0);
+	seen_set(const seen_set &other) = delete;
+	/*!
+	 * \brief Destroys the set, files spilled to the disk are removed.
+	 */
+	~seen_set();
+
+	seen_set &operator =(const seen_set &other) = delete;
+
+	/*!
+	 * \brief Fronts the set by Bloom filter for \a expected_count urls with \a false_positive_rate.
+	 *
+	 * It must be called before the first insert. Filter takes about 1.2 bytes per url for 1% rate.
+	 */
+	void set_bloom_filter(size_t expected_count, double false_positive_rate);
+	/*!
+	 * \brief Makes the set to spill fingerprints to \a directory once they take more than \a limit bytes.
+	 *
+	 * It must be called before the first insert. By default there is no limit.
+	 */
+	void set_memory_limit(size_t limit, const std::string &directory);
+
+	/*!
+	 * \brief Returns the fingerprint of \a url of \a size bytes.
+	 */
+	static uint64_t fingerprint(const char *url, size_t size);
+	/*!
+	 * \brief Returns the fingerprint of \a url.
+	 */
+	static uint64_t fingerprint(const std::string &url);
+
+	/*!
+	 * \brief Inserts \a url to the set.
+	 *
+	 * Returns true if url was not in the set yet.
+	 */
+	bool insert(const std::string &url);
+	/*!
+	 * \brief Inserts url with \a fingerprint to the set.
+	 *
+	 * Returns true if url was not in the set yet.
+	 */
+	bool insert_fingerprint(uint64_t fingerprint);
+	/*!
+	 * \brief Returns true if \a url is in the set.
+	 */
+	bool contains(const std::string &url) const;
+	/*!
+	 * \brief Returns true if url with \a fingerprint is in the set.
+	 */
+	bool contains_fingerprint(uint64_t fingerprint) const;
+
+	/*!
+	 * \brief Returns number of urls in the set.
+	 */
+	size_t size() const;
+	/*!
+	 * \brief Returns number of urls spilled to the disk.
+	 */
+	size_t spilled() const;
+	/*!
+	 * \brief Returns number of bytes used by in-memory shards and the Bloom filter.
+	 */
+	size_t memory_usage() const;
+
+	/*!
+	 * \brief Saves fingerprints of all urls to \a path.
+	 *
+	 * File is written under the temporary name and renamed, so the previous checkpoint is kept
+	 * intact on failure. Throws std::runtime_error on error.
+	 */
+	void save(const std::string &path) const;
+	/*!
+	 * \brief Inserts all urls saved to \a path to the set.
+	 *
+	 * Returns false if there is no such file. Throws std::runtime_error if the file is broken.
+	 */
+	bool load(const std::string &path);
+
+private:
+	std::unique_ptr<seen_set_private> m_data;
+};
+
+}} // namespace ioremap::swarm
+
+#endif // IOREMAP_SWARM_CRAWLER_SEEN_SET_HPP
@@ -27,6 +27,8 @@ namespace swarm {
 
 #define LAST_MODIFIED_HEADER "Last-Modified"
 #define IF_MODIFIED_SINCE_HEADER "If-Modified-Since"
+#define ETAG_HEADER "ETag"
+#define IF_NONE_MATCH_HEADER "If-None-Match"
 #define CONNECTION_HEADER "Connection"
 #define CONNECTION_HEADER_KEEP_ALIVE "Keep-Alive"
 #define CONTENT_LENGTH_HEADER "Content-Length"
@@ -483,6 +485,26 @@ void http_headers::set_if_modified_since(time_t time)
 	set_if_modified_since(convert_to_http_date(time));
 }
 
+boost::optional<std::string> http_headers::etag() const
+{
+	return p->get_header(ETAG_HEADER);
+}
+
+void http_headers::set_etag(const std::string &etag)
+{
+	p->set_header(ETAG_HEADER, etag);
+}
+
+boost::optional<std::string> http_headers::if_none_match() const
+{
+	return p->get_header(IF_NONE_MATCH_HEADER);
+}
+
+void http_headers::set_if_none_match(const std::string &etag)
+{
+	p->set_header(IF_NONE_MATCH_HEADER, etag);
+}
+
 void http_headers::set_content_length(size_t length)
 {
 	char buffer[20];
@@ -238,6 +238,31 @@ public:
 	 */
 	void set_if_modified_since(time_t time);
 
+	/*!
+	 * \brief Returnes the value of ETag header.
+	 *
+	 * \sa set_etag
+	 */
+	boost::optional<std::string> etag() const;
+	/*!
+	 * \brief Sets the value of ETag header to \a etag.
+	 *
+	 * \attention \a etag must be quoted, i.e. "\"xyzzy\"" or "W/\"xyzzy\"".
+	 */
+	void set_etag(const std::string &etag);
+	/*!
+	 * \brief Returnes the value of If-None-Match header.
+	 *
+	 * \sa set_if_none_match
+	 */
+	boost::optional<std::string> if_none_match() const;
+	/*!
+	 * \brief Sets the value of If-None-Match header to \a etag.
+	 *
+	 * If the entry's ETag matches the header server should reply by Not Modified 304 error code.
+	 */
+	void set_if_none_match(const std::string &etag);
+
 	/*!
 	 * \brief Sets the value of Content-Length header to \a length;
 	 */
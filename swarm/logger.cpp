@@ -22,6 +22,18 @@
 #include <cstdio>
 #include <cstdarg>
 #include <cstring>
+#include <cerrno>
+#include <system_error>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <fcntl.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include <sys/uio.h>
 
@@ -131,12 +143,419 @@ private:
 	FILE *m_file;
 };
 
+/*
+ * Buffer of the single thread, it's lock is taken only by it's owner
+ * and the flushing thread, so it's almost never contended.
+ */
+struct thread_buffer
+{
+	thread_buffer(buffered_logger_data *owner) : owner(owner), thread_id(get_thread_id()), second(-1)
+	{
+		date[0] = '\0';
+	}
+
+	buffered_logger_data *owner;
+	std::mutex mutex;
+	std::string data;
+	const long thread_id;
+	time_t second;
+	char date[32];
+};
+
+static void write_all(int fd, const char *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t written = ::write(fd, data, size);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			// There is nobody to report the error to
+			return;
+		}
+		data += written;
+		size -= written;
+	}
+}
+
+class buffered_logger_data
+{
+public:
+	buffered_logger_data(const char *file, size_t buffer_size, long flush_interval) :
+		path(file), fd(-1), buffer_size(buffer_size), flush_interval(flush_interval), stopped(false)
+	{
+		fd = open_file();
+		if (int err = pthread_key_create(&key, &buffered_logger_data::on_thread_exit)) {
+			::close(fd);
+			throw std::system_error(err, std::system_category(), "Failed to create thread key for logger");
+		}
+		flusher = std::thread(std::bind(&buffered_logger_data::run, this));
+	}
+
+	~buffered_logger_data()
+	{
+		{
+			std::lock_guard<std::mutex> lock(stop_mutex);
+			stopped = true;
+			stop_condition.notify_all();
+		}
+		flusher.join();
+
+		pthread_key_delete(key);
+
+		std::lock_guard<std::mutex> lock(buffers_mutex);
+		for (auto it = buffers.begin(); it != buffers.end(); ++it) {
+			write_buffer(**it);
+			delete *it;
+		}
+		buffers.clear();
+		::close(fd);
+	}
+
+	int open_file()
+	{
+		int result = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+		if (result < 0) {
+			int err = errno;
+			std::string message = "Failed to open log file \"";
+			message += path;
+			message += "\": ";
+			message += strerror(err);
+			throw std::ios_base::failure(message);
+		}
+		return result;
+	}
+
+	thread_buffer &local_buffer()
+	{
+		thread_buffer *buffer = static_cast<thread_buffer *>(pthread_getspecific(key));
+		if (!buffer) {
+			buffer = new thread_buffer(this);
+			buffer->data.reserve(buffer_size + 1024);
+
+			std::lock_guard<std::mutex> lock(buffers_mutex);
+			buffers.push_back(buffer);
+			pthread_setspecific(key, buffer);
+		}
+		return *buffer;
+	}
+
+	void log(int level, const char *msg)
+	{
+		thread_buffer &buffer = local_buffer();
+
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+
+		std::lock_guard<std::mutex> lock(buffer.mutex);
+
+		if (buffer.second != tv.tv_sec) {
+			struct tm tm;
+			buffer.second = tv.tv_sec;
+			localtime_r(&buffer.second, &tm);
+			strftime(buffer.date, sizeof(buffer.date), "%F %R:%S", &tm);
+		}
+
+		const char *level_name = log_level_names[std::max(0, std::min<int>(level, log_level_names_size - 1))];
+		char usecs_and_id[64];
+		snprintf(usecs_and_id, sizeof(usecs_and_id), ".%06ld %ld/%d [%s]: ",
+			(long)tv.tv_usec, buffer.thread_id, getpid(), level_name);
+
+		size_t msg_len = ::strlen(msg);
+		if (msg_len > 0 && msg[msg_len - 1] == '\n')
+			--msg_len;
+
+		buffer.data.append(buffer.date);
+		buffer.data.append(usecs_and_id);
+		buffer.data.append(msg, msg_len);
+		buffer.data.push_back('\n');
+
+		if (buffer.data.size() >= buffer_size)
+			write_buffer(buffer);
+	}
+
+	// Must be called with buffer's lock held, so messages of the thread are never reordered
+	void write_buffer(thread_buffer &buffer)
+	{
+		if (buffer.data.empty())
+			return;
+
+		std::lock_guard<std::mutex> lock(file_mutex);
+		write_all(fd, buffer.data.c_str(), buffer.data.size());
+		buffer.data.clear();
+	}
+
+	void flush()
+	{
+		std::lock_guard<std::mutex> lock(buffers_mutex);
+		for (auto it = buffers.begin(); it != buffers.end(); ++it) {
+			thread_buffer &buffer = **it;
+			std::lock_guard<std::mutex> buffer_lock(buffer.mutex);
+			write_buffer(buffer);
+		}
+	}
+
+	void reopen()
+	{
+		log(-1, "Reopened log file");
+		flush();
+
+		int new_fd = open_file();
+		{
+			std::lock_guard<std::mutex> lock(file_mutex);
+			std::swap(fd, new_fd);
+		}
+		::close(new_fd);
+
+		log(-1, "Reopened log file");
+	}
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(stop_mutex);
+		while (!stopped) {
+			stop_condition.wait_for(lock, std::chrono::milliseconds(flush_interval));
+			if (stopped)
+				break;
+
+			lock.unlock();
+			flush();
+			lock.lock();
+		}
+	}
+
+	static void on_thread_exit(void *data)
+	{
+		thread_buffer *buffer = static_cast<thread_buffer *>(data);
+		buffered_logger_data *owner = buffer->owner;
+
+		std::lock_guard<std::mutex> lock(owner->buffers_mutex);
+		{
+			std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+			owner->write_buffer(*buffer);
+		}
+		owner->buffers.erase(std::remove(owner->buffers.begin(), owner->buffers.end(), buffer), owner->buffers.end());
+		delete buffer;
+	}
+
+	const std::string path;
+	int fd;
+	const size_t buffer_size;
+	const long flush_interval;
+
+	pthread_key_t key;
+	std::mutex buffers_mutex;
+	std::vector<thread_buffer *> buffers;
+	std::mutex file_mutex;
+
+	std::thread flusher;
+	std::mutex stop_mutex;
+	std::condition_variable stop_condition;
+	bool stopped;
+};
+
+buffered_logger_interface::buffered_logger_interface(const char *file, size_t buffer_size, long flush_interval)
+	: m_data(new buffered_logger_data(file, buffer_size, flush_interval))
+{
+	m_data->log(-1, "Opened log file");
+}
+
+buffered_logger_interface::~buffered_logger_interface()
+{
+}
+
+void buffered_logger_interface::log(int level, const char *msg)
+{
+	m_data->log(level, msg);
+}
+
+void buffered_logger_interface::reopen()
+{
+	m_data->reopen();
+}
+
+void buffered_logger_interface::flush()
+{
+	m_data->flush();
+}
+
+/*
+ * Token bucket for every call site. Buckets are split between stripes
+ * by the format pointer, so different call sites rarely share the lock.
+ *
+ * Suppressed messages of the call site are reported either before it's next passed message
+ * or by the reporter thread once it's bucket is refilled, so the count isn't lost if the storm ends.
+ */
+class log_rate_limiter
+{
+public:
+	enum {
+		stripes_count = 64,
+		// Format strings are expected to be literals, so there should not be more call sites
+		max_stripe_size = 1024,
+		// Milliseconds between checks of refilled buckets
+		report_interval = 1000
+	};
+
+	log_rate_limiter(logger_interface *impl, double rate, double burst, int max_level) :
+		rate(rate), burst(std::max(1.0, burst)), max_level(max_level), impl(impl), stopped(false)
+	{
+		reporter = std::thread(std::bind(&log_rate_limiter::run, this));
+	}
+
+	~log_rate_limiter()
+	{
+		{
+			std::lock_guard<std::mutex> lock(stop_mutex);
+			stopped = true;
+			stop_condition.notify_all();
+		}
+		reporter.join();
+
+		// Nothing is going to be logged by this limiter any more
+		report(true);
+	}
+
+	/*
+	 * Returns true if message of \a format may be logged, \a suppressed is set to
+	 * the number of messages of this call site which were dropped since the last passed one.
+	 */
+	bool allow(int level, const char *format, unsigned long long *suppressed)
+	{
+		const double now = current_time();
+
+		stripe &current = stripes[(reinterpret_cast<uintptr_t>(format) >> 3) % stripes_count];
+		std::lock_guard<std::mutex> lock(current.mutex);
+
+		auto it = current.buckets.find(format);
+		if (it == current.buckets.end()) {
+			if (current.buckets.size() >= max_stripe_size)
+				return true;
+
+			bucket &fresh = current.buckets[format];
+			fresh.tokens = burst - 1;
+			fresh.timestamp = now;
+			fresh.suppressed = 0;
+			fresh.level = level;
+			*suppressed = 0;
+			return true;
+		}
+
+		bucket &info = it->second;
+		info.tokens = std::min(burst, info.tokens + (now - info.timestamp) * rate);
+		info.timestamp = now;
+
+		if (info.tokens < 1) {
+			++info.suppressed;
+			info.level = level;
+			return false;
+		}
+
+		info.tokens -= 1;
+		*suppressed = info.suppressed;
+		info.suppressed = 0;
+		return true;
+	}
+
+	const double rate;
+	const double burst;
+	const int max_level;
+
+private:
+	struct bucket
+	{
+		double tokens;
+		double timestamp;
+		unsigned long long suppressed;
+		// Level of the last suppressed message
+		int level;
+	};
+
+	struct stripe
+	{
+		std::mutex mutex;
+		std::unordered_map<const char *, bucket> buckets;
+	};
+
+	struct pending_report
+	{
+		const char *format;
+		unsigned long long suppressed;
+		int level;
+	};
+
+	static double current_time()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec + ts.tv_nsec / 1000000000.;
+	}
+
+	/*
+	 * Logs suppressed counts of call sites whose buckets are refilled, or of all of them if \a all is true
+	 */
+	void report(bool all)
+	{
+		if (!impl)
+			return;
+
+		const double now = current_time();
+		std::vector<pending_report> reports;
+
+		for (size_t i = 0; i < stripes_count; ++i) {
+			stripe &current = stripes[i];
+			std::lock_guard<std::mutex> lock(current.mutex);
+
+			for (auto it = current.buckets.begin(); it != current.buckets.end(); ++it) {
+				bucket &info = it->second;
+				if (info.suppressed == 0)
+					continue;
+				if (!all && info.tokens + (now - info.timestamp) * rate < 1)
+					continue;
+
+				pending_report item = { it->first, info.suppressed, info.level };
+				reports.push_back(item);
+				info.suppressed = 0;
+			}
+		}
+
+		// Messages are logged without stripes' locks, so logging threads don't wait for the file
+		char buffer[1024];
+		for (auto it = reports.begin(); it != reports.end(); ++it) {
+			snprintf(buffer, sizeof(buffer), "%llu messages suppressed like: %s", it->suppressed, it->format);
+			impl->log(it->level, buffer);
+		}
+	}
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(stop_mutex);
+		while (!stopped) {
+			stop_condition.wait_for(lock, std::chrono::milliseconds(report_interval));
+			if (stopped)
+				break;
+
+			lock.unlock();
+			report(false);
+			lock.lock();
+		}
+	}
+
+	stripe stripes[stripes_count];
+	logger_interface *impl;
+
+	std::thread reporter;
+	std::mutex stop_mutex;
+	std::condition_variable stop_condition;
+	bool stopped;
+};
+
 class logger_data
 {
 public:
 	logger_data(int level) : level(level) {}
 
 	std::unique_ptr<logger_interface> impl;
+	std::unique_ptr<log_rate_limiter> limiter;
 	int level;
 };
 
@@ -154,6 +573,14 @@ logger::logger(const char *file, int level) : m_data(std::make_shared<logger_dat
 	m_data->impl.reset(new file_logger_interface(file));
 }
 
+logger::logger(const char *file, int level, bool buffered) : m_data(std::make_shared<logger_data>(level))
+{
+	if (buffered)
+		m_data->impl.reset(new buffered_logger_interface(file));
+	else
+		m_data->impl.reset(new file_logger_interface(file));
+}
+
 logger::~logger()
 {
 }
@@ -168,6 +595,14 @@ void logger::set_level(int level)
 	m_data->level = level;
 }
 
+void logger::set_rate_limit(double rate, double burst, int max_level)
+{
+	if (rate > 0)
+		m_data->limiter.reset(new log_rate_limiter(m_data->impl.get(), rate, burst, max_level));
+	else
+		m_data->limiter.reset();
+}
+
 void logger::reopen()
 {
 	if (m_data->impl) {
@@ -193,9 +628,34 @@ void logger::vlog(int level, const char *format, va_list args) const
 	char buffer[1024];
 	const size_t buffer_size = sizeof(buffer);
 
-	vsnprintf(buffer, buffer_size, format, args);
-	buffer[buffer_size - 1] = '\0';
-	m_data->impl->log(level, buffer);
+	if (m_data->limiter && level <= m_data->limiter->max_level) {
+		unsigned long long suppressed = 0;
+		if (!m_data->limiter->allow(level, format, &suppressed))
+			return;
+
+		if (suppressed > 0) {
+			snprintf(buffer, buffer_size, "%llu messages suppressed like: %s", suppressed, format);
+			m_data->impl->log(level, buffer);
+		}
+	}
+
+	va_list args_copy;
+	va_copy(args_copy, args);
+	const int size = vsnprintf(buffer, buffer_size, format, args_copy);
+	va_end(args_copy);
+
+	if (size < 0)
+		return;
+
+	if (static_cast<size_t>(size) < buffer_size) {
+		m_data->impl->log(level, buffer);
+		return;
+	}
+
+	// Long messages are rare, so they are allowed to pay for allocation
+	std::vector<char> long_buffer(size + 1);
+	vsnprintf(long_buffer.data(), long_buffer.size(), format, args);
+	m_data->impl->log(level, long_buffer.data());
 }
 
 } // namespace swarm
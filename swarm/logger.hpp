@@ -40,6 +40,52 @@ enum log_level {
 };
 
 class logger_data;
+class buffered_logger_data;
+
+/*!
+ * \brief The buffered_logger_interface class is file logger for high rate of messages.
+ *
+ * Every thread appends it's messages to it's own buffer, so logging threads never contend
+ * with each other and never make system calls: thread id is taken once per thread and the
+ * date is formatted once per second. Buffers are written to the file by the background
+ * thread every flush interval, or by the logging thread itself once it's buffer is full.
+ *
+ * Messages of the same thread are written in order, messages of different threads may be
+ * interleaved by the buffer, their timestamps tell the real order. Messages logged right
+ * before the crash may be lost if they were not flushed yet.
+ *
+ * \code{.cpp}
+ * swarm::logger log(new swarm::buffered_logger_interface("/var/log/server.log"), swarm::SWARM_LOG_INFO);
+ * \endcode
+ */
+class buffered_logger_interface : public logger_interface
+{
+public:
+	/*!
+	 * \brief Constructs logger which writes to \a file.
+	 *
+	 * Thread's buffer is flushed once it exceeds \a buffer_size bytes, all buffers are flushed
+	 * every \a flush_interval milliseconds. Throws std::ios_base::failure if the file can not be opened.
+	 */
+	buffered_logger_interface(const char *file, size_t buffer_size = 64 * 1024, long flush_interval = 100);
+	buffered_logger_interface(const buffered_logger_interface &other) = delete;
+	/*!
+	 * \brief Flushes all buffers and closes the file.
+	 */
+	~buffered_logger_interface();
+
+	buffered_logger_interface &operator =(const buffered_logger_interface &other) = delete;
+
+	void log(int level, const char *msg);
+	void reopen();
+	/*!
+	 * \brief Writes buffers of all threads to the file.
+	 */
+	void flush();
+
+private:
+	std::unique_ptr<buffered_logger_data> m_data;
+};
 
 /*!
  * \brief The logger class is convient class for logging facility.
@@ -66,6 +112,12 @@ public:
 	 * Logger will write all entries to \a file.
 	 */
 	logger(const char *file, int level);
+	/*!
+	 * \brief Constructs file logger with \a level, it's buffered if \a buffered is true.
+	 *
+	 * \sa buffered_logger_interface
+	 */
+	logger(const char *file, int level, bool buffered);
 	/*!
 	 * Destroyes object.
 	 */
@@ -80,6 +132,19 @@ public:
 	 */
 	void set_level(int level);
 
+	/*!
+	 * \brief Limits messages of \a max_level and more important ones to \a rate per second for every call site.
+	 *
+	 * Call sites are told apart by the pointer to the format string, each of them may log up to \a burst
+	 * messages at once. Number of suppressed messages is reported before the next message of the call site
+	 * which passes the limit, or by the background thread once the call site's limit is restored, so it's
+	 * reported even if the call site stays silent. Zero \a rate disables limiting, it's the default.
+	 *
+	 * This protects the server from logging the same error for every request once some backend is down.
+	 * Must be called before logger is shared between threads.
+	 */
+	void set_rate_limit(double rate, double burst, int max_level = SWARM_LOG_ERROR);
+
 	/*!
 	 * \brief Reopens logger.
 	 *
@@ -90,6 +155,8 @@ public:
 	/*!
 	 * \brief Logs message \a format with \a level.
 	 *
+	 * Message is formatted only if it passes the level of the logger. It's never truncated.
+	 *
 	 * \attention This method uses printf-like notation.
 	 */
 	void log(int level, const char *format, ...) const __attribute__ ((format(printf, 3, 4)));
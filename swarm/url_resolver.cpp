@@ -0,0 +1,342 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "url_resolver.hpp"
+#include "url.hpp"
+
+#include <string.h>
+
+namespace ioremap {
+namespace swarm {
+
+/*
+ * Components of the reference by RFC 3986, section 3, pointers are inside of the original string
+ */
+struct url_reference
+{
+	const char *scheme;
+	const char *scheme_end;
+	const char *authority;
+	const char *authority_end;
+	const char *path;
+	const char *path_end;
+	const char *query;
+	const char *query_end;
+	const char *fragment;
+	const char *fragment_end;
+
+	bool has_scheme() const { return scheme != scheme_end; }
+	bool has_authority() const { return authority != NULL; }
+	bool has_query() const { return query != NULL; }
+	bool has_fragment() const { return fragment != NULL; }
+};
+
+static inline bool is_alpha(char ch)
+{
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+}
+
+static inline bool is_hex(char ch)
+{
+	return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F');
+}
+
+static inline char to_lower(char ch)
+{
+	return (ch >= 'A' && ch <= 'Z') ? ch - 'A' + 'a' : ch;
+}
+
+static const char *find_any(const char *begin, const char *end, const char *chars)
+{
+	for (; begin < end; ++begin) {
+		if (strchr(chars, *begin))
+			return begin;
+	}
+	return end;
+}
+
+static void split_reference(const char *begin, const char *end, url_reference &ref)
+{
+	memset(&ref, 0, sizeof(ref));
+
+	// Leading and trailing spaces and control characters are ignored as by browsers
+	while (begin < end && static_cast<unsigned char>(*begin) <= ' ')
+		++begin;
+	while (begin < end && static_cast<unsigned char>(*(end - 1)) <= ' ')
+		--end;
+
+	ref.scheme = ref.scheme_end = begin;
+
+	const char *it = begin;
+	if (it < end && is_alpha(*it)) {
+		while (it < end && (is_alpha(*it) || (*it >= '0' && *it <= '9') || *it == '+' || *it == '-' || *it == '.'))
+			++it;
+		if (it < end && *it == ':') {
+			ref.scheme_end = it;
+			begin = it + 1;
+		}
+	}
+
+	if (end - begin >= 2 && begin[0] == '/' && begin[1] == '/') {
+		ref.authority = begin + 2;
+		ref.authority_end = find_any(ref.authority, end, "/?#");
+		begin = ref.authority_end;
+	}
+
+	ref.path = begin;
+	ref.path_end = find_any(begin, end, "?#");
+	begin = ref.path_end;
+
+	if (begin < end && *begin == '?') {
+		ref.query = begin + 1;
+		ref.query_end = find_any(ref.query, end, "#");
+		begin = ref.query_end;
+	}
+
+	if (begin < end && *begin == '#') {
+		ref.fragment = begin + 1;
+		ref.fragment_end = end;
+	}
+}
+
+url_resolver::url_resolver() :
+	m_scheme_end(0), m_authority_end(0), m_path_end(0), m_query_end(0),
+	m_has_authority(false), m_has_query(false), m_strip_fragment(false), m_valid(false)
+{
+}
+
+url_resolver::url_resolver(const std::string &base) :
+	m_scheme_end(0), m_authority_end(0), m_path_end(0), m_query_end(0),
+	m_has_authority(false), m_has_query(false), m_strip_fragment(false), m_valid(false)
+{
+	set_base(base);
+}
+
+url_resolver::url_resolver(const swarm::url &base) :
+	m_scheme_end(0), m_authority_end(0), m_path_end(0), m_query_end(0),
+	m_has_authority(false), m_has_query(false), m_strip_fragment(false), m_valid(false)
+{
+	set_base(base.to_string());
+}
+
+bool url_resolver::set_base(const std::string &base)
+{
+	url_reference ref;
+	split_reference(base.c_str(), base.c_str() + base.size(), ref);
+
+	m_valid = false;
+	m_base.clear();
+
+	if (!ref.has_scheme())
+		return false;
+
+	// Base is normalized the same way as resolved urls
+	const bool strip_fragment = m_strip_fragment;
+	m_strip_fragment = true;
+	m_valid = true;
+	m_scheme_end = 0;
+	resolve(base);
+	m_strip_fragment = strip_fragment;
+
+	m_base.swap(m_result);
+
+	m_scheme_end = ref.scheme_end - ref.scheme;
+	m_has_authority = ref.has_authority();
+	m_has_query = ref.has_query();
+
+	// Offsets are calculated in the normalized string, which has the same structure as the original
+	size_t offset = m_scheme_end + 1;
+	if (m_has_authority)
+		offset = m_base.find_first_of("/?", offset + 2);
+	if (offset == std::string::npos)
+		offset = m_base.size();
+	m_authority_end = offset;
+
+	m_path_end = m_base.find('?', m_authority_end);
+	if (m_path_end == std::string::npos)
+		m_path_end = m_base.size();
+	m_query_end = m_base.size();
+
+	return true;
+}
+
+bool url_resolver::is_valid() const
+{
+	return m_valid;
+}
+
+void url_resolver::set_strip_fragment(bool strip)
+{
+	m_strip_fragment = strip;
+}
+
+const std::string &url_resolver::resolve(const std::string &relative)
+{
+	return resolve(relative.c_str(), relative.size());
+}
+
+const std::string &url_resolver::resolve(const char *relative, size_t size)
+{
+	m_result.clear();
+
+	if (!m_valid)
+		return m_result;
+
+	url_reference ref;
+	split_reference(relative, relative + size, ref);
+
+	bool use_base_query = false;
+
+	if (ref.has_scheme()) {
+		for (const char *it = ref.scheme; it != ref.scheme_end; ++it)
+			m_result += to_lower(*it);
+		m_result += ':';
+	} else {
+		m_result.append(m_base, 0, m_scheme_end + 1);
+	}
+
+	if (ref.has_scheme() || ref.has_authority()) {
+		if (ref.has_authority()) {
+			m_result += "//";
+			const size_t start = m_result.size();
+			append_encoded(ref.authority, ref.authority_end, true);
+
+			// Host is case-insensitive, user info is not
+			const size_t at = m_result.rfind('@');
+			for (size_t i = (at == std::string::npos || at < start) ? start : at + 1; i < m_result.size(); ++i)
+				m_result[i] = to_lower(m_result[i]);
+		}
+
+		append_path(ref.path, ref.path_end);
+	} else {
+		// "//authority" of the base
+		m_result.append(m_base, m_scheme_end + 1, m_authority_end - m_scheme_end - 1);
+
+		if (ref.path == ref.path_end) {
+			m_result.append(m_base, m_authority_end, m_path_end - m_authority_end);
+			use_base_query = !ref.has_query();
+		} else if (*ref.path == '/') {
+			append_path(ref.path, ref.path_end);
+		} else {
+			// Merge with the base's path without it's last segment
+			const size_t start = m_result.size();
+			const size_t slash = m_base.rfind('/', m_path_end - 1);
+
+			if (m_has_authority && m_path_end == m_authority_end) {
+				m_result += '/';
+			} else if (slash != std::string::npos && slash >= m_authority_end) {
+				m_result.append(m_base, m_authority_end, slash + 1 - m_authority_end);
+			}
+
+			append_encoded(ref.path, ref.path_end, false);
+			remove_dot_segments(start);
+		}
+	}
+
+	if (use_base_query) {
+		if (m_has_query)
+			m_result.append(m_base, m_path_end, m_query_end - m_path_end);
+	} else if (ref.has_query()) {
+		m_result += '?';
+		append_encoded(ref.query, ref.query_end, false);
+	}
+
+	if (ref.has_fragment() && !m_strip_fragment) {
+		m_result += '#';
+		append_encoded(ref.fragment, ref.fragment_end, false);
+	}
+
+	return m_result;
+}
+
+void url_resolver::append_path(const char *begin, const char *end)
+{
+	const size_t start = m_result.size();
+	append_encoded(begin, end, false);
+	remove_dot_segments(start);
+}
+
+/*
+ * Appends the string replacing characters not allowed in urls by percent-encoding,
+ * it works the same way as url::from_user_input
+ */
+void url_resolver::append_encoded(const char *begin, const char *end, bool authority)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	static const char encode[] = " \"<>[\\]^`{|}";
+	static const char encode_authority[] = " \"<>\\^`{|}";
+
+	for (const char *it = begin; it < end; ++it) {
+		const unsigned char ch = *it;
+
+		// Browsers drop tabs and line breaks inside of urls
+		if (ch == '\t' || ch == '\n' || ch == '\r')
+			continue;
+
+		if (ch == '%' && (end - it < 3 || !is_hex(it[1]) || !is_hex(it[2]))) {
+			m_result += "%25";
+		} else if (ch <= ' ' || ch >= 127 || strchr(authority ? encode_authority : encode, ch)) {
+			m_result += '%';
+			m_result += hex[ch >> 4];
+			m_result += hex[ch & 0xf];
+		} else {
+			m_result += ch;
+		}
+	}
+}
+
+/*
+ * Removes "." and ".." segments of the path starting at \a start in place, RFC 3986 section 5.2.4
+ */
+void url_resolver::remove_dot_segments(size_t start)
+{
+	char *data = &m_result[0];
+	const size_t end = m_result.size();
+	const size_t root = (start < end && data[start] == '/') ? start + 1 : start;
+
+	size_t read = root;
+	size_t write = root;
+
+	while (read <= end) {
+		const char *slash = reinterpret_cast<const char *>(memchr(data + read, '/', end - read));
+		const size_t segment_end = slash ? slash - data : end;
+		const size_t length = segment_end - read;
+		const bool last = (segment_end == end);
+
+		if (length == 1 && data[read] == '.') {
+			// Skip the segment, the previous one already ends by '/'
+		} else if (length == 2 && data[read] == '.' && data[read + 1] == '.') {
+			if (write > root) {
+				--write;
+				while (write > root && data[write - 1] != '/')
+					--write;
+			}
+		} else {
+			memmove(data + write, data + read, length);
+			write += length;
+			if (!last)
+				data[write++] = '/';
+		}
+
+		if (last)
+			break;
+		read = segment_end + 1;
+	}
+
+	m_result.resize(write);
+}
+
+}} // namespace ioremap::swarm
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOREMAP_SWARM_URL_RESOLVER_HPP
+#define IOREMAP_SWARM_URL_RESOLVER_HPP
+
+#include <string>
+
+namespace ioremap {
+namespace swarm {
+
+class url;
+
+/*!
+ * \brief The url_resolver class resolves many relative urls against the single base url.
+ *
+ * Base url is parsed once at construction, every reference is resolved by RFC 3986 (section 5.2)
+ * and normalized directly into the internal buffer, which is reused by the next call.
+ * So resolving of thousands of page's links makes no memory allocations once the buffer is large enough.
+ *
+ * Normalization includes lower-casing of scheme and host, removing of dot segments and
+ * percent-encoding of characters which are not allowed in urls.
+ *
+ * \code{.cpp}
+ * swarm::url_resolver resolver(page_url);
+ * for (auto it = links.begin(); it != links.end(); ++it) {
+ *     const std::string &absolute = resolver.resolve(*it);
+ *     if (!absolute.empty())
+ *         queue.push(absolute);
+ * }
+ * \endcode
+ *
+ * \sa url::resolved
+ */
+class url_resolver
+{
+public:
+	/*!
+	 * \brief Constructs resolver with invalid base url.
+	 */
+	url_resolver();
+	/*!
+	 * \brief Constructs resolver for \a base url.
+	 */
+	url_resolver(const std::string &base);
+	/*!
+	 * \brief Constructs resolver for \a base url.
+	 */
+	url_resolver(const swarm::url &base);
+
+	/*!
+	 * \brief Set the base url to \a base.
+	 *
+	 * Returns false if \a base is not an absolute url.
+	 */
+	bool set_base(const std::string &base);
+	/*!
+	 * \brief Returns true if base url is valid absolute url.
+	 */
+	bool is_valid() const;
+
+	/*!
+	 * \brief Makes fragments to be removed from resolved urls if \a strip is true.
+	 *
+	 * By default fragments are kept.
+	 */
+	void set_strip_fragment(bool strip);
+
+	/*!
+	 * \brief Resolves \a relative reference of \a size bytes against the base url.
+	 *
+	 * Returns reference to the internal buffer, it's valid until the next call.
+	 * Empty string is returned if base url is invalid.
+	 */
+	const std::string &resolve(const char *relative, size_t size);
+	/*!
+	 * \brief Resolves \a relative reference against the base url.
+	 *
+	 * \sa resolve(const char *, size_t)
+	 */
+	const std::string &resolve(const std::string &relative);
+
+private:
+	void append_encoded(const char *begin, const char *end, bool authority);
+	void append_path(const char *begin, const char *end);
+	void remove_dot_segments(size_t start);
+
+	std::string m_base;
+	size_t m_scheme_end;
+	size_t m_authority_end;
+	size_t m_path_end;
+	size_t m_query_end;
+	bool m_has_authority;
+	bool m_has_query;
+	bool m_strip_fragment;
+	bool m_valid;
+	std::string m_result;
+};
+
+}} // namespace ioremap::swarm
+
+#endif // IOREMAP_SWARM_URL_RESOLVER_HPP
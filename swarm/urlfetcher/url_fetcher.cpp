@@ -18,6 +18,7 @@
 #include "../c++config.hpp"
 
 #include <string.h>
+#include <strings.h>
 #include <curl/curl.h>
 
 #include <sstream>
@@ -32,8 +33,11 @@
 
 #include <queue>
 #include <list>
+#include <unordered_map>
 #include <algorithm>
 
+#include <boost/lexical_cast.hpp>
+
 #ifndef BOOST_SYSTEM_NOEXCEPT
 #  define BOOST_SYSTEM_NOEXCEPT
 #endif
@@ -48,23 +52,79 @@ typedef std::chrono::high_resolution_clock clock;
 
 enum http_command {
 	GET,
-	POST
+	POST,
+	CUSTOM
 };
 
 std::atomic_int alive(0);
 
+class network_manager_private;
+class network_connection_info;
+
+/*
+ * Implementation of request_handle, all *_impl methods and callbacks are called from event loop's thread
+ */
+class network_request_handle : public request_handle, public std::enable_shared_from_this<network_request_handle>
+{
+public:
+	struct upload_chunk
+	{
+		boost::asio::const_buffer data;
+		std::function<void (const boost::system::error_code &err)> handler;
+	};
+
+	network_request_handle(network_manager_private *manager) :
+		manager(manager), info(NULL), offset(0), pause_mask(0),
+		started(false), finished(false), cancelled(false),
+		upload_paused(false), recv_paused(false), in_callback(false)
+	{
+	}
+
+	void send_data(const boost::asio::const_buffer &data,
+		       std::function<void (const boost::system::error_code &err)> &&handler);
+	void finish();
+	void pause();
+	void resume();
+	void cancel();
+
+	void send_data_impl(const upload_chunk &chunk);
+	void finish_impl();
+	void pause_impl();
+	void resume_impl();
+	void cancel_impl();
+
+	void attach(network_connection_info *new_info);
+	void detach();
+	void update_pause();
+
+	size_t read(char *data, size_t size);
+
+	network_manager_private *manager;
+	network_connection_info *info;
+	std::deque<upload_chunk> chunks;
+	size_t offset;
+	int pause_mask;
+	bool started;
+	bool finished;
+	bool cancelled;
+	bool upload_paused;
+	bool recv_paused;
+	bool in_callback;
+};
+
 class network_connection_info
 {
 public:
 	typedef std::unique_ptr<network_connection_info> ptr;
 
-	network_connection_info() : easy(NULL), redirect_count(0), on_headers_called(false)
+	network_connection_info() : easy(NULL), resolve_list(NULL), redirect_count(0), on_headers_called(false)
 	{
 		//        error[0] = '\0';
 	}
 	~network_connection_info()
 	{
 		curl_easy_cleanup(easy);
+		curl_slist_free_all(resolve_list);
 		//                error[CURL_ERROR_SIZE - 1] = '\0';
 	}
 
@@ -81,26 +141,83 @@ public:
 		on_headers_called = true;
 		reply.set_code(code);
 		reply.set_url(effective_url);
-		stream->on_headers(std::move(reply));
+
+		if (handle) {
+			handle->in_callback = true;
+			stream->on_headers(std::move(reply));
+			handle->in_callback = false;
+		} else {
+			stream->on_headers(std::move(reply));
+		}
+	}
+
+	/*
+	 * Returns true if request was cancelled by the handle from one of the stream's callbacks
+	 */
+	bool is_cancelled() const
+	{
+		return handle && handle->cancelled;
 	}
 
 	CURL *easy;
+	struct curl_slist *resolve_list;
 	swarm::logger logger;
 	url_fetcher::response reply;
 	std::shared_ptr<base_stream> stream;
 	std::string body;
+	std::string host;
+	std::shared_ptr<network_request_handle> handle;
 	long redirect_count;
 	bool on_headers_called;
 
 	//    char error[CURL_ERROR_SIZE];
 };
 
+/*
+ * Upstream GET request shared by several callers, all methods are called from event loop's thread
+ */
+class coalesced_stream : public base_stream
+{
+public:
+	struct follower
+	{
+		std::shared_ptr<base_stream> stream;
+		url_fetcher::request request;
+	};
+
+	coalesced_stream(network_manager_private *manager, const std::string &key,
+		const std::shared_ptr<base_stream> &leader) :
+		manager(manager), key(key), leader(leader), reply(boost::none),
+		headers_received(false), joinable(true)
+	{
+	}
+
+	void join(const std::shared_ptr<base_stream> &stream, url_fetcher::request &&request);
+
+	void on_headers(url_fetcher::response &&response);
+	void on_data(const boost::asio::const_buffer &data);
+	void on_close(const boost::system::error_code &error);
+
+	void forget();
+
+	network_manager_private *manager;
+	std::string key;
+	std::shared_ptr<base_stream> leader;
+	std::vector<follower> followers;
+	url_fetcher::response reply;
+	std::string body;
+	bool headers_received;
+	bool joinable;
+};
+
 class network_manager_private : public event_listener
 {
 public:
 	network_manager_private(event_loop &loop) :
 		loop(loop), still_running(0), prev_running(0),
-		active_connections(0), active_connections_limit(std::numeric_limits<long>::max())
+		active_connections(0), active_connections_limit(std::numeric_limits<long>::max()),
+		host_limit(std::numeric_limits<long>::max()), multiplexing(false),
+		coalescing(false), coalescing_limit(1024 * 1024)
 	{
 		loop.set_listener(this);
 		loop.set_logger(logger);
@@ -152,10 +269,27 @@ public:
 		url_fetcher::request request;
 		http_command command;
 		std::string body;
+		std::string host;
 		std::shared_ptr<base_stream> stream;
+		std::shared_ptr<network_request_handle> handle;
 		std::chrono::time_point<clock> begin;
 	};
 
+	typedef std::queue<request_info::ptr, std::list<request_info::ptr>> request_queue;
+
+	/*
+	 * Per-host state of the scheduler, it is maintained only if host limit is set
+	 */
+	struct host_info
+	{
+		host_info() : active_requests(0)
+		{
+		}
+
+		long active_requests;
+		request_queue requests;
+	};
+
 	struct multi_error_category : public boost::system::error_category
 	{
 	public:
@@ -219,8 +353,145 @@ public:
 		return boost::system::error_code(err, easy_category());
 	}
 
+	static std::string host_key(const swarm::url &url)
+	{
+		std::string key = url.scheme();
+		key += "://";
+		key += url.host();
+		if (const auto &port = url.port()) {
+			key += ':';
+			key += boost::lexical_cast<std::string>(*port);
+		}
+		return key;
+	}
+
+	static std::string coalescing_key(const url_fetcher::request &request, const std::vector<std::string> &vary_headers)
+	{
+		std::string key = "GET ";
+		key += request.url().to_string();
+		key += request.follow_location() ? " L" : " N";
+		// Requests which may end differently are never merged
+		key += ' ';
+		key += boost::lexical_cast<std::string>(request.timeout());
+		key += ' ';
+		key += boost::lexical_cast<std::string>(int(request.http2()));
+		key += ' ';
+		key += request.resolve();
+
+		for (auto it = vary_headers.begin(); it != vary_headers.end(); ++it) {
+			key += '\n';
+			key += *it;
+			key += ": ";
+			if (const auto value = request.headers().get(*it))
+				key += *value;
+		}
+
+		return key;
+	}
+
+	/*
+	 * Returns CURLOPT_RESOLVE list for the request, the address is put to the multi handle's DNS cache,
+	 * so curl doesn't resolve the host itself.
+	 *
+	 * Such entries never expire from curl's cache, so the entry is removed once a request to the same
+	 * host and port comes without the address or with another one, i.e. once resolver's TTL has expired.
+	 */
+	struct curl_slist *resolve_list(const url_fetcher::request &request)
+	{
+		const std::string &resolve = request.resolve();
+		if (resolve.empty() && resolve_entries.empty())
+			return NULL;
+
+		std::string key;
+		if (!resolve.empty()) {
+			key = resolve.substr(0, resolve.find(':', resolve.find(':') + 1));
+		} else {
+			const swarm::url &url = request.url();
+			key = url.host();
+			key += ':';
+			if (const auto &port = url.port())
+				key += boost::lexical_cast<std::string>(*port);
+			else
+				key += url.scheme() == "https" ? "443" : "80";
+		}
+
+		struct curl_slist *list = NULL;
+
+		auto it = resolve_entries.find(key);
+		if (it != resolve_entries.end() && it->second != resolve) {
+			list = curl_slist_append(list, ("-" + key).c_str());
+			resolve_entries.erase(it);
+		}
+
+		if (!resolve.empty()) {
+			list = curl_slist_append(list, resolve.c_str());
+			resolve_entries[key] = resolve;
+		}
+
+		return list;
+	}
+
+	/*
+	 * Replies to requests with credentials are private, such requests share the reply
+	 * only with the ones having the same credentials, so the header must be in vary_headers
+	 */
+	static bool may_coalesce(const url_fetcher::request &request, const std::vector<std::string> &vary_headers)
+	{
+		const char *private_headers[] = { "Authorization", "Cookie" };
+
+		for (size_t i = 0; i < sizeof(private_headers) / sizeof(private_headers[0]); ++i) {
+			if (!request.headers().has(private_headers[i]))
+				continue;
+
+			bool varies = false;
+			for (auto it = vary_headers.begin(); it != vary_headers.end() && !varies; ++it)
+				varies = strcasecmp(it->c_str(), private_headers[i]) == 0;
+
+			if (!varies)
+				return false;
+		}
+
+		return true;
+	}
+
+	/*
+	 * Returns true if request is attached to the one already in flight,
+	 * otherwise it's stream is replaced by the new shared one
+	 */
+	bool coalesce(const request_info::ptr &request)
+	{
+		if (!may_coalesce(request->request, vary_headers))
+			return false;
+
+		const std::string key = coalescing_key(request->request, vary_headers);
+
+		auto it = flights.find(key);
+		if (it != flights.end()) {
+			it->second->join(request->stream, std::move(request->request));
+			return true;
+		}
+
+		auto flight = std::make_shared<coalesced_stream>(this, key, request->stream);
+		flights[key] = flight;
+		request->stream = flight;
+		return false;
+	}
+
 	void process_info(const request_info::ptr &request)
 	{
+		if (coalescing && request->command == GET && coalesce(request))
+			return;
+
+		if (host_limit != std::numeric_limits<long>::max()) {
+			request->host = host_key(request->request.url());
+
+			auto it = hosts.find(request->host);
+			if (it != hosts.end() && it->second.active_requests >= host_limit) {
+				it->second.requests.push(request);
+				return;
+			}
+		}
+
 		if (active_connections >= active_connections_limit) {
 			requests.push(request);
 			return;
@@ -229,17 +500,88 @@ public:
 		process_info_nocheck(request);
 	}
 
+	/*
+	 * Called once request to the \a host is finished, host's queue is processed later by process_pending
+	 */
+	void release_host(const std::string &host)
+	{
+		if (host.empty())
+			return;
+
+		auto it = hosts.find(host);
+		if (it == hosts.end())
+			return;
+
+		--it->second.active_requests;
+
+		if (!it->second.requests.empty()) {
+			ready_hosts.push_back(host);
+		} else if (it->second.active_requests <= 0) {
+			hosts.erase(it);
+		}
+	}
+
+	void process_pending()
+	{
+		// Requests waiting for their hosts go first as they came earlier than ones in the common queue
+		while (!ready_hosts.empty() && active_connections < active_connections_limit) {
+			auto it = hosts.find(ready_hosts.front());
+			ready_hosts.pop_front();
+
+			if (it == hosts.end())
+				continue;
+
+			host_info &host = it->second;
+			while (!host.requests.empty()
+				&& host.active_requests < host_limit
+				&& active_connections < active_connections_limit) {
+				auto request = host.requests.front();
+				host.requests.pop();
+				process_info_nocheck(request);
+			}
+
+			if (!host.requests.empty() && host.active_requests < host_limit) {
+				// Total limit is reached, try this host again next time
+				ready_hosts.push_front(it->first);
+				break;
+			}
+		}
+
+		while (!requests.empty() && active_connections < active_connections_limit) {
+			auto request = requests.front();
+			requests.pop();
+
+			if (!request->host.empty()) {
+				auto it = hosts.find(request->host);
+				if (it != hosts.end() && it->second.active_requests >= host_limit) {
+					it->second.requests.push(request);
+					continue;
+				}
+			}
+
+			process_info_nocheck(request);
+		}
+	}
+
 	void process_info_nocheck(const request_info::ptr &request)
 	{
 //		auto tmp = clock::now();
 
+		if (request->handle && request->handle->cancelled) {
+			request->stream->on_close(boost::asio::error::operation_aborted);
+			return;
+		}
+
 		network_connection_info::ptr info(new network_connection_info);
+		// Callbacks of the request and the options below refer to the handle
+		info->handle = request->handle;
 		info->easy = curl_easy_init();
 		info->reply.set_request(std::move(request->request));
 		info->reply.set_url(info->reply.request().url());
 		info->reply.set_code(200);
 		info->stream = request->stream;
 		info->body = std::move(request->body);
+		info->host = request->host;
 		info->logger = logger;
 		if (!info->easy) {
 			info->stream->on_close(make_multi_error(multi_error_category::failed_to_create_easy_handle));
@@ -262,6 +604,30 @@ public:
 			curl_easy_setopt(info->easy, CURLOPT_POST, true);
 			curl_easy_setopt(info->easy, CURLOPT_POSTFIELDS, info->body.c_str());
 			curl_easy_setopt(info->easy, CURLOPT_POSTFIELDSIZE, info->body.size());
+		} else if (request->command == CUSTOM) {
+			const auto &custom_headers = info->reply.request().headers();
+			const std::string method = info->reply.request().method();
+
+			if (method == "HEAD") {
+				curl_easy_setopt(info->easy, CURLOPT_NOBODY, 1L);
+			} else if (!method.empty() && method != "GET") {
+				curl_easy_setopt(info->easy, CURLOPT_CUSTOMREQUEST, method.c_str());
+			}
+
+			const auto content_length = custom_headers.content_length();
+			if ((content_length && *content_length > 0) || custom_headers.has("Transfer-Encoding")) {
+				curl_easy_setopt(info->easy, CURLOPT_UPLOAD, 1L);
+				curl_easy_setopt(info->easy, CURLOPT_READFUNCTION, network_manager_private::read_callback);
+				curl_easy_setopt(info->easy, CURLOPT_READDATA, info.get());
+				if (content_length)
+					curl_easy_setopt(info->easy, CURLOPT_INFILESIZE_LARGE, curl_off_t(*content_length));
+
+				// Don't wait for "100 Continue" reply, the body is already on it's way
+				if (!custom_headers.has("Expect"))
+					headers_list = curl_slist_append(headers_list, "Expect:");
+			} else {
+				info->handle->finished = true;
+			}
 		}
 
 		curl_easy_setopt(info->easy, CURLOPT_HTTPHEADER, headers_list);
@@ -270,6 +636,29 @@ public:
 		curl_easy_setopt(info->easy, CURLOPT_URL, info->reply.request().url().to_string().c_str());
 		curl_easy_setopt(info->easy, CURLOPT_TIMEOUT_MS, info->reply.request().timeout());
 
+		info->resolve_list = resolve_list(info->reply.request());
+		if (info->resolve_list)
+			curl_easy_setopt(info->easy, CURLOPT_RESOLVE, info->resolve_list);
+
+		const url_fetcher::request::http2_mode http2 = info->reply.request().http2();
+		if (http2 != url_fetcher::request::http2_disabled) {
+#if LIBCURL_VERSION_NUM >= MAKE_VERSION(7, 49, 0)
+			if (http2 == url_fetcher::request::http2_prior_knowledge)
+				curl_easy_setopt(info->easy, CURLOPT_HTTP_VERSION, long(CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE));
+			else
+				curl_easy_setopt(info->easy, CURLOPT_HTTP_VERSION, long(CURL_HTTP_VERSION_2_0));
+
+			/*
+			 * Wait for the connection to the host to be established instead of opening
+			 * the new one, so concurrent requests are multiplexed over the single connection
+			 */
+			if (multiplexing)
+				curl_easy_setopt(info->easy, CURLOPT_PIPEWAIT, 1L);
+#else
+			logger.log(SWARM_LOG_ERROR, "process_info: libcurl is too old for HTTP/2, fallback to HTTP/1.1");
+#endif
+		}
+
 #if LIBCURL_VERSION_NUM >= MAKE_VERSION(7, 21, 7)
 		IF_CURL_VERSION(7, 21, 7) {
 			/*
@@ -305,6 +694,10 @@ public:
 //			  << std::endl;
 		if (err == CURLM_OK) {
 			++active_connections;
+			if (!info->host.empty())
+				++hosts[info->host].active_requests;
+			if (info->handle)
+				info->handle->attach(info.get());
 			/*
 			 * We saved info's content in info->easy and stored it in multi handler,
 			 * which will free it, so we just forget about info's content here.
@@ -358,10 +751,15 @@ public:
 				info->ensure_headers_sent();
 
 				--active_connections;
+				release_host(info->host);
+				if (info->handle)
+					info->handle->detach();
 				long err = 0;
 				curl_easy_getinfo(easy, CURLINFO_OS_ERRNO, &err);
 
-				if (err) {
+				if (info->is_cancelled()) {
+					info->stream->on_close(boost::asio::error::operation_aborted);
+				} else if (err) {
 					info->stream->on_close(make_posix_error(err));
 				} else if (msg->data.result == CURLE_OK) {
 					info->stream->on_close(boost::system::error_code());
@@ -379,11 +777,25 @@ public:
 			delete info;
 		} while (easy);
 
-		while (!requests.empty() && active_connections < active_connections_limit) {
-			auto request = requests.front();
-			requests.pop();
-			process_info_nocheck(request);
-		}
+		process_pending();
+	}
+
+	/*
+	 * Aborts the running request, it's called by request_handle::cancel
+	 */
+	void cancel(network_connection_info *info)
+	{
+		curl_multi_remove_handle(multi, info->easy);
+
+		--active_connections;
+		release_host(info->host);
+		info->handle->detach();
+
+		std::unique_ptr<network_connection_info> guard(info);
+		info->stream->on_close(boost::asio::error::operation_aborted);
+		guard.reset();
+
+		process_pending();
 	}
 
 	static int open_callback(event_loop *loop, curlsocktype purpose, struct curl_sockaddr *address)
@@ -438,10 +850,34 @@ public:
 		info->ensure_headers_sent();
 		info->logger.log(SWARM_LOG_DEBUG, "write_callback, size: %zu, nmemb: %zu", size, nmemb);
 		const size_t real_size = size * nmemb;
+
+		if (auto handle = info->handle.get()) {
+			if (handle->cancelled)
+				return 0;
+
+			// Curl keeps the data and passes it again once the transfer is unpaused
+			if (handle->recv_paused) {
+				handle->pause_mask |= CURLPAUSE_RECV;
+				return CURL_WRITEFUNC_PAUSE;
+			}
+
+			handle->in_callback = true;
+			info->stream->on_data(boost::asio::buffer(data, real_size));
+			handle->in_callback = false;
+
+			// Returning less than real_size aborts the transfer
+			return handle->cancelled ? 0 : real_size;
+		}
+
 		info->stream->on_data(boost::asio::buffer(data, real_size));
 		return real_size;
 	}
 
+	static size_t read_callback(char *data, size_t size, size_t nmemb, network_connection_info *info)
+	{
+		return info->handle->read(data, size * nmemb);
+	}
+
 	template <typename Iter>
 	static inline void trim_line(Iter &begin, Iter &end)
 	{
@@ -469,6 +905,9 @@ public:
 			info->reply.headers().clear();
 		}
 
+		if (info->is_cancelled())
+			return 0;
+
 		if (real_size == 2) {
 			long code;
 			curl_easy_getinfo(info->easy, CURLINFO_RESPONSE_CODE, &code);
@@ -481,7 +920,7 @@ public:
 				info->ensure_headers_sent();
 			}
 
-			return real_size;
+			return info->is_cancelled() ? 0 : real_size;
 		}
 
 		char *lf;
@@ -522,7 +961,17 @@ public:
 	int prev_running;
 	std::atomic_long active_connections;
 	long active_connections_limit;
-	std::queue<request_info::ptr, std::list<request_info::ptr>> requests;
+	long host_limit;
+	bool multiplexing;
+	request_queue requests;
+	std::unordered_map<std::string, host_info> hosts;
+	std::deque<std::string> ready_hosts;
+	bool coalescing;
+	size_t coalescing_limit;
+	std::vector<std::string> vary_headers;
+	//! Entries put to curl's DNS cache by CURLOPT_RESOLVE, "host:port" to the whole entry
+	std::unordered_map<std::string, std::string> resolve_entries;
+	std::unordered_map<std::string, std::shared_ptr<coalesced_stream>> flights;
 	swarm::logger logger;
 	CURLM *multi;
 };
@@ -552,6 +1001,39 @@ void url_fetcher::set_total_limit(long active_connections)
 	p->active_connections_limit = active_connections;
 }
 
+void url_fetcher::set_host_limit(long active_requests)
+{
+	p->host_limit = active_requests;
+
+#if LIBCURL_VERSION_NUM >= MAKE_VERSION(7, 67, 0)
+	if (active_requests < std::numeric_limits<int>::max())
+		curl_multi_setopt(p->multi, CURLMOPT_MAX_CONCURRENT_STREAMS, active_requests);
+#endif
+}
+
+void url_fetcher::set_multiplexing(bool multiplexing)
+{
+	p->multiplexing = multiplexing;
+
+#ifdef CURLPIPE_MULTIPLEX
+	curl_multi_setopt(p->multi, CURLMOPT_PIPELINING, multiplexing ? long(CURLPIPE_MULTIPLEX) : long(0));
+#else
+	if (multiplexing)
+		p->logger.log(SWARM_LOG_ERROR, "set_multiplexing: libcurl is built without HTTP/2 multiplexing support");
+#endif
+}
+
+void url_fetcher::set_coalescing(bool coalescing, const std::vector<std::string> &vary_headers)
+{
+	p->coalescing = coalescing;
+	p->vary_headers = vary_headers;
+}
+
+void url_fetcher::set_coalescing_limit(size_t limit)
+{
+	p->coalescing_limit = limit;
+}
+
 void url_fetcher::set_logger(const swarm::logger &log)
 {
 	p->loop.set_logger(log);
@@ -584,15 +1066,260 @@ void url_fetcher::post(const std::shared_ptr<base_stream> &stream, url_fetcher::
 	p->loop.post(std::bind(&network_manager_private::process_info, p, info));
 }
 
+std::shared_ptr<request_handle> url_fetcher::open(const std::shared_ptr<base_stream> &stream, url_fetcher::request &&request)
+{
+	auto handle = std::make_shared<network_request_handle>(p);
+
+	auto info = std::make_shared<network_manager_private::request_info>();
+	info->stream = stream;
+	info->request = std::move(request);
+	info->command = CUSTOM;
+	info->handle = handle;
+
+	p->loop.post(std::bind(&network_manager_private::process_info, p, info));
+
+	return handle;
+}
+
+const boost::system::error_category &url_fetcher::easy_category()
+{
+	return network_manager_private::easy_category();
+}
+
+bool url_fetcher::is_timeout(const boost::system::error_code &error)
+{
+	if (error == boost::system::errc::timed_out)
+		return true;
+
+	return error.category() == easy_category() && error.value() == CURLE_OPERATION_TIMEDOUT;
+}
+
+void network_request_handle::send_data(const boost::asio::const_buffer &data,
+	std::function<void (const boost::system::error_code &err)> &&handler)
+{
+	upload_chunk chunk = { data, std::move(handler) };
+	manager->loop.post(std::bind(&network_request_handle::send_data_impl, shared_from_this(), chunk));
+}
+
+void network_request_handle::finish()
+{
+	manager->loop.post(std::bind(&network_request_handle::finish_impl, shared_from_this()));
+}
+
+void network_request_handle::pause()
+{
+	manager->loop.post(std::bind(&network_request_handle::pause_impl, shared_from_this()));
+}
+
+void network_request_handle::resume()
+{
+	manager->loop.post(std::bind(&network_request_handle::resume_impl, shared_from_this()));
+}
+
+void network_request_handle::cancel()
+{
+	manager->loop.post(std::bind(&network_request_handle::cancel_impl, shared_from_this()));
+}
+
+void network_request_handle::send_data_impl(const upload_chunk &chunk)
+{
+	if (cancelled || (started && !info)) {
+		if (chunk.handler)
+			chunk.handler(boost::asio::error::operation_aborted);
+		return;
+	}
+
+	chunks.push_back(chunk);
+	update_pause();
+}
+
+void network_request_handle::finish_impl()
+{
+	finished = true;
+	update_pause();
+}
+
+void network_request_handle::pause_impl()
+{
+	recv_paused = true;
+	update_pause();
+}
+
+void network_request_handle::resume_impl()
+{
+	recv_paused = false;
+	update_pause();
+}
+
+void network_request_handle::cancel_impl()
+{
+	if (cancelled)
+		return;
+
+	cancelled = true;
+
+	// If it's called from stream's callback the transfer is aborted by the callback's return value
+	if (info && !in_callback) {
+		manager->cancel(info);
+	}
+}
+
+void network_request_handle::attach(network_connection_info *new_info)
+{
+	info = new_info;
+	started = true;
+}
+
+void network_request_handle::detach()
+{
+	info = NULL;
+
+	// Nobody is going to consume the rest of the body
+	std::deque<upload_chunk> tmp;
+	tmp.swap(chunks);
+	for (auto it = tmp.begin(); it != tmp.end(); ++it) {
+		if (it->handler)
+			it->handler(boost::asio::error::operation_aborted);
+	}
+}
+
+void network_request_handle::update_pause()
+{
+	// Curl doesn't like to be (un)paused from it's own callbacks, new state is applied by the callbacks
+	if (!info || in_callback)
+		return;
+
+	if (upload_paused && (finished || !chunks.empty()))
+		upload_paused = false;
+
+	const int mask = (recv_paused ? CURLPAUSE_RECV : 0) | (upload_paused ? CURLPAUSE_SEND : 0);
+	if (mask != pause_mask) {
+		pause_mask = mask;
+		curl_easy_pause(info->easy, mask);
+	}
+}
+
+size_t network_request_handle::read(char *data, size_t size)
+{
+	size_t total = 0;
+
+	if (cancelled)
+		return CURL_READFUNC_ABORT;
+
+	in_callback = true;
+	while (total < size && !chunks.empty()) {
+		upload_chunk &chunk = chunks.front();
+		const size_t chunk_size = boost::asio::buffer_size(chunk.data);
+		const size_t delta = std::min(size - total, chunk_size - offset);
+
+		memcpy(data + total, boost::asio::buffer_cast<const char *>(chunk.data) + offset, delta);
+		total += delta;
+		offset += delta;
+
+		if (offset == chunk_size) {
+			auto handler = std::move(chunk.handler);
+			chunks.pop_front();
+			offset = 0;
+
+			if (handler)
+				handler(boost::system::error_code());
+		}
+	}
+	in_callback = false;
+
+	if (total > 0 || finished)
+		return total;
+
+	upload_paused = true;
+	pause_mask |= CURLPAUSE_SEND;
+	return CURL_READFUNC_PAUSE;
+}
+
+void coalesced_stream::join(const std::shared_ptr<base_stream> &stream, url_fetcher::request &&request)
+{
+	if (!headers_received) {
+		follower item = { stream, std::move(request) };
+		followers.emplace_back(std::move(item));
+		return;
+	}
+
+	// Reply is already on it's way, so replay everything received so far
+	url_fetcher::response response = reply;
+	response.set_request(request);
+	stream->on_headers(std::move(response));
+	if (!body.empty())
+		stream->on_data(boost::asio::buffer(body));
+
+	follower item = { stream, std::move(request) };
+	followers.emplace_back(std::move(item));
+}
+
+void coalesced_stream::on_headers(url_fetcher::response &&response)
+{
+	headers_received = true;
+	reply = response;
+
+	for (auto it = followers.begin(); it != followers.end(); ++it) {
+		url_fetcher::response copy = response;
+		copy.set_request(it->request);
+		it->stream->on_headers(std::move(copy));
+	}
+
+	leader->on_headers(std::move(response));
+}
+
+void coalesced_stream::on_data(const boost::asio::const_buffer &data)
+{
+	if (joinable) {
+		if (body.size() + boost::asio::buffer_size(data) > manager->coalescing_limit) {
+			// Too much to keep for the late requests, let them make their own
+			forget();
+			std::string().swap(body);
+		} else {
+			body.append(boost::asio::buffer_cast<const char *>(data), boost::asio::buffer_size(data));
+		}
+	}
+
+	for (auto it = followers.begin(); it != followers.end(); ++it)
+		it->stream->on_data(data);
+
+	leader->on_data(data);
+}
+
+void coalesced_stream::on_close(const boost::system::error_code &error)
+{
+	forget();
+
+	for (auto it = followers.begin(); it != followers.end(); ++it)
+		it->stream->on_close(error);
+
+	leader->on_close(error);
+}
+
+void coalesced_stream::forget()
+{
+	if (!joinable)
+		return;
+
+	joinable = false;
+
+	auto it = manager->flights.find(key);
+	if (it != manager->flights.end() && it->second.get() == this)
+		manager->flights.erase(it);
+}
+
 class url_fetcher_request_data
 {
 public:
-	url_fetcher_request_data() : follow_location(false), timeout(30000)
+	url_fetcher_request_data() : follow_location(false), timeout(30000),
+		http2(url_fetcher::request::http2_disabled)
 	{
 	}
 
 	bool follow_location;
 	long timeout;
+	url_fetcher::request::http2_mode http2;
+	std::string resolve;
 };
 
 class url_fetcher_response_data
@@ -665,6 +1392,38 @@ void url_fetcher::request::set_timeout(long timeout)
 	m_data->timeout = timeout;
 }
 
+url_fetcher::request::http2_mode url_fetcher::request::http2() const
+{
+	return m_data->http2;
+}
+
+void url_fetcher::request::set_http2(http2_mode mode)
+{
+	m_data->http2 = mode;
+}
+
+const std::string &url_fetcher::request::resolve() const
+{
+	return m_data->resolve;
+}
+
+void url_fetcher::request::set_resolve(const std::string &host, int port, const std::string &address)
+{
+	m_data->resolve = host;
+	m_data->resolve += ':';
+	m_data->resolve += boost::lexical_cast<std::string>(port);
+	m_data->resolve += ':';
+
+	// IPv6 addresses are passed in brackets
+	if (address.find(':') != std::string::npos) {
+		m_data->resolve += '[';
+		m_data->resolve += address;
+		m_data->resolve += ']';
+	} else {
+		m_data->resolve += address;
+	}
+}
+
 url_fetcher::response::response() : m_data(new url_fetcher_response_data)
 {
 }
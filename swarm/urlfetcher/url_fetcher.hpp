@@ -25,6 +25,7 @@
 #include <memory>
 #include <functional>
 #include <map>
+#include <vector>
 
 #include <boost/asio.hpp>
 #include <boost/variant.hpp>
@@ -36,6 +37,7 @@ class network_manager_private;
 class url_fetcher_request_data;
 class url_fetcher_response_data;
 class base_stream;
+class request_handle;
 
 /*!
  * \class url_fetcher
@@ -66,6 +68,18 @@ public:
 	class request : public http_request
 	{
 	public:
+		/*!
+		 * \brief The http2_mode enum describes how HTTP/2 is negotiated with the server.
+		 */
+		enum http2_mode {
+			//! Plain HTTP/1.1, the default
+			http2_disabled,
+			//! Negotiate HTTP/2 by ALPN for https and by Upgrade header for http
+			http2_negotiate,
+			//! Speak HTTP/2 over cleartext (h2c) without upgrade, suitable for local upstreams
+			http2_prior_knowledge
+		};
+
 		request();
 		request(const boost::none_t &);
 		request(request &&other);
@@ -92,6 +106,36 @@ public:
 		 */
 		void set_timeout(long timeout);
 
+		http2_mode http2() const;
+		/*!
+		 * \brief Sets the way HTTP/2 is negotiated for this request to \a mode.
+		 *
+		 * HTTP/2 requests to the same host share the single connection if
+		 * multiplexing is enabled for the url fetcher.
+		 *
+		 * By default HTTP/2 is disabled.
+		 *
+		 * \sa url_fetcher::set_multiplexing
+		 */
+		void set_http2(http2_mode mode);
+
+		/*!
+		 * \brief Returns the resolve entry of the request in "host:port:address" form.
+		 *
+		 * \sa set_resolve
+		 */
+		const std::string &resolve() const;
+		/*!
+		 * \brief Makes connections to \a host at \a port to go to already resolved \a address.
+		 *
+		 * The address is put to DNS cache of the url fetcher, so no DNS lookup is done for the host.
+		 * It's intended for resolvers which prefetch addresses in advance.
+		 *
+		 * The address is kept in the cache until a request to the same host and port comes with
+		 * another address or without any, curl resolves the host itself then.
+		 */
+		void set_resolve(const std::string &host, int port, const std::string &address);
+
 	private:
 		std::unique_ptr<url_fetcher_request_data> m_data;
 	};
@@ -138,6 +182,61 @@ public:
 	 */
 	void set_total_limit(long active_connections);
 
+	/*!
+	 * \brief Set limit of simultaneously running requests to the single host to \a active_requests.
+	 *
+	 * Requests above the limit are queued per host and are started as soon as previous
+	 * requests to the same host are finished. If multiplexing is enabled this is also the limit
+	 * of concurrent HTTP/2 streams opened to the host.
+	 *
+	 * By default this property is set to LONG_MAX.
+	 *
+	 * \sa set_multiplexing
+	 */
+	void set_host_limit(long active_requests);
+
+	/*!
+	 * \brief Makes HTTP/2 requests to the same host share the single connection if \a multiplexing is true.
+	 *
+	 * Without multiplexing every concurrent request needs it's own TCP connection.
+	 * Only requests with request::http2 mode different from request::http2_disabled are multiplexed.
+	 *
+	 * By default multiplexing is disabled.
+	 *
+	 * \sa request::set_http2
+	 */
+	void set_multiplexing(bool multiplexing);
+
+	/*!
+	 * \brief Makes concurrent GET requests for the same resource share the single upstream request if \a coalescing is true.
+	 *
+	 * Requests are considered the same if they have equal url, follow_location flag, timeout,
+	 * HTTP/2 mode, resolve entry and values of headers listed in \a vary_headers (i.e. "Accept-Encoding").
+	 * The first request is sent to the server, the rest of them are attached to it, each of their
+	 * streams receives the headers and the body replayed from the beginning.
+	 *
+	 * Only requests made by get are coalesced. Requests with Authorization or Cookie header are
+	 * never coalesced unless the header is listed in \a vary_headers, so private reply of one user
+	 * is never given to another one.
+	 *
+	 * By default coalescing is disabled.
+	 *
+	 * \sa set_coalescing_limit
+	 */
+	void set_coalescing(bool coalescing, const std::vector<std::string> &vary_headers = std::vector<std::string>());
+
+	/*!
+	 * \brief Sets the maximum size of the body kept for replaying to \a limit bytes.
+	 *
+	 * Requests arriving once the shared reply's body exceeds the limit are not attached to it
+	 * and start their own request instead.
+	 *
+	 * By default this property is set to 1 megabyte.
+	 *
+	 * \sa set_coalescing
+	 */
+	void set_coalescing_limit(size_t limit);
+
 	/*!
 	 * \brief Set \a log as logger for fetcher.
 	 */
@@ -170,6 +269,33 @@ public:
 	 * \sa get
 	 */
 	void post(const std::shared_ptr<base_stream> &stream, url_fetcher::request &&request, std::string &&body);
+	/*!
+	 * \brief Make HTTP request to server by \a request. Result will be send to \a stream.
+	 *
+	 * HTTP method is taken from request's method, GET is used if it's empty.
+	 * If request has Content-Length or Transfer-Encoding header the body is uploaded by chunks
+	 * passed to request_handle::send_data of the returned handle, otherwise request has no body.
+	 *
+	 * Returned handle also makes possible to pause receiving of the reply and to cancel the request.
+	 *
+	 * This method is thread safe.
+	 *
+	 * \attention The handle must not be used after url fetcher is destroyed.
+	 *
+	 * \sa request_handle
+	 */
+	std::shared_ptr<request_handle> open(const std::shared_ptr<base_stream> &stream, url_fetcher::request &&request);
+
+	/*!
+	 * \brief Returns category of errors from enum CURLcode passed to base_stream::on_close.
+	 */
+	static const boost::system::error_category &easy_category();
+	/*!
+	 * \brief Returns true if request finished with \a error because of the timeout.
+	 *
+	 * Both timeouts of url_fetcher and boost::system::errc::timed_out are recognized.
+	 */
+	static bool is_timeout(const boost::system::error_code &error);
 
 private:
 	url_fetcher(const url_fetcher &other);
@@ -213,11 +339,67 @@ public:
 	 * \li "curl_multi_code" - errors from enum CURLMcode
 	 * \li "curl_easy_code" - errors from enum CURLcode
 	 *
-	 * So i.e. timeout is notified by "curl_easy_code" error category and CURLE_OPERATION_TIMEDOUT error.
+	 * So i.e. timeout is notified by "curl_easy_code" error category and CURLE_OPERATION_TIMEDOUT error,
+	 * url_fetcher::is_timeout checks for it.
 	 */
 	virtual void on_close(const boost::system::error_code &error) = 0;
 };
 
+/*!
+ * \brief The request_handle class provides API for controlling request started by url_fetcher::open.
+ *
+ * All methods of this class are thread-safe, the actions are performed in event loop's thread.
+ *
+ * \sa url_fetcher::open
+ */
+class request_handle
+{
+public:
+	/*!
+	 * \brief Destroyes the request_handle.
+	 *
+	 * Destruction of the handle doesn't cancel the request.
+	 */
+	virtual ~request_handle() {}
+
+	/*!
+	 * \brief Sends next chunk \a data of request's body to server.
+	 *
+	 * Once the chunk is consumed \a handler is called with empty error_code. If request is finished
+	 * or cancelled before it the \a handler is called with boost::asio::error::operation_aborted.
+	 *
+	 * \attention You must guarantee that \a data will be accessable until the handler's call.
+	 */
+	virtual void send_data(const boost::asio::const_buffer &data,
+			       std::function<void (const boost::system::error_code &err)> &&handler) = 0;
+	/*!
+	 * \brief Tells that all chunks of request's body were already sent.
+	 */
+	virtual void finish() = 0;
+	/*!
+	 * \brief Stops receiving of the reply from server.
+	 *
+	 * Use it if stream can't process data as fast as it's received.
+	 * Few more base_stream::on_data calls are still possible after this call.
+	 *
+	 * \sa resume
+	 */
+	virtual void pause() = 0;
+	/*!
+	 * \brief Resumes receiving of the reply from server.
+	 *
+	 * \sa pause
+	 */
+	virtual void resume() = 0;
+	/*!
+	 * \brief Aborts the request.
+	 *
+	 * Stream's on_close is called with boost::asio::error::operation_aborted
+	 * unless the request is already finished.
+	 */
+	virtual void cancel() = 0;
+};
+
 } // namespace service
 } // namespace cocaine
 
@@ -14,42 +14,537 @@
  * limitations under the License.
  */
 
+
 #include "url_finder.hpp"
 #include <libxml/HTMLparser.h>
 #include <cstring>
+#include <limits>
+#include <new>
 
 namespace ioremap {
 namespace swarm {
 
+class url_finder_stream_private;
+
+/*
+ * Lexer-only link extraction, it looks only at attributes of the tags and doesn't build any tree.
+ * Text between tags, comments and scripts is skipped by memchr/memmem which are vectorized by libc.
+ */
+class url_lexer
+{
+public:
+	enum state_type {
+		text_state,
+		comment_state,
+		raw_text_state
+	};
+
+	url_lexer(url_finder_stream_private *finder) : finder(finder), state(text_state), fallback(false)
+	{
+	}
+
+	/*
+	 * Returns number of consumed bytes, the rest must be passed again together with the next chunk.
+	 * Sets fallback to true if markup can't be handled by the lexer.
+	 */
+	size_t process(const char *begin, const char *end);
+
+	url_finder_stream_private *finder;
+	state_type state;
+	std::string raw_tag;
+	bool fallback;
 
-struct parser_context
+private:
+	const char *process_text(const char *begin, const char *end);
+	const char *process_comment(const char *begin, const char *end);
+	const char *process_raw_text(const char *begin, const char *end);
+	void process_tag(const char *begin, const char *end);
+};
+
+class url_finder_stream_private
 {
-	std::vector<std::string> &urls;
+public:
+	enum {
+		// Larger tags are certainly broken markup
+		max_pending_size = 64 * 1024
+	};
+
+	url_finder_stream_private(const url_finder_stream::handler_type &handler, url_finder::parser_mode mode) :
+		handler(handler), mode(mode), ctxt(NULL), lexer(this),
+		urls_limit(std::numeric_limits<size_t>::max()),
+		bytes_limit(std::numeric_limits<size_t>::max()),
+		urls_count(0), bytes_count(0), sources(false), stopped(false)
+	{
+	}
+
+	~url_finder_stream_private()
+	{
+		if (ctxt)
+			htmlFreeParserCtxt(ctxt);
+	}
+
+	void on_url(const std::string &url)
+	{
+		if (stopped)
+			return;
+
+		++urls_count;
+		if (!handler(url) || urls_count >= urls_limit) {
+			stopped = true;
+			// Parser stops at the end of current htmlParseChunk call
+			if (ctxt)
+				xmlStopParser(ctxt);
+		}
+	}
+
+	void on_base(const std::string &url)
+	{
+		// Only the first <base> is taken into account
+		if (base_url.empty())
+			base_url = url;
+	}
+
+	void create_parser();
+	void parse(const char *data, size_t size);
+	void finish();
+
+	url_finder_stream::handler_type handler;
+	url_finder::parser_mode mode;
+	htmlParserCtxtPtr ctxt;
+	url_lexer lexer;
+	std::string pending;
+	std::string base_url;
+	size_t urls_limit;
+	size_t bytes_limit;
+	size_t urls_count;
+	size_t bytes_count;
+	bool sources;
+	bool stopped;
 };
 
 static void parser_start_element(void *void_context,
 				 const xmlChar *tag_name,
 				 const xmlChar **attributes)
 {
-	parser_context *context = reinterpret_cast<parser_context*>(void_context);
+	url_finder_stream_private *context = reinterpret_cast<url_finder_stream_private*>(void_context);
+
+	if (!attributes)
+		return;
+
+	const bool is_link = strcasecmp(reinterpret_cast<const char*>(tag_name), "a") == 0;
+	const bool is_base = !is_link && strcasecmp(reinterpret_cast<const char*>(tag_name), "base") == 0;
+
+	if (!is_link && !is_base && !context->sources)
+		return;
+
+	for (size_t index = 0; attributes[index]; index += 2) {
+		const xmlChar *name = attributes[index];
+		const xmlChar *value = attributes[index + 1];
+		if (!value)
+			continue;
+
+		if (strcmp(reinterpret_cast<const char*>(name), "href") == 0) {
+			if (is_link)
+				context->on_url(reinterpret_cast<const char*>(value));
+			else if (is_base)
+				context->on_base(reinterpret_cast<const char*>(value));
+		} else if (context->sources && strcmp(reinterpret_cast<const char*>(name), "src") == 0) {
+			context->on_url(reinterpret_cast<const char*>(value));
+		}
+	}
+}
+
+void url_finder_stream_private::create_parser()
+{
+	htmlSAXHandler sax;
+	memset(&sax, 0, sizeof(sax));
+	sax.startElement = parser_start_element;
+
+	ctxt = htmlCreatePushParserCtxt(&sax, this, "", 0, "", XML_CHAR_ENCODING_NONE);
+	if (!ctxt)
+		throw std::bad_alloc();
+}
+
+void url_finder_stream_private::parse(const char *data, size_t size)
+{
+	if (mode == url_finder::libxml_parser) {
+		htmlParseChunk(ctxt, data, size, 0);
+		return;
+	}
+
+	if (bytes_count == size && size >= 2) {
+		// UTF-16 documents need real decoding, leave them to libxml
+		const unsigned char first = data[0];
+		const unsigned char second = data[1];
+		if ((first == 0xff && second == 0xfe) || (first == 0xfe && second == 0xff))
+			lexer.fallback = true;
+	}
+
+	const char *begin = data;
+	const char *end = data + size;
+
+	if (!pending.empty() && !lexer.fallback) {
+		pending.append(data, size);
+		begin = pending.c_str();
+		end = begin + pending.size();
+	}
+
+	if (!lexer.fallback)
+		begin += lexer.process(begin, end);
+
+	if (stopped)
+		return;
+
+	if (!lexer.fallback && end - begin > max_pending_size)
+		lexer.fallback = true;
+
+	if (lexer.fallback) {
+		// The rest of the document is parsed by libxml starting from the problematic place
+		mode = url_finder::libxml_parser;
+		create_parser();
+		std::string tail(begin, end);
+		pending.clear();
+		htmlParseChunk(ctxt, tail.c_str(), tail.size(), 0);
+		return;
+	}
+
+	std::string tail(begin, end);
+	pending.swap(tail);
+}
+
+void url_finder_stream_private::finish()
+{
+	if (mode == url_finder::libxml_parser)
+		htmlParseChunk(ctxt, "", 0, 1);
+
+	// Unterminated tag at the end of the document is ignored, as well as by browsers
+	pending.clear();
+	stopped = true;
+}
+
+static inline bool is_space(char ch)
+{
+	return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\f';
+}
+
+static inline bool is_name_char(char ch)
+{
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '-' || ch == ':';
+}
+
+static inline bool equals(const char *begin, const char *end, const char *name)
+{
+	const size_t size = strlen(name);
+	return size_t(end - begin) == size && strncasecmp(begin, name, size) == 0;
+}
+
+static void append_utf8(std::string &result, unsigned long code)
+{
+	if (code == 0 || code > 0x10ffff || (code >= 0xd800 && code <= 0xdfff))
+		code = 0xfffd;
+
+	if (code < 0x80) {
+		result += char(code);
+	} else if (code < 0x800) {
+		result += char(0xc0 | (code >> 6));
+		result += char(0x80 | (code & 0x3f));
+	} else if (code < 0x10000) {
+		result += char(0xe0 | (code >> 12));
+		result += char(0x80 | ((code >> 6) & 0x3f));
+		result += char(0x80 | (code & 0x3f));
+	} else {
+		result += char(0xf0 | (code >> 18));
+		result += char(0x80 | ((code >> 12) & 0x3f));
+		result += char(0x80 | ((code >> 6) & 0x3f));
+		result += char(0x80 | (code & 0x3f));
+	}
+}
+
+/*
+ * Returns attribute's value with decoded character references and without surrounding whitespaces.
+ * Only named references which make sense in urls are supported, the rest are kept as is.
+ */
+static std::string decode_value(const char *begin, const char *end)
+{
+	while (begin < end && is_space(*begin))
+		++begin;
+	while (begin < end && is_space(*(end - 1)))
+		--end;
+
+	std::string result;
+	result.reserve(end - begin);
+
+	while (begin < end) {
+		const char *amp = reinterpret_cast<const char *>(memchr(begin, '&', end - begin));
+		if (!amp) {
+			result.append(begin, end);
+			break;
+		}
+
+		result.append(begin, amp);
+		begin = amp + 1;
+
+		if (begin < end && *begin == '#') {
+			const char *it = begin + 1;
+			const bool hex = (it < end && (*it == 'x' || *it == 'X'));
+			if (hex)
+				++it;
+
+			unsigned long code = 0;
+			const char *digits = it;
+			for (; it < end && it - digits < 8; ++it) {
+				const char ch = *it;
+				if (ch >= '0' && ch <= '9')
+					code = code * (hex ? 16 : 10) + (ch - '0');
+				else if (hex && ch >= 'a' && ch <= 'f')
+					code = code * 16 + (ch - 'a' + 10);
+				else if (hex && ch >= 'A' && ch <= 'F')
+					code = code * 16 + (ch - 'A' + 10);
+				else
+					break;
+			}
+
+			if (it == digits) {
+				result += '&';
+				continue;
+			}
+
+			append_utf8(result, code);
+			begin = (it < end && *it == ';') ? it + 1 : it;
+			continue;
+		}
 
-	if (strcasecmp(reinterpret_cast<const char*>(tag_name), "a") == 0) {
-		if (attributes) {
-			for (size_t index = 0; attributes[index]; index += 2) {
-				const xmlChar *name = attributes[index];
-				const xmlChar *value = attributes[index + 1];
-				if (!value)
-					continue;
+		static const struct {
+			const char *name;
+			char value;
+		} entities[] = {
+			{ "amp;", '&' },
+			{ "lt;", '<' },
+			{ "gt;", '>' },
+			{ "quot;", '"' },
+			{ "apos;", '\'' }
+		};
 
-				if (strcmp(reinterpret_cast<const char*>(name), "href") == 0) {
-					context->urls.push_back(reinterpret_cast<const char*>(value));
-				}
+		bool found = false;
+		for (size_t i = 0; i < sizeof(entities) / sizeof(entities[0]); ++i) {
+			const size_t size = strlen(entities[i].name);
+			if (size_t(end - begin) >= size && memcmp(begin, entities[i].name, size) == 0) {
+				result += entities[i].value;
+				begin += size;
+				found = true;
+				break;
 			}
 		}
+
+		if (!found)
+			result += '&';
+	}
+
+	return result;
+}
+
+size_t url_lexer::process(const char *begin, const char *end)
+{
+	const char *it = begin;
+
+	while (it < end && !finder->stopped && !fallback) {
+		const char *next = NULL;
+		const state_type old_state = state;
+
+		switch (state) {
+		case text_state:
+			next = process_text(it, end);
+			break;
+		case comment_state:
+			next = process_comment(it, end);
+			break;
+		case raw_text_state:
+			next = process_raw_text(it, end);
+			break;
+		}
+
+		// More data is needed
+		if (next == it && state == old_state)
+			break;
+
+		it = next;
+	}
+
+	return it - begin;
+}
+
+const char *url_lexer::process_text(const char *begin, const char *end)
+{
+	const char *lt = reinterpret_cast<const char *>(memchr(begin, '<', end - begin));
+	if (!lt)
+		return end;
+
+	const char *it = lt + 1;
+	if (it == end)
+		return lt;
+
+	if (*it == '!') {
+		if (end - it < 3)
+			return lt;
+
+		if (it[1] == '-' && it[2] == '-') {
+			state = comment_state;
+			return it + 3;
+		}
+	}
+
+	if (*it == '!' || *it == '?' || *it == '/') {
+		// Doctype, processing instruction or closing tag, nothing interesting inside
+		const char *gt = reinterpret_cast<const char *>(memchr(it, '>', end - it));
+		return gt ? gt + 1 : lt;
+	}
+
+	if (!((*it >= 'a' && *it <= 'z') || (*it >= 'A' && *it <= 'Z'))) {
+		// Just a '<' character in the text
+		return it;
+	}
+
+	// Find the end of the tag, '>' may be inside of quoted attribute's values
+	bool after_equals = false;
+	for (; it < end; ++it) {
+		const char ch = *it;
+
+		if (ch == '>') {
+			process_tag(lt + 1, it);
+			return it + 1;
+		} else if (after_equals && (ch == '"' || ch == '\'')) {
+			const char *quote = reinterpret_cast<const char *>(memchr(it + 1, ch, end - it - 1));
+			if (!quote)
+				return lt;
+			it = quote;
+			after_equals = false;
+		} else if (ch == '=') {
+			after_equals = true;
+		} else if (!is_space(ch)) {
+			after_equals = false;
+		}
+	}
+
+	return lt;
+}
+
+const char *url_lexer::process_comment(const char *begin, const char *end)
+{
+	const char *gt = reinterpret_cast<const char *>(memmem(begin, end - begin, "-->", 3));
+	if (gt) {
+		state = text_state;
+		return gt + 3;
+	}
+
+	// Keep the possible beginning of "-->"
+	return end - begin > 2 ? end - 2 : begin;
+}
+
+const char *url_lexer::process_raw_text(const char *begin, const char *end)
+{
+	const char *it = begin;
+
+	while (it < end) {
+		const char *lt = reinterpret_cast<const char *>(memchr(it, '<', end - it));
+		if (!lt)
+			return end;
+
+		// "</" + tag name + one more character to check that the name is finished
+		if (size_t(end - lt) < raw_tag.size() + 3)
+			return lt;
+
+		if (lt[1] == '/'
+			&& strncasecmp(lt + 2, raw_tag.c_str(), raw_tag.size()) == 0
+			&& !is_name_char(lt[2 + raw_tag.size()])) {
+			state = text_state;
+			return lt;
+		}
+
+		it = lt + 1;
+	}
+
+	return end;
+}
+
+void url_lexer::process_tag(const char *begin, const char *end)
+{
+	const char *it = begin;
+	while (it < end && is_name_char(*it))
+		++it;
+
+	const char *name_end = it;
+	const bool is_link = equals(begin, name_end, "a");
+	const bool is_base = !is_link && equals(begin, name_end, "base");
+
+	if (equals(begin, name_end, "script") || equals(begin, name_end, "style")) {
+		// Content of them is not a markup, it's skipped until closing tag
+		if (end == begin || *(end - 1) != '/') {
+			raw_tag.assign(begin, name_end);
+			state = raw_text_state;
+		}
+		return;
+	}
+
+	if (!is_link && !is_base && !finder->sources)
+		return;
+
+	// The first attribute wins like in libxml and browsers, duplicates are ignored
+	bool href_found = false;
+	bool src_found = false;
+
+	while (it < end && !finder->stopped) {
+		while (it < end && (is_space(*it) || *it == '/'))
+			++it;
+
+		const char *attr_begin = it;
+		while (it < end && !is_space(*it) && *it != '=' && *it != '/')
+			++it;
+		const char *attr_end = it;
+
+		while (it < end && is_space(*it))
+			++it;
+
+		if (it == end || *it != '=')
+			continue;
+
+		++it;
+		while (it < end && is_space(*it))
+			++it;
+
+		const char *value_begin = it;
+		const char *value_end;
+
+		if (it < end && (*it == '"' || *it == '\'')) {
+			const char *quote = reinterpret_cast<const char *>(memchr(it + 1, *it, end - it - 1));
+			value_begin = it + 1;
+			value_end = quote ? quote : end;
+			it = quote ? quote + 1 : end;
+		} else {
+			while (it < end && !is_space(*it))
+				++it;
+			value_end = it;
+		}
+
+		if (!href_found && equals(attr_begin, attr_end, "href")) {
+			href_found = true;
+			if (is_link)
+				finder->on_url(decode_value(value_begin, value_end));
+			else if (is_base)
+				finder->on_base(decode_value(value_begin, value_end));
+		} else if (finder->sources && !src_found && equals(attr_begin, attr_end, "src")) {
+			src_found = true;
+			finder->on_url(decode_value(value_begin, value_end));
+		}
 	}
 }
 
-url_finder::url_finder(const std::string &html) : m_html(html), m_parsed(false)
+static bool push_url(std::vector<std::string> *urls, const std::string &url)
+{
+	urls->push_back(url);
+	return true;
+}
+
+url_finder::url_finder(const std::string &html, parser_mode mode) : m_html(html), m_mode(mode), m_parsed(false)
 {
 }
 
@@ -63,21 +558,96 @@ const std::vector<std::string> &url_finder::urls() const
 	return m_urls;
 }
 
+const std::string &url_finder::base_url() const
+{
+	urls();
+	return m_base_url;
+}
+
 void url_finder::parse() const
 {
-	htmlParserCtxtPtr ctxt;
-	parser_context context = { m_urls };
+	url_finder_stream stream(std::bind(push_url, &m_urls, std::placeholders::_1), m_mode);
+	stream.feed(m_html);
+	stream.finish();
+	m_base_url = stream.base_url();
+}
+
+url_finder_stream::url_finder_stream(const handler_type &handler, url_finder::parser_mode mode) :
+	m_data(new url_finder_stream_private(handler, mode))
+{
+	if (mode == url_finder::libxml_parser)
+		m_data->create_parser();
+}
+
+url_finder_stream::~url_finder_stream()
+{
+}
+
+void url_finder_stream::set_urls_limit(size_t limit)
+{
+	m_data->urls_limit = limit;
+}
+
+void url_finder_stream::set_bytes_limit(size_t limit)
+{
+	m_data->bytes_limit = limit;
+}
 
-	htmlSAXHandler handler;
-	memset(&handler, 0, sizeof(handler));
-	handler.startElement = parser_start_element;
+void url_finder_stream::set_sources(bool sources)
+{
+	m_data->sources = sources;
+}
+
+bool url_finder_stream::feed(const char *data, size_t size)
+{
+	if (m_data->stopped)
+		return false;
+
+	const size_t left = m_data->bytes_limit - m_data->bytes_count;
+	const bool last = (size >= left);
+	if (last)
+		size = left;
+
+	m_data->bytes_count += size;
+	m_data->parse(data, size);
+
+	if (last && !m_data->stopped)
+		finish();
+
+	return !m_data->stopped;
+}
+
+bool url_finder_stream::feed(const std::string &data)
+{
+	return feed(data.c_str(), data.size());
+}
 
-	ctxt = htmlCreatePushParserCtxt(&handler, &context, "", 0, "", XML_CHAR_ENCODING_NONE);
+void url_finder_stream::finish()
+{
+	if (m_data->stopped)
+		return;
+
+	m_data->finish();
+}
+
+bool url_finder_stream::stopped() const
+{
+	return m_data->stopped;
+}
 
-	htmlParseChunk(ctxt, m_html.c_str(), m_html.size(), 0);
-	htmlParseChunk(ctxt, "", 0, 1);
+size_t url_finder_stream::urls_count() const
+{
+	return m_data->urls_count;
+}
+
+size_t url_finder_stream::bytes_count() const
+{
+	return m_data->bytes_count;
+}
 
-	htmlFreeParserCtxt(ctxt);
+const std::string &url_finder_stream::base_url() const
+{
+	return m_data->base_url;
 }
 
 } // namespace crawler
@@ -19,23 +19,142 @@
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <functional>
 
 namespace ioremap {
 namespace swarm {
 
+class url_finder_stream_private;
+
 class url_finder
 {
 public:
-	url_finder(const std::string &html);
+	/*!
+	 * \brief The parser_mode enum describes the way links are extracted from the document.
+	 */
+	enum parser_mode {
+		//! Full HTML parser by libxml, the default
+		libxml_parser,
+		/*!
+		 * Lexer which looks only at tags' attributes, it's many times faster.
+		 * libxml is still used for the rest of the document if markup is too broken for the lexer.
+		 */
+		lexer_parser
+	};
+
+	url_finder(const std::string &html, parser_mode mode = libxml_parser);
 
 	const std::vector<std::string> &urls() const;
+	/*!
+	 * \brief Returns value of the document's <base href> tag, empty string if there is no one.
+	 *
+	 * Relative links have to be resolved against it instead of the document's url.
+	 */
+	const std::string &base_url() const;
 
 private:
 	void parse() const;
 
 	std::string m_html;
+	parser_mode m_mode;
 	mutable bool m_parsed;
 	mutable std::vector<std::string> m_urls;
+	mutable std::string m_base_url;
+};
+
+/*!
+ * \brief The url_finder_stream class extracts links from the HTML document received by chunks.
+ *
+ * Links are passed to the handler as soon as they are found, so there is no need to keep
+ * the whole document in memory. Parsing may be stopped after first urls_limit links or
+ * bytes_limit bytes of the document, or by the handler itself.
+ *
+ * \code{.cpp}
+ * auto finder = std::make_shared<url_finder_stream>([] (const std::string &url) {
+ *     std::cout << url << std::endl;
+ *     return true;
+ * });
+ * finder->set_urls_limit(100);
+ *
+ * // from base_stream::on_data
+ * finder->feed(boost::asio::buffer_cast<const char *>(data), boost::asio::buffer_size(data));
+ * // from base_stream::on_close
+ * finder->finish();
+ * \endcode
+ */
+class url_finder_stream
+{
+public:
+	/*!
+	 * \brief Handler is called for every found link, parsing is stopped if it returns false.
+	 */
+	typedef std::function<bool (const std::string &url)> handler_type;
+
+	/*!
+	 * \brief Constructs url finder which passes links to \a handler, they are found by parser of \a mode.
+	 */
+	url_finder_stream(const handler_type &handler, url_finder::parser_mode mode = url_finder::libxml_parser);
+	url_finder_stream(const url_finder_stream &other) = delete;
+	~url_finder_stream();
+
+	url_finder_stream &operator =(const url_finder_stream &other) = delete;
+
+	/*!
+	 * \brief Stops parsing once \a limit links are found.
+	 *
+	 * By default there is no limit.
+	 */
+	void set_urls_limit(size_t limit);
+	/*!
+	 * \brief Stops parsing once first \a limit bytes of the document are processed.
+	 *
+	 * By default there is no limit.
+	 */
+	void set_bytes_limit(size_t limit);
+	/*!
+	 * \brief Makes values of src attributes (images, scripts, frames) to be reported as links if \a sources is true.
+	 *
+	 * By default only href attributes of <a> tags are reported.
+	 */
+	void set_sources(bool sources);
+
+	/*!
+	 * \brief Parses next chunk of the document by \a data of \a size bytes.
+	 *
+	 * Returns false if parsing is stopped and there is no need in more data.
+	 */
+	bool feed(const char *data, size_t size);
+	/*!
+	 * \brief Parses next chunk of the document by \a data.
+	 *
+	 * Returns false if parsing is stopped and there is no need in more data.
+	 */
+	bool feed(const std::string &data);
+	/*!
+	 * \brief Finishes parsing of the document, links from it's tail are reported at this point.
+	 */
+	void finish();
+
+	/*!
+	 * \brief Returns true if parsing is stopped either by finish or because of limits.
+	 */
+	bool stopped() const;
+	/*!
+	 * \brief Returns number of links found so far.
+	 */
+	size_t urls_count() const;
+	/*!
+	 * \brief Returns number of bytes of the document processed so far.
+	 */
+	size_t bytes_count() const;
+	/*!
+	 * \brief Returns value of the document's <base href> tag, empty string if it's not found yet.
+	 */
+	const std::string &base_url() const;
+
+private:
+	std::unique_ptr<url_finder_stream_private> m_data;
 };
 
 } // namespace crawler
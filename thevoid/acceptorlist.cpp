@@ -21,6 +21,8 @@
 #include <boost/lexical_cast.hpp>
 #include <iostream>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 namespace ioremap { namespace thevoid {
 
@@ -37,6 +39,128 @@ static void complete_socket_creation(boost::asio::local::stream_protocol::endpoi
 	chmod(endpoint.path().c_str(), 0666);
 }
 
+template <typename Socket>
+static int incoming_cpu_worker(server_data &data, Socket &socket)
+{
+	(void) data;
+	(void) socket;
+	return -1;
+}
+
+/*
+ * Returns the active worker which runs at the CPU the socket's packets are processed at.
+ * Together with IRQ affinity of NIC's queues it makes all the work with the connection
+ * to be done by the single CPU.
+ */
+static int incoming_cpu_worker(server_data &data, boost::asio::ip::tcp::socket &socket)
+{
+#ifdef SO_INCOMING_CPU
+	if (!data.incoming_cpu)
+		return -1;
+
+	int cpu = -1;
+	socklen_t cpu_size = sizeof(cpu);
+	if (getsockopt(socket.native_handle(), SOL_SOCKET, SO_INCOMING_CPU, &cpu, &cpu_size) != 0)
+		return -1;
+
+	if (cpu < 0 || size_t(cpu) >= data.cpu_workers.size() || data.cpu_workers[cpu] < 0)
+		return -1;
+
+	const unsigned int worker = data.cpu_workers[cpu];
+	return worker < data.threads_count ? int(worker) : -1;
+#else
+	(void) data;
+	(void) socket;
+	return -1;
+#endif
+}
+
+/*
+ * Keeps the worker's loop running until the connection is started there, returns null if the worker is retired.
+ * The work is taken before the worker is checked to be active, so the pool shrunk concurrently
+ * can not make the loop exit in between.
+ */
+static std::shared_ptr<boost::asio::io_service::work> hold_worker(server_data &data, boost::asio::io_service &service)
+{
+	auto work = std::make_shared<boost::asio::io_service::work>(service);
+
+	const int worker = data.worker_index(service);
+	if (worker < 0 || unsigned(worker) >= data.threads_count)
+		work.reset();
+	return work;
+}
+
+/*
+ * Moves the accepted socket to another worker if it's SO_INCOMING_CPU asks so, or if the worker
+ * it was created for has been retired while the socket was waiting for the connection.
+ * The work holds the loop of the worker the returned connection belongs to.
+ */
+template <typename Connection>
+static std::shared_ptr<Connection> move_to_worker(server_data &data, const std::shared_ptr<Connection> &conn,
+	std::shared_ptr<boost::asio::io_service::work> &work)
+{
+	boost::asio::io_service &current = conn->socket().get_io_service();
+	boost::asio::io_service *service = &current;
+
+	const int worker = incoming_cpu_worker(data, conn->socket());
+	if (worker >= 0)
+		service = data.worker_io_services[worker].get();
+
+	work = hold_worker(data, *service);
+	while (!work) {
+		service = &data.get_worker_service();
+		work = hold_worker(data, *service);
+	}
+
+	if (service == &current)
+		return conn;
+
+	// The connection stays at it's worker if it can not be moved, the loop is kept running until it's started
+	boost::system::error_code ec;
+	auto endpoint = conn->socket().local_endpoint(ec);
+	if (ec) {
+		work = std::make_shared<boost::asio::io_service::work>(current);
+		return conn;
+	}
+
+	// Sockets can not be moved between io_services, so the new one is created for the same descriptor
+	const int fd = dup(conn->socket().native_handle());
+	if (fd < 0) {
+		work = std::make_shared<boost::asio::io_service::work>(current);
+		return conn;
+	}
+
+	auto result = std::make_shared<Connection>(*service, data.buffer_size);
+	result->socket().assign(endpoint.protocol(), fd, ec);
+	if (ec) {
+		::close(fd);
+		work = std::make_shared<boost::asio::io_service::work>(current);
+		return conn;
+	}
+
+	conn->socket().close(ec);
+	return result;
+}
+
+static std::shared_ptr<monitor_connection> move_to_worker(server_data &data, const std::shared_ptr<monitor_connection> &conn,
+	std::shared_ptr<boost::asio::io_service::work> &work)
+{
+	(void) data;
+	(void) work;
+	return conn;
+}
+
+/*
+ * The work is bound to the handler, so the worker's loop doesn't exit before the connection is started
+ */
+template <typename Connection>
+static void start_connection(const std::shared_ptr<Connection> &conn, const std::shared_ptr<base_server> &server,
+	const std::shared_ptr<boost::asio::io_service::work> &work)
+{
+	(void) work;
+	conn->start(server);
+}
+
 template <typename Connection>
 acceptors_list<Connection>::acceptors_list(server_data &data) : data(data)
 {
@@ -100,7 +224,10 @@ void acceptors_list<Connection>::handle_accept(size_t index, connection_ptr_type
 {
 	if (!err) {
 		if (auto server = data.server.lock()) {
-			conn->start(server);
+			std::shared_ptr<boost::asio::io_service::work> work;
+			conn = move_to_worker(data, conn, work);
+			// Connection is started by it's own thread, so all it's memory is allocated there
+			conn->socket().get_io_service().post(std::bind(start_connection<connection_type>, conn, server, work));
 		} else {
 			throw std::logic_error("server::m_data->server is null");
 		}
@@ -16,6 +16,10 @@
 
 #include "connection_p.hpp"
 #include <vector>
+#include <limits>
+#include <algorithm>
+#include <string.h>
+#include <strings.h>
 #include <boost/bind.hpp>
 #include <iostream>
 
@@ -66,21 +70,24 @@ do { \
 
 template <typename T>
 connection<T>::connection(boost::asio::io_service &service, size_t buffer_size) :
+	m_worker(0),
 	m_socket(service),
-	m_buffer(buffer_size),
+	m_buffer_size(buffer_size),
 	m_content_length(0),
 	m_state(read_headers | waiting_for_first_data),
 	m_sending(false),
 	m_keep_alive(false),
 	m_at_read(false)
 {
-	m_unprocessed_begin = m_buffer.data();
-	m_unprocessed_end = m_buffer.data();
+	m_unprocessed_begin = NULL;
+	m_unprocessed_end = NULL;
 	m_access_start.tv_sec = 0;
 	m_access_start.tv_usec = 0;
 	m_access_status = 0;
 	m_access_received = 0;
 	m_access_sent = 0;
+	m_access_seed = reinterpret_cast<uintptr_t>(this) ^ time(NULL);
+	reset_slow_log();
 
 	debug(&service);
 }
@@ -91,8 +98,11 @@ connection<T>::~connection()
 	if (m_server) {
 		debug("Closed connection to client: " << this);
 		--m_server->m_data->connections_counter;
+		m_server->m_data->counters.connections_closed.shard(m_worker).increment();
 	}
 
+	unregister_inflight();
+
 	if (m_handler) {
 		m_access_status = 597;
 		print_access_log();
@@ -110,11 +120,24 @@ T &connection<T>::socket()
 template <typename T>
 void connection<T>::start(const std::shared_ptr<base_server> &server)
 {
-	m_access_local = boost::lexical_cast<std::string>(m_socket.local_endpoint());
-	m_access_remote = boost::lexical_cast<std::string>(m_socket.remote_endpoint());
+	// Client may be already gone as start is called from the worker's queue
+	boost::system::error_code ec;
+	auto local_endpoint = m_socket.local_endpoint(ec);
+	if (!ec)
+		m_access_local = boost::lexical_cast<std::string>(local_endpoint);
+	auto remote_endpoint = m_socket.remote_endpoint(ec);
+	if (!ec)
+		m_access_remote = boost::lexical_cast<std::string>(remote_endpoint);
+
 	m_server = server;
 	m_logger = server->logger();
+	m_buffer.resize(m_buffer_size);
+
+	const int worker = m_server->m_data->worker_index(m_socket.get_io_service());
+	if (worker >= 0)
+		m_worker = worker;
 	++m_server->m_data->connections_counter;
+	m_server->m_data->counters.connections_accepted.shard(m_worker).increment();
 	debug("Opened new connection to client: " << this);
 	async_read();
 }
@@ -127,6 +150,9 @@ void connection<T>::send_headers(swarm::http_response &&rep,
 	debug("send headers: " << rep.code());
 
 	m_access_status = rep.code();
+	m_inflight.set_phase(inflight_request::sending_reply);
+	if (m_slow_threshold != std::numeric_limits<unsigned long long>::max())
+		gettimeofday(&m_slow_reply_time, NULL);
 
 	if (m_keep_alive) {
                 rep.headers().set_keep_alive();
@@ -195,6 +221,7 @@ template <typename T>
 void connection<T>::write_finished(const boost::system::error_code &err, size_t bytes_written)
 {
 	m_access_sent += bytes_written;
+	m_inflight.set_bytes(m_access_received, m_access_sent);
 
 	if (err) {
 		decltype(m_outgoing) outgoing;
@@ -372,6 +399,7 @@ void connection<T>::process_next()
 	m_access_status = 0;
 	m_access_received = 0;
 	m_access_sent = 0;
+	reset_slow_log();
 	m_request_parser.reset();
 
 	m_request = swarm::http_request();
@@ -388,6 +416,8 @@ void connection<T>::process_next()
 template <typename T>
 void connection<T>::print_access_log()
 {
+	unregister_inflight();
+
 	if (m_state & waiting_for_first_data)
 		return;
 
@@ -396,6 +426,26 @@ void connection<T>::print_access_log()
 
 	unsigned long long delta = 1000000ull * (end.tv_sec - m_access_start.tv_sec) + end.tv_usec - m_access_start.tv_usec;
 
+	// Shards of the worker are not touched by other workers
+	server_counters &counters = m_server->m_data->counters;
+	counters.requests.shard(m_worker).increment();
+	counters.statuses[std::max(0, std::min(m_access_status / 100, 5))].shard(m_worker).increment();
+	counters.bytes_received.shard(m_worker).increment(m_access_received);
+	counters.bytes_sent.shard(m_worker).increment(m_access_sent);
+	counters.request_time.shard(m_worker).add(delta);
+
+	if (delta >= m_slow_threshold)
+		print_slow_log(delta);
+
+	// Slow requests are always logged, the rest is sampled by status class
+	if (delta < m_server->m_data->access_log_slow_time) {
+		const int status_class = std::max(0, std::min(m_access_status / 100, 5));
+		const double sample = m_server->m_data->access_log_sample[status_class];
+
+		if (sample < 1.0 && (sample <= 0 || rand_r(&m_access_seed) >= sample * RAND_MAX))
+			return;
+	}
+
 	m_logger.log(swarm::SWARM_LOG_INFO, "access_log_entry: method: %s, url: %s, local: %s, remote: %s, status: %d, received: %llu, sent: %llu, time: %llu us",
 		m_access_method.empty() ? "-" : m_access_method.c_str(),
 		m_access_url.empty() ? "-" : m_access_url.c_str(),
@@ -407,6 +457,99 @@ void connection<T>::print_access_log()
 		delta);
 }
 
+static std::string slow_log_offset(const timeval &start, const timeval &phase)
+{
+	if (phase.tv_sec == 0 && phase.tv_usec == 0)
+		return "-";
+
+	const long long delta = 1000000ll * (phase.tv_sec - start.tv_sec) + phase.tv_usec - start.tv_usec;
+	return boost::lexical_cast<std::string>(delta) + " us";
+}
+
+/*
+ * Returns true if the header carries credentials, so it's value must not get to the log
+ */
+static bool is_secret_header(const std::string &name)
+{
+	static const char *secret_headers[] = {
+		"Authorization",
+		"Proxy-Authorization",
+		"Cookie",
+		"Set-Cookie"
+	};
+
+	for (size_t i = 0; i < sizeof(secret_headers) / sizeof(secret_headers[0]); ++i) {
+		if (strcasecmp(secret_headers[i], name.c_str()) == 0)
+			return true;
+	}
+	return false;
+}
+
+template <typename T>
+void connection<T>::print_slow_log(unsigned long long delta)
+{
+	const server_data &data = *m_server->m_data;
+
+	// Keep the record in one line, values of credential headers are hidden
+	std::string headers;
+	for (auto it = m_slow_headers.all().begin(); it != m_slow_headers.all().end(); ++it) {
+		if (!headers.empty())
+			headers += "\\n";
+		headers += it->first;
+		headers += ": ";
+		headers += is_secret_header(it->first) ? "<hidden>" : it->second;
+	}
+
+	data.slow_logger.log(swarm::SWARM_LOG_INFO, "slow_request: method: %s, url: %s, local: %s, remote: %s, status: %d, "
+		"worker: %zu, active at arrival: %d, received: %llu, sent: %llu, "
+		"headers parsed: %s, body received: %s, reply started: %s, time: %llu us, headers: \"%s\"",
+		m_access_method.empty() ? "-" : m_access_method.c_str(),
+		m_access_url.empty() ? "-" : m_access_url.c_str(),
+		m_access_local.c_str(),
+		m_access_remote.c_str(),
+		m_access_status,
+		m_worker,
+		m_slow_active,
+		m_access_received,
+		m_access_sent,
+		slow_log_offset(m_access_start, m_slow_headers_time).c_str(),
+		slow_log_offset(m_access_start, m_slow_body_time).c_str(),
+		slow_log_offset(m_access_start, m_slow_reply_time).c_str(),
+		delta,
+		headers.c_str());
+}
+
+template <typename T>
+void connection<T>::reset_slow_log()
+{
+	m_slow_threshold = std::numeric_limits<unsigned long long>::max();
+	timerclear(&m_slow_headers_time);
+	timerclear(&m_slow_body_time);
+	timerclear(&m_slow_reply_time);
+	m_slow_active = 0;
+	m_slow_headers.clear();
+}
+
+template <typename T>
+void connection<T>::register_inflight()
+{
+	m_inflight.method = &m_access_method;
+	m_inflight.url = &m_access_url;
+	m_inflight.start = m_access_start;
+	m_inflight.set_phase(inflight_request::receiving_body);
+	m_inflight.set_bytes(m_access_received, m_access_sent);
+
+	if (!m_inflight.registered)
+		m_server->m_data->inflight_registries[m_worker]->insert(&m_inflight);
+}
+
+template <typename T>
+void connection<T>::unregister_inflight()
+{
+	if (m_inflight.registered)
+		m_server->m_data->inflight_registries[m_worker]->remove(&m_inflight);
+}
+
 template <typename T>
 void connection<T>::handle_read(const boost::system::error_code &err, std::size_t bytes_transferred)
 {
@@ -464,7 +607,15 @@ void connection<T>::process_data(const char *begin, const char *end)
 
 			m_access_method = m_request.method();
 			m_access_url = m_request.url().original();
-			auto factory = m_server->factory(m_request);
+			register_inflight();
+			auto factory = m_server->factory(m_request, &m_slow_threshold);
+
+			if (m_slow_threshold != std::numeric_limits<unsigned long long>::max()) {
+				gettimeofday(&m_slow_headers_time, NULL);
+				m_slow_active = m_server->m_data->active_connections_counter;
+				// The request itself is moved to the handler, so keep it's headers for the record
+				m_slow_headers = m_request.headers();
+			}
 
 			if (auto length = m_request.headers().content_length())
 				m_content_length = *length;
@@ -474,7 +625,7 @@ void connection<T>::process_data(const char *begin, const char *end)
 
 			if (factory) {
 				++m_server->m_data->active_connections_counter;
-				m_handler = factory->create();
+				m_handler = factory->create(m_server);
 				m_handler->initialize(std::static_pointer_cast<reply_stream>(this->shared_from_this()));
 				SAFE_CALL(m_handler->on_headers(std::move(m_request)), "connection::process_data -> on_headers", SAFE_SEND_ERROR);
 			} else {
@@ -500,6 +651,7 @@ void connection<T>::process_data(const char *begin, const char *end)
 
 		m_content_length -= processed_size;
 		m_access_received += processed_size;
+		m_inflight.set_bytes(m_access_received, m_access_sent);
 
 		debug(m_state);
 
@@ -517,6 +669,11 @@ void connection<T>::process_data(const char *begin, const char *end)
 			m_unprocessed_begin = begin + processed_size;
 			m_unprocessed_end = end;
 
+			if (m_inflight.phase == inflight_request::receiving_body)
+				m_inflight.set_phase(inflight_request::processing);
+			if (m_slow_threshold != std::numeric_limits<unsigned long long>::max())
+				gettimeofday(&m_slow_body_time, NULL);
+
 			debug("Handler processed all data, " << (m_unprocessed_end - m_unprocessed_begin) << " bytes are still unprocessed, state: " << m_state);
 
 			if (m_handler)
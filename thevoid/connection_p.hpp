@@ -24,6 +24,7 @@
 #include <boost/enable_shared_from_this.hpp>
 #include <swarm/http_request.hpp>
 #include "request_parser_p.hpp"
+#include "inflight_p.hpp"
 #include "stream.hpp"
 #include <queue>
 #include <mutex>
@@ -118,6 +119,10 @@ private:
 	void close_impl(const boost::system::error_code &err);
 	void process_next();
 	void print_access_log();
+	void print_slow_log(unsigned long long delta);
+	void reset_slow_log();
+	void register_inflight();
+	void unregister_inflight();
 
 	//! Handle completion of a read operation.
 	void handle_read(const boost::system::error_code &err, std::size_t bytes_transferred);
@@ -130,6 +135,8 @@ private:
 	//! Server reference for handler logic
 	std::shared_ptr<base_server> m_server;
 	swarm::logger m_logger;
+	//! Index of the worker which owns the connection
+	size_t m_worker;
 
 	//! Socket for the connection.
 	T m_socket;
@@ -138,8 +145,9 @@ private:
 	std::deque<buffer_info> m_outgoing;
 	std::mutex m_outgoing_mutex;
 
-	//! Buffer for incoming data.
+	//! Buffer for incoming data, it's allocated by the worker's thread at start, so it's local to it's NUMA node
 	std::vector<char> m_buffer;
+	size_t m_buffer_size;
 
 	//! The incoming request.
 	swarm::http_request m_request;
@@ -153,6 +161,19 @@ private:
 	int m_access_status;
 	unsigned long long m_access_received;
 	unsigned long long m_access_sent;
+	unsigned int m_access_seed;
+
+	//! Slow log info, phases' timestamps are zero until they are reached
+	unsigned long long m_slow_threshold;
+	timeval m_slow_headers_time;
+	timeval m_slow_body_time;
+	timeval m_slow_reply_time;
+	int m_slow_active;
+	//! Headers of the request, kept only if it's handler has slow threshold
+	swarm::http_headers m_slow_headers;
+
+	//! Slot in the worker's registry of requests being processed
+	inflight_request m_inflight;
 
 	//! The parser for the incoming request.
 	request_parser m_request_parser;
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "inflight_p.hpp"
+
+namespace ioremap {
+namespace thevoid {
+
+inflight_registry::inflight_registry() : m_head(NULL)
+{
+}
+
+void inflight_registry::insert(inflight_request *request)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	request->prev = NULL;
+	request->next = m_head;
+	if (m_head)
+		m_head->prev = request;
+	m_head = request;
+	request->registered = true;
+}
+
+void inflight_registry::remove(inflight_request *request)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (request->prev)
+		request->prev->next = request->next;
+	else
+		m_head = request->next;
+	if (request->next)
+		request->next->prev = request->prev;
+
+	request->prev = NULL;
+	request->next = NULL;
+	request->registered = false;
+}
+
+void inflight_registry::collect(size_t worker, std::vector<inflight_request_info> &requests) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (inflight_request *it = m_head; it; it = it->next) {
+		inflight_request_info info;
+		info.worker = worker;
+		info.method = *it->method;
+		info.url = *it->url;
+		info.start = it->start;
+		info.phase = it->phase.load(std::memory_order_relaxed);
+		info.received = it->received.load(std::memory_order_relaxed);
+		info.sent = it->sent.load(std::memory_order_relaxed);
+		requests.push_back(std::move(info));
+	}
+}
+
+const char *inflight_registry::phase_name(int phase)
+{
+	switch (phase) {
+	case inflight_request::receiving_body:
+		return "receiving-body";
+	case inflight_request::processing:
+		return "processing";
+	case inflight_request::sending_reply:
+		return "sending-reply";
+	default:
+		return "unknown";
+	}
+}
+
+}} // namespace ioremap::thevoid
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOREMAP_THEVOID_INFLIGHT_P_HPP
+#define IOREMAP_THEVOID_INFLIGHT_P_HPP
+
+#include <swarm/c++config.hpp>
+
+#include <sys/time.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef SWARM_CSTDATOMIC
+#  include <cstdatomic>
+#else
+#  include <atomic>
+#endif
+
+namespace ioremap {
+namespace thevoid {
+
+/*!
+ * \internal
+ *
+ * Slot of the request being processed, it's a part of the connection.
+ *
+ * Method, url and start time are set before the slot is registered and are not changed until
+ * it's unregistered, the rest is updated by the connection's thread with relaxed stores.
+ */
+struct inflight_request
+{
+	enum phase_type {
+		receiving_body = 0,
+		processing = 1,
+		sending_reply = 2
+	};
+
+	inflight_request() : method(NULL), url(NULL), phase(receiving_body), received(0), sent(0),
+		registered(false), prev(NULL), next(NULL)
+	{
+		start.tv_sec = 0;
+		start.tv_usec = 0;
+	}
+
+	void set_phase(phase_type value)
+	{
+		phase.store(value, std::memory_order_relaxed);
+	}
+
+	void set_bytes(unsigned long long received_bytes, unsigned long long sent_bytes)
+	{
+		received.store(received_bytes, std::memory_order_relaxed);
+		sent.store(sent_bytes, std::memory_order_relaxed);
+	}
+
+	const std::string *method;
+	const std::string *url;
+	timeval start;
+	std::atomic_int phase;
+	std::atomic_ullong received;
+	std::atomic_ullong sent;
+
+	bool registered;
+	inflight_request *prev;
+	inflight_request *next;
+};
+
+/*!
+ * \internal
+ *
+ * Copy of inflight_request made for the monitor.
+ */
+struct inflight_request_info
+{
+	size_t worker;
+	std::string method;
+	std::string url;
+	timeval start;
+	int phase;
+	unsigned long long received;
+	unsigned long long sent;
+};
+
+/*!
+ * \internal
+ *
+ * List of requests being processed by the single worker. It's lock is taken by the worker
+ * only at start and at finish of the request, so the only contender is the monitor.
+ */
+class inflight_registry
+{
+public:
+	inflight_registry();
+	inflight_registry(const inflight_registry &other) = delete;
+	inflight_registry &operator =(const inflight_registry &other) = delete;
+
+	void insert(inflight_request *request);
+	void remove(inflight_request *request);
+
+	/*!
+	 * Appends copies of all requests to \a requests, \a worker is stored to each of them.
+	 */
+	void collect(size_t worker, std::vector<inflight_request_info> &requests) const;
+
+	static const char *phase_name(int phase);
+
+private:
+	mutable std::mutex m_mutex;
+	inflight_request *m_head;
+};
+
+}} // namespace ioremap::thevoid
+
+#endif // IOREMAP_THEVOID_INFLIGHT_P_HPP
@@ -0,0 +1,478 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOREMAP_THEVOID_MIRROR_HPP
+#define IOREMAP_THEVOID_MIRROR_HPP
+
+#include "streamfactory.hpp"
+#include "proxy_stream.hpp"
+
+#include <swarm/c++config.hpp>
+
+#ifdef SWARM_CSTDATOMIC
+#  include <cstdatomic>
+#else
+#  include <atomic>
+#endif
+
+#include <chrono>
+#include <cmath>
+
+namespace ioremap {
+namespace thevoid {
+
+/*!
+ * \brief The traffic_mirror class sends copies of client's requests to the shadow upstream.
+ *
+ * Responses of the shadow upstream are discarded, only the number of mirrored requests,
+ * their errors and latency are accounted. It's intended for checking of the new backend
+ * by the production traffic without any influence on client's replies.
+ *
+ * Mirroring is strictly bounded: requests are not mirrored if there are already
+ * max_in_flight mirrored requests or max_queued_bytes of their data are kept in memory.
+ * Requests with bodies larger than body_limit are not mirrored too.
+ *
+ * Mirror is attached to the handlers by server::on_mirrored, each of them may have own sampling rate.
+ *
+ * \code{.cpp}
+ * auto mirror = std::make_shared<thevoid::traffic_mirror>(fetcher, "http://shadow:8080");
+ * on_mirrored<on_get>(mirror, 0.01,
+ *     options::exact_match("/get"),
+ *     options::methods("GET")
+ * );
+ * \endcode
+ *
+ * \attention url_fetcher's event loop must be run by it's own thread, not by thevoid's workers.
+ *
+ * \sa server::on_mirrored
+ */
+class traffic_mirror : public std::enable_shared_from_this<traffic_mirror>
+{
+public:
+	/*!
+	 * \brief Constructs mirror which sends requests by \a fetcher to \a upstream.
+	 *
+	 * \a upstream is a prefix like "http://host:port" the original url's path and query are appended to.
+	 */
+	traffic_mirror(swarm::url_fetcher &fetcher, const std::string &upstream) :
+		m_fetcher(fetcher),
+		m_upstream(upstream),
+		m_max_in_flight(64),
+		m_max_queued_bytes(16 * 1024 * 1024),
+		m_body_limit(1024 * 1024),
+		m_timeout(5000),
+		m_in_flight(0),
+		m_queued_bytes(0),
+		m_mirrored(0),
+		m_failed(0),
+		m_dropped(0),
+		m_total_time(0)
+	{
+	}
+
+	/*!
+	 * \brief Sets the maximum number of simultaneously mirrored requests to \a max_in_flight.
+	 *
+	 * By default this property is set to 64.
+	 */
+	void set_max_in_flight(size_t max_in_flight)
+	{
+		m_max_in_flight = max_in_flight;
+	}
+
+	/*!
+	 * \brief Sets the maximum size of data kept by all mirrored requests to \a max_queued_bytes.
+	 *
+	 * By default this property is set to 16 megabytes.
+	 */
+	void set_max_queued_bytes(size_t max_queued_bytes)
+	{
+		m_max_queued_bytes = max_queued_bytes;
+	}
+
+	/*!
+	 * \brief Sets the maximum size of the request body to \a body_limit, larger requests are not mirrored.
+	 *
+	 * By default this property is set to 1 megabyte.
+	 */
+	void set_body_limit(size_t body_limit)
+	{
+		m_body_limit = body_limit;
+	}
+
+	/*!
+	 * \brief Sets \a timeout milliseconds as the timeout of mirrored requests.
+	 *
+	 * By default this property is set to 5000 milliseconds.
+	 */
+	void set_timeout(long timeout)
+	{
+		m_timeout = timeout;
+	}
+
+	size_t body_limit() const
+	{
+		return m_body_limit;
+	}
+
+	/*!
+	 * \brief Returns the number of mirrored requests being processed right now.
+	 */
+	size_t in_flight() const
+	{
+		return m_in_flight;
+	}
+
+	/*!
+	 * \brief Returns the size of data kept by mirrored requests right now.
+	 */
+	size_t queued_bytes() const
+	{
+		return m_queued_bytes;
+	}
+
+	/*!
+	 * \brief Returns the number of finished mirrored requests.
+	 */
+	size_t mirrored() const
+	{
+		return m_mirrored;
+	}
+
+	/*!
+	 * \brief Returns the number of mirrored requests finished with an error.
+	 */
+	size_t failed() const
+	{
+		return m_failed;
+	}
+
+	/*!
+	 * \brief Returns the number of sampled requests which were not mirrored because of the limits.
+	 */
+	size_t dropped() const
+	{
+		return m_dropped;
+	}
+
+	/*!
+	 * \brief Returns the average time of mirrored requests in microseconds.
+	 */
+	size_t average_time() const
+	{
+		const size_t count = m_mirrored;
+		return count ? m_total_time / count : 0;
+	}
+
+	/*!
+	 * \internal
+	 *
+	 * Takes the slot for new mirrored request, returns false if there is no free one.
+	 */
+	bool acquire()
+	{
+		size_t current = m_in_flight;
+		do {
+			if (current >= m_max_in_flight) {
+				++m_dropped;
+				return false;
+			}
+		} while (!m_in_flight.compare_exchange_weak(current, current + 1));
+
+		return true;
+	}
+
+	/*!
+	 * \internal
+	 *
+	 * Accounts \a size more bytes as queued, returns false if it exceeds the limit.
+	 */
+	bool reserve(size_t size)
+	{
+		size_t current = m_queued_bytes;
+		do {
+			if (current + size > m_max_queued_bytes)
+				return false;
+		} while (!m_queued_bytes.compare_exchange_weak(current, current + size));
+
+		return true;
+	}
+
+	/*!
+	 * \internal
+	 *
+	 * Releases the slot and \a size queued bytes of request which was not mirrored.
+	 */
+	void abandon(size_t size)
+	{
+		m_queued_bytes -= size;
+		--m_in_flight;
+		++m_dropped;
+	}
+
+	/*!
+	 * \internal
+	 *
+	 * Builds mirrored request from the client's one \a req.
+	 */
+	swarm::url_fetcher::request make_request(const swarm::http_request &req) const
+	{
+		swarm::url_fetcher::request request;
+		request.set_url(m_upstream + req.url().original());
+		request.set_method(req.method());
+		request.set_timeout(m_timeout);
+		proxy_copy_headers(req.headers(), request.headers());
+		request.headers().remove("Host");
+		request.headers().remove("Content-Length");
+
+		return request;
+	}
+
+	/*!
+	 * \internal
+	 *
+	 * Sends \a request with \a body to the upstream, \a reserved bytes are released as it's finished.
+	 */
+	void send(swarm::url_fetcher::request &&request, const std::shared_ptr<std::string> &body, size_t reserved)
+	{
+		if (!body->empty())
+			request.headers().set_content_length(body->size());
+
+		auto stream = std::make_shared<discard_stream>(shared_from_this(), body, reserved);
+		auto handle = m_fetcher.open(stream, std::move(request));
+
+		if (!body->empty())
+			handle->send_data(boost::asio::buffer(*body), std::function<void (const boost::system::error_code &)>());
+		handle->finish();
+	}
+
+private:
+	/*!
+	 * \internal
+	 *
+	 * Holds the request's data until it's sent and ignores the reply.
+	 */
+	class discard_stream : public swarm::base_stream
+	{
+	public:
+		discard_stream(const std::shared_ptr<traffic_mirror> &mirror, const std::shared_ptr<std::string> &body, size_t reserved) :
+			m_mirror(mirror), m_body(body), m_reserved(reserved), m_code(0),
+			m_begin(std::chrono::steady_clock::now())
+		{
+		}
+
+		void on_headers(swarm::url_fetcher::response &&response)
+		{
+			m_code = response.code();
+		}
+
+		void on_data(const boost::asio::const_buffer &)
+		{
+		}
+
+		void on_close(const boost::system::error_code &error)
+		{
+			const auto end = std::chrono::steady_clock::now();
+			const size_t time = std::chrono::duration_cast<std::chrono::microseconds>(end - m_begin).count();
+
+			m_mirror->m_total_time += time;
+			++m_mirror->m_mirrored;
+			if (error || m_code >= 500)
+				++m_mirror->m_failed;
+
+			m_body.reset();
+			m_mirror->m_queued_bytes -= m_reserved;
+			--m_mirror->m_in_flight;
+		}
+
+	private:
+		std::shared_ptr<traffic_mirror> m_mirror;
+		std::shared_ptr<std::string> m_body;
+		size_t m_reserved;
+		int m_code;
+		std::chrono::steady_clock::time_point m_begin;
+	};
+
+	swarm::url_fetcher &m_fetcher;
+	std::string m_upstream;
+	size_t m_max_in_flight;
+	size_t m_max_queued_bytes;
+	size_t m_body_limit;
+	long m_timeout;
+	std::atomic<size_t> m_in_flight;
+	std::atomic<size_t> m_queued_bytes;
+	std::atomic<size_t> m_mirrored;
+	std::atomic<size_t> m_failed;
+	std::atomic<size_t> m_dropped;
+	std::atomic<size_t> m_total_time;
+};
+
+/*!
+ * \internal
+ *
+ * \brief The mirror_request_stream class passes all events to the real handler and copies the request to the mirror.
+ *
+ * Only the data consumed by the handler is copied, so flow control of the handler is kept.
+ */
+class mirror_request_stream : public base_request_stream
+{
+public:
+	mirror_request_stream(const std::shared_ptr<base_request_stream> &stream, const std::shared_ptr<traffic_mirror> &mirror) :
+		m_stream(stream), m_mirror(mirror), m_request(boost::none), m_reserved(0), m_active(true)
+	{
+	}
+
+	~mirror_request_stream()
+	{
+		if (m_active)
+			m_mirror->abandon(m_reserved);
+	}
+
+	void on_headers(swarm::http_request &&req)
+	{
+		m_request = m_mirror->make_request(req);
+		m_body = std::make_shared<std::string>();
+
+		const auto content_length = req.headers().content_length();
+		if (content_length && *content_length > m_mirror->body_limit())
+			abandon();
+		else
+			reserve(headers_size(m_request.headers()));
+
+		m_stream->initialize(get_reply());
+		m_stream->on_headers(std::move(req));
+	}
+
+	size_t on_data(const boost::asio::const_buffer &buffer)
+	{
+		const size_t processed = m_stream->on_data(buffer);
+
+		if (m_active && processed > 0) {
+			if (m_body->size() + processed > m_mirror->body_limit() || !reserve(processed))
+				abandon();
+			else
+				m_body->append(boost::asio::buffer_cast<const char *>(buffer), processed);
+		}
+
+		return processed;
+	}
+
+	void on_close(const boost::system::error_code &err)
+	{
+		m_stream->on_close(err);
+
+		if (!m_active)
+			return;
+
+		if (err) {
+			abandon();
+			return;
+		}
+
+		m_active = false;
+		m_mirror->send(std::move(m_request), m_body, m_reserved);
+		m_body.reset();
+	}
+
+private:
+	static size_t headers_size(const swarm::http_headers &headers)
+	{
+		size_t size = 0;
+		const auto &all = headers.all();
+		for (auto it = all.begin(); it != all.end(); ++it)
+			size += it->first.size() + it->second.size();
+		return size;
+	}
+
+	bool reserve(size_t size)
+	{
+		if (!m_mirror->reserve(size)) {
+			abandon();
+			return false;
+		}
+
+		m_reserved += size;
+		return true;
+	}
+
+	void abandon()
+	{
+		if (!m_active)
+			return;
+
+		m_active = false;
+		m_body.reset();
+		m_mirror->abandon(m_reserved);
+		m_reserved = 0;
+	}
+
+	std::shared_ptr<base_request_stream> m_stream;
+	std::shared_ptr<traffic_mirror> m_mirror;
+	swarm::url_fetcher::request m_request;
+	std::shared_ptr<std::string> m_body;
+	size_t m_reserved;
+	bool m_active;
+};
+
+/*!
+ * \internal
+ *
+ * \brief The mirror_stream_factory class creates handlers of type \a T and mirrors \a rate part of them.
+ *
+ * Requests which are not sampled are handled by \a T directly without any overhead.
+ */
+template <typename Server, typename T>
+class mirror_stream_factory : public stream_factory<Server, T>
+{
+public:
+	mirror_stream_factory(const std::shared_ptr<traffic_mirror> &mirror, double rate) :
+		m_mirror(mirror), m_rate(rate), m_counter(0)
+	{
+	}
+
+	std::shared_ptr<base_request_stream> create(const std::shared_ptr<base_server> &server) /*override*/
+	{
+		auto stream = stream_factory<Server, T>::create(server);
+
+		if (!sample() || !m_mirror->acquire())
+			return stream;
+
+		return std::make_shared<mirror_request_stream>(stream, m_mirror);
+	}
+
+private:
+	/*
+	 * Deterministic sampling, exactly rate part of requests is chosen
+	 */
+	bool sample()
+	{
+		if (m_rate <= 0)
+			return false;
+		if (m_rate >= 1)
+			return true;
+
+		const unsigned long index = m_counter++;
+		return std::floor((index + 1) * m_rate) > std::floor(index * m_rate);
+	}
+
+	std::shared_ptr<traffic_mirror> m_mirror;
+	const double m_rate;
+	std::atomic<unsigned long> m_counter;
+};
+
+}} // namespace ioremap::thevoid
+
+#endif // IOREMAP_THEVOID_MIRROR_HPP
@@ -21,6 +21,12 @@
 #include "rapidjson/prettywriter.h"
 
 #include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <limits>
+#include <sys/time.h>
 
 namespace ioremap {
 namespace thevoid {
@@ -47,25 +53,66 @@ void monitor_connection::start(const std::shared_ptr<base_server> &server)
 	async_read();
 }
 
-std::string monitor_connection::get_information()
+/*
+ * Parses the number argument of the command like "r 20", returns zero if there is no one.
+ */
+static size_t parse_argument(const char *data, size_t size)
+{
+	size_t result = 0;
+	for (size_t i = 1; i < size; ++i) {
+		if (isdigit(data[i]))
+			result = result * 10 + (data[i] - '0');
+		else if (result)
+			break;
+	}
+	return result;
+}
+
+static bool inflight_request_older(const inflight_request_info &first, const inflight_request_info &second)
+{
+	return timercmp(&first.start, &second.start, <);
+}
+
+std::string monitor_connection::get_requests(size_t limit)
 {
-	auto server_statistics = m_server->get_statistics();
+	const auto &registries = m_server->m_data->inflight_registries;
+
+	std::vector<inflight_request_info> requests;
+	for (size_t i = 0; i < registries.size(); ++i)
+		registries[i]->collect(i, requests);
+
+	limit = std::min(limit, requests.size());
+	std::partial_sort(requests.begin(), requests.begin() + limit, requests.end(), inflight_request_older);
+
+	timeval now;
+	gettimeofday(&now, NULL);
 
 	rapidjson::MemoryPoolAllocator<> allocator;
 	rapidjson::Value information;
 	information.SetObject();
 
-	information.AddMember("connections", int(m_server->m_data->connections_counter), allocator);
-	information.AddMember("active-connections", int(m_server->m_data->active_connections_counter), allocator);
-
-	rapidjson::Value application;
-	application.SetObject();
-
-	for (auto it = server_statistics.begin(); it != server_statistics.end(); ++it) {
-		application.AddMember(it->first.c_str(), it->second.c_str(), allocator);
+	information.AddMember("total", uint64_t(requests.size()), allocator);
+
+	rapidjson::Value list;
+	list.SetArray();
+
+	for (size_t i = 0; i < limit; ++i) {
+		const inflight_request_info &info = requests[i];
+		const long long time = 1000000ll * (now.tv_sec - info.start.tv_sec) + now.tv_usec - info.start.tv_usec;
+
+		rapidjson::Value request;
+		request.SetObject();
+		request.AddMember("worker", uint64_t(info.worker), allocator);
+		request.AddMember("method", info.method.c_str(), allocator);
+		request.AddMember("url", info.url.c_str(), allocator);
+		request.AddMember("time", int64_t(time), allocator);
+		request.AddMember("phase", inflight_registry::phase_name(info.phase), allocator);
+		request.AddMember("received", uint64_t(info.received), allocator);
+		request.AddMember("sent", uint64_t(info.sent), allocator);
+		list.PushBack(request, allocator);
 	}
 
-	information.AddMember("application", application, allocator);
+	information.AddMember("requests", list, allocator);
 
 	rapidjson::StringBuffer buffer;
 	rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
@@ -93,8 +140,31 @@ void monitor_connection::handle_read(const boost::system::error_code &err, std::
 
 	switch (m_buffer[0]) {
 		case 'i': case 'I':
-			async_write(get_information());
+			async_write(m_server->m_data->snapshot->information(true));
 			break;
+		case 'c': case 'C':
+			async_write(m_server->m_data->snapshot->information(false));
+			break;
+		case 'r': case 'R': {
+			const size_t limit = parse_argument(m_buffer.data(), bytes_transferred);
+			async_write(get_requests(limit ? limit : 10));
+			break;
+		}
+		case 't': case 'T': {
+			auto &data = *m_server->m_data;
+			const size_t count = parse_argument(m_buffer.data(), bytes_transferred);
+			std::string result;
+			try {
+				if (count)
+					data.set_threads_count(std::min<size_t>(count, std::numeric_limits<unsigned int>::max()));
+				result = "Workers: " + boost::lexical_cast<std::string>(data.threads_count)
+					+ " of " + boost::lexical_cast<std::string>(data.max_threads_count) + "\n";
+			} catch (std::exception &e) {
+				result = std::string("Failed to change number of workers: ") + e.what() + "\n";
+			}
+			async_write(result);
+			break;
+		}
 		case 's': case 'S': {
 			const char *result = "Stopping...\n";
 			boost::asio::async_write(m_socket, boost::asio::buffer(result, strlen(result)),
@@ -105,6 +175,9 @@ void monitor_connection::handle_read(const boost::system::error_code &err, std::
 		default:
 		case 'h': case 'H':
 			async_write("i - statistics information\n"
+				    "c - statistics information in compact form\n"
+				    "r [N] - N oldest requests being processed, 10 by default\n"
+				    "t [N] - change number of workers to N, show it if N is omitted\n"
 				    "s - stop server\n"
 				    "h - this help message\n");
 			break;
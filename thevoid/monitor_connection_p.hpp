@@ -37,7 +37,7 @@ public:
 	void start(const std::shared_ptr<base_server> &server);
 
 protected:
-	std::string get_information();
+	std::string get_requests(size_t limit);
 	void async_read();
 	void handle_read(const boost::system::error_code &err, std::size_t bytes_transferred);
 	void async_write(const std::string &data);
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "monitor_snapshot_p.hpp"
+#include "server_p.hpp"
+
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+#include "rapidjson/prettywriter.h"
+
+#include <ctime>
+
+namespace ioremap {
+namespace thevoid {
+
+monitor_snapshot::monitor_snapshot(server_data &data) :
+	m_data(data),
+	m_timer(data.monitor_io_service),
+	m_interval(1000),
+	m_built(false),
+	m_current(0)
+{
+}
+
+void monitor_snapshot::set_interval(long milliseconds)
+{
+	m_interval = std::max(0l, milliseconds);
+}
+
+void monitor_snapshot::start()
+{
+	if (m_interval > 0)
+		schedule();
+}
+
+const std::string &monitor_snapshot::information(bool pretty)
+{
+	if (!m_built || m_interval == 0)
+		build();
+
+	return pretty ? m_pretty[m_current] : m_compact[m_current];
+}
+
+void monitor_snapshot::schedule()
+{
+	m_timer.expires_from_now(boost::posix_time::milliseconds(m_interval));
+	m_timer.async_wait(std::bind(&monitor_snapshot::on_timer, this, std::placeholders::_1));
+}
+
+void monitor_snapshot::on_timer(const boost::system::error_code &err)
+{
+	if (err)
+		return;
+
+	build();
+	schedule();
+}
+
+template <typename Writer>
+static void render(const rapidjson::Value &information, std::string &result)
+{
+	rapidjson::StringBuffer buffer;
+	Writer writer(buffer);
+
+	information.Accept(writer);
+	buffer.Put('\n');
+
+	result.assign(buffer.GetString(), buffer.Size());
+}
+
+void monitor_snapshot::build()
+{
+	rapidjson::MemoryPoolAllocator<> allocator;
+	rapidjson::Value information;
+	information.SetObject();
+
+	information.AddMember("timestamp", uint64_t(time(NULL)), allocator);
+	information.AddMember("connections", int(m_data.connections_counter), allocator);
+	information.AddMember("active-connections", int(m_data.active_connections_counter), allocator);
+	information.AddMember("threads", uint64_t(m_data.threads_count), allocator);
+	information.AddMember("max-threads", uint64_t(m_data.max_threads_count), allocator);
+
+	if (m_data.watchdog)
+		m_data.watchdog->fill_information(information, allocator);
+
+	const statistics_segment &segment = *m_data.statistics;
+
+	// Names are temporary strings, so they are copied by the allocator
+	rapidjson::Value counters;
+	counters.SetObject();
+	for (size_t i = 0; i < segment.counters_count(); ++i) {
+		const std::string name = segment.counter_name(i);
+		rapidjson::Value name_value(name.c_str(), name.size(), allocator);
+		rapidjson::Value counter_value(uint64_t(segment.counter_value(i)));
+		counters.AddMember(name_value, counter_value, allocator);
+	}
+
+	rapidjson::Value histograms_value;
+	histograms_value.SetObject();
+	for (size_t i = 0; i < segment.histograms_count(); ++i) {
+		const statistics_segment::histogram_info info = segment.histogram_value(i);
+
+		rapidjson::Value histogram_value;
+		histogram_value.SetObject();
+		histogram_value.AddMember("count", uint64_t(info.count), allocator);
+		histogram_value.AddMember("sum", uint64_t(info.sum), allocator);
+
+		// Bucket i counts values less than 2^i, trailing empty buckets are omitted
+		size_t buckets_count = info.buckets.size();
+		while (buckets_count > 0 && info.buckets[buckets_count - 1] == 0)
+			--buckets_count;
+
+		rapidjson::Value buckets;
+		buckets.SetArray();
+		for (size_t j = 0; j < buckets_count; ++j)
+			buckets.PushBack(uint64_t(info.buckets[j]), allocator);
+		histogram_value.AddMember("buckets", buckets, allocator);
+
+		rapidjson::Value name_value(info.name.c_str(), info.name.size(), allocator);
+		histograms_value.AddMember(name_value, histogram_value, allocator);
+	}
+
+	rapidjson::Value statistics;
+	statistics.SetObject();
+	statistics.AddMember("counters", counters, allocator);
+	statistics.AddMember("histograms", histograms_value, allocator);
+	information.AddMember("statistics", statistics, allocator);
+
+	std::map<std::string, std::string> server_statistics;
+	if (auto server = m_data.server.lock())
+		server_statistics = server->get_statistics();
+
+	rapidjson::Value application;
+	application.SetObject();
+
+	for (auto it = server_statistics.begin(); it != server_statistics.end(); ++it) {
+		application.AddMember(it->first.c_str(), it->second.c_str(), allocator);
+	}
+
+	information.AddMember("application", application, allocator);
+
+	const size_t next = 1 - m_current;
+	render<rapidjson::Writer<rapidjson::StringBuffer>>(information, m_compact[next]);
+	render<rapidjson::PrettyWriter<rapidjson::StringBuffer>>(information, m_pretty[next]);
+
+	m_current = next;
+	m_built = true;
+}
+
+}} // namespace ioremap::thevoid
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOREMAP_THEVOID_MONITOR_SNAPSHOT_P_HPP
+#define IOREMAP_THEVOID_MONITOR_SNAPSHOT_P_HPP
+
+#include "server.hpp"
+#include <boost/asio/deadline_timer.hpp>
+
+namespace ioremap {
+namespace thevoid {
+
+class server_data;
+
+/*!
+ * \internal
+ *
+ * Statistics of the server rendered for the monitor.
+ *
+ * Statistics are rendered every interval to the back buffers, which are swapped with
+ * the front ones after that, so monitor requests only copy the latest rendered string
+ * and frequent scrapes don't make application to collect it's statistics.
+ * All methods must be called from the monitor thread, so there is no need in locks.
+ */
+class monitor_snapshot
+{
+public:
+	monitor_snapshot(server_data &data);
+
+	/*!
+	 * Zero interval means that statistics are rendered for every request.
+	 */
+	void set_interval(long milliseconds);
+
+	void start();
+
+	/*!
+	 * Returns the latest rendered statistics, renders them if there are no ones yet.
+	 */
+	const std::string &information(bool pretty);
+
+private:
+	void schedule();
+	void on_timer(const boost::system::error_code &err);
+	void build();
+
+	server_data &m_data;
+	boost::asio::deadline_timer m_timer;
+	long m_interval;
+	bool m_built;
+	size_t m_current;
+	std::string m_compact[2];
+	std::string m_pretty[2];
+};
+
+}} // namespace ioremap::thevoid
+
+#endif // IOREMAP_THEVOID_MONITOR_SNAPSHOT_P_HPP
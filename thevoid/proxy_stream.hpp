@@ -0,0 +1,506 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOREMAP_THEVOID_PROXY_STREAM_HPP
+#define IOREMAP_THEVOID_PROXY_STREAM_HPP
+
+#include "stream.hpp"
+#include <swarm/urlfetcher/url_fetcher.hpp>
+
+#include <mutex>
+#include <string.h>
+#include <strings.h>
+
+namespace ioremap {
+namespace thevoid {
+
+/*!
+ * \internal
+ *
+ * \brief Returns true if header \a name must not be forwarded by proxy.
+ *
+ * Hop-by-hop headers are listed by RFC 2616, section 13.5.1, additional ones are
+ * passed by the value of Connection header \a connection.
+ */
+inline bool proxy_is_hop_by_hop(const std::string &name, const boost::optional<std::string> &connection)
+{
+	static const char *headers[] = {
+		"Connection",
+		"Keep-Alive",
+		"Proxy-Authenticate",
+		"Proxy-Authorization",
+		"Proxy-Connection",
+		"TE",
+		"Trailer",
+		"Trailers",
+		"Transfer-Encoding",
+		"Upgrade"
+	};
+
+	for (size_t i = 0; i < sizeof(headers) / sizeof(headers[0]); ++i) {
+		if (strcasecmp(name.c_str(), headers[i]) == 0)
+			return true;
+	}
+
+	if (!connection)
+		return false;
+
+	const std::string &tokens = *connection;
+	for (size_t begin = 0; begin < tokens.size();) {
+		size_t end = tokens.find(',', begin);
+		if (end == std::string::npos)
+			end = tokens.size();
+
+		size_t first = begin;
+		size_t last = end;
+		while (first < last && isspace(tokens[first]))
+			++first;
+		while (first < last && isspace(tokens[last - 1]))
+			--last;
+
+		if (last - first == name.size() && strncasecmp(name.c_str(), tokens.c_str() + first, name.size()) == 0)
+			return true;
+
+		begin = end + 1;
+	}
+
+	return false;
+}
+
+/*!
+ * \internal
+ *
+ * \brief Copies end-to-end headers from \a source to \a destination.
+ */
+inline void proxy_copy_headers(const swarm::http_headers &source, swarm::http_headers &destination)
+{
+	const auto connection = source.connection();
+	const auto &headers = source.all();
+
+	for (auto it = headers.begin(); it != headers.end(); ++it) {
+		if (!proxy_is_hop_by_hop(it->first, connection))
+			destination.add(*it);
+	}
+}
+
+/*!
+ * \internal
+ *
+ * \brief The proxy_bridge class passes data between reply_stream of the client and the upstream request.
+ *
+ * It's shared by proxy_request_stream and url_fetcher, so it's alive until both sides are finished.
+ * Methods are called both from the thevoid's worker thread and from url_fetcher's event loop thread.
+ */
+class proxy_bridge : public swarm::base_stream, public std::enable_shared_from_this<proxy_bridge>
+{
+public:
+	typedef std::function<void (const boost::system::error_code &err)> handler_type;
+
+	proxy_bridge(const std::shared_ptr<reply_stream> &reply, size_t buffer_limit) :
+		m_reply(reply),
+		m_buffer_limit(buffer_limit),
+		m_upload_pending(0),
+		m_upload_blocked(false),
+		m_reply_pending(0),
+		m_reply_writes(0),
+		m_reply_paused(false),
+		m_headers_sent(false),
+		m_close_delimited(false),
+		m_head_request(false),
+		m_upstream_closed(false),
+		m_client_closed(false),
+		m_finished(false)
+	{
+	}
+
+	void start(swarm::url_fetcher &fetcher, swarm::url_fetcher::request &&request)
+	{
+		m_head_request = (request.method() == "HEAD");
+		auto handle = fetcher.open(shared_from_this(), std::move(request));
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_handle = handle;
+	}
+
+	/*!
+	 * Passes chunk of the client's request body to upstream.
+	 * Returns 0 if there is already too much data in flight, want_more is called once it's sent.
+	 */
+	size_t on_client_data(const boost::asio::const_buffer &buffer)
+	{
+		const size_t size = boost::asio::buffer_size(buffer);
+		std::shared_ptr<swarm::request_handle> handle;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_finished || !m_handle)
+				return size;
+
+			if (m_upload_pending >= m_buffer_limit) {
+				m_upload_blocked = true;
+				return 0;
+			}
+
+			m_upload_pending += size;
+			handle = m_handle;
+		}
+
+		// Connection's buffer is reused for the next read, so the data has to be copied
+		auto data = std::make_shared<std::string>(boost::asio::buffer_cast<const char *>(buffer), size);
+		handle->send_data(boost::asio::buffer(*data), std::bind(&proxy_bridge::on_upload_sent,
+			shared_from_this(), data, std::placeholders::_1));
+
+		return size;
+	}
+
+	void on_client_close(const boost::system::error_code &err)
+	{
+		std::shared_ptr<swarm::request_handle> handle;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (err)
+				m_client_closed = true;
+			handle = m_handle;
+		}
+
+		if (!handle)
+			return;
+
+		if (err)
+			handle->cancel();
+		else
+			handle->finish();
+	}
+
+protected:
+	virtual void on_headers(swarm::url_fetcher::response &&response)
+	{
+		// Code is zero if upstream was not reached at all, on_close will send the error
+		if (response.code() == 0)
+			return;
+
+		swarm::http_response reply;
+		reply.set_code(response.code());
+		proxy_copy_headers(response.headers(), reply.headers());
+
+		const int code = response.code();
+		const bool has_body = !m_head_request && code >= 200 && code != 204 && code != 304;
+
+		std::shared_ptr<reply_stream> reply_stream;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_client_closed || m_finished)
+				return;
+
+			// Connection must be closed to mark the end of the body of unknown length
+			m_close_delimited = has_body && !reply.headers().content_length();
+			m_headers_sent = true;
+			++m_reply_writes;
+			reply_stream = m_reply;
+		}
+
+		reply_stream->send_headers(std::move(reply), boost::asio::const_buffer(), std::bind(&proxy_bridge::on_reply_sent,
+			shared_from_this(), std::shared_ptr<std::string>(), std::placeholders::_1));
+	}
+
+	virtual void on_data(const boost::asio::const_buffer &buffer)
+	{
+		const size_t size = boost::asio::buffer_size(buffer);
+		std::shared_ptr<reply_stream> reply_stream;
+		std::shared_ptr<swarm::request_handle> handle;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_client_closed || m_finished || !m_headers_sent)
+				return;
+
+			++m_reply_writes;
+			m_reply_pending += size;
+			reply_stream = m_reply;
+
+			if (m_reply_pending >= m_buffer_limit && !m_reply_paused) {
+				m_reply_paused = true;
+				handle = m_handle;
+			}
+		}
+
+		auto data = std::make_shared<std::string>(boost::asio::buffer_cast<const char *>(buffer), size);
+		reply_stream->send_data(boost::asio::buffer(*data), std::bind(&proxy_bridge::on_reply_sent,
+			shared_from_this(), data, std::placeholders::_1));
+
+		if (handle)
+			handle->pause();
+	}
+
+	virtual void on_close(const boost::system::error_code &error)
+	{
+		bool finish = false;
+		bool send_error = false;
+		std::shared_ptr<reply_stream> reply_stream;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_upstream_closed = true;
+			m_upstream_error = error;
+			m_handle.reset();
+
+			if (m_finished)
+				return;
+
+			if (m_client_closed) {
+				m_finished = true;
+				m_reply.reset();
+				return;
+			}
+
+			if (!m_headers_sent) {
+				m_finished = true;
+				send_error = true;
+				reply_stream = std::move(m_reply);
+			} else if (m_reply_writes == 0) {
+				finish = true;
+			}
+		}
+
+		if (send_error) {
+			if (swarm::url_fetcher::is_timeout(error)) {
+				reply_stream->send_error(swarm::http_response::gateway_timeout);
+			} else {
+				reply_stream->send_error(swarm::http_response::bad_gateway);
+			}
+		} else if (finish) {
+			finish_reply();
+		}
+	}
+
+private:
+	void on_upload_sent(const std::shared_ptr<std::string> &data, const boost::system::error_code &err)
+	{
+		std::shared_ptr<reply_stream> reply_stream;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_upload_pending -= data->size();
+
+			if (!err && m_upload_blocked && m_upload_pending < m_buffer_limit && !m_finished) {
+				m_upload_blocked = false;
+				reply_stream = m_reply;
+			}
+		}
+
+		if (reply_stream)
+			reply_stream->want_more();
+	}
+
+	void on_reply_sent(const std::shared_ptr<std::string> &data, const boost::system::error_code &err)
+	{
+		bool finish = false;
+		std::shared_ptr<swarm::request_handle> cancel;
+		std::shared_ptr<swarm::request_handle> resume;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			--m_reply_writes;
+			if (data)
+				m_reply_pending -= data->size();
+
+			if (err) {
+				// Client is gone, there is no reason to continue the upstream request
+				m_client_closed = true;
+				cancel = m_handle;
+			} else if (m_reply_paused && m_reply_pending < m_buffer_limit / 2) {
+				m_reply_paused = false;
+				resume = m_handle;
+			}
+
+			if (m_upstream_closed && m_reply_writes == 0 && !m_finished)
+				finish = !m_client_closed;
+		}
+
+		if (cancel)
+			cancel->cancel();
+		if (resume)
+			resume->resume();
+		if (finish)
+			finish_reply();
+	}
+
+	void finish_reply()
+	{
+		std::shared_ptr<reply_stream> reply_stream;
+		boost::system::error_code error;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_finished)
+				return;
+
+			m_finished = true;
+			reply_stream = std::move(m_reply);
+			error = m_upstream_error;
+
+			if (!error && m_close_delimited)
+				error = boost::asio::error::eof;
+		}
+
+		reply_stream->close(error);
+	}
+
+	std::mutex m_mutex;
+	std::shared_ptr<reply_stream> m_reply;
+	std::shared_ptr<swarm::request_handle> m_handle;
+	const size_t m_buffer_limit;
+	size_t m_upload_pending;
+	bool m_upload_blocked;
+	size_t m_reply_pending;
+	size_t m_reply_writes;
+	bool m_reply_paused;
+	bool m_headers_sent;
+	bool m_close_delimited;
+	bool m_head_request;
+	bool m_upstream_closed;
+	bool m_client_closed;
+	bool m_finished;
+	boost::system::error_code m_upstream_error;
+};
+
+/*!
+ * \brief The proxy_request_stream class forwards requests to the upstream server by url_fetcher.
+ *
+ * Body of the request is streamed to the upstream as soon as it's received from the client
+ * and the reply is streamed back the same way, so nothing is buffered as a whole.
+ *
+ * Both directions are flow-controlled: reading from the client is suspended while more than
+ * buffer_limit bytes are waiting for the upstream, and receiving from the upstream is paused
+ * while more than buffer_limit bytes are waiting to be sent to the client.
+ *
+ * If the client disconnects the upstream request is cancelled. Hop-by-hop headers
+ * (Connection, Keep-Alive, Transfer-Encoding, etc. and ones listed by Connection header)
+ * are not forwarded in both directions. If upstream is not available the client receives
+ * 502 Bad Gateway or 504 Gateway Timeout.
+ *
+ * \code{.cpp}
+ * struct on_proxy : public thevoid::proxy_request_stream<http_server>
+ * {
+ *     swarm::url_fetcher &fetcher() {
+ *         return server()->fetcher();
+ *     }
+ *
+ *     swarm::url upstream_url(const swarm::http_request &req) {
+ *         return swarm::url("http://localhost:8081" + req.url().original());
+ *     }
+ * };
+ * \endcode
+ *
+ * \attention url_fetcher's event loop must be run by it's own thread, not by thevoid's workers.
+ */
+template <typename Server>
+class proxy_request_stream : public request_stream<Server>
+{
+public:
+	proxy_request_stream() : m_buffer_limit(1024 * 1024)
+	{
+	}
+
+	~proxy_request_stream()
+	{
+		if (m_bridge)
+			m_bridge->on_client_close(boost::asio::error::operation_aborted);
+	}
+
+	/*!
+	 * \brief Returns url fetcher the request is forwarded by.
+	 */
+	virtual swarm::url_fetcher &fetcher() = 0;
+	/*!
+	 * \brief Returns url of the upstream the request \a req is forwarded to.
+	 */
+	virtual swarm::url upstream_url(const swarm::http_request &req) = 0;
+	/*!
+	 * \brief Makes possible to modify upstream's \a request before it's sent.
+	 *
+	 * Original client's request is available by \a req.
+	 * Use it to set timeouts or add headers like X-Forwarded-For.
+	 */
+	virtual void prepare_request(const swarm::http_request &req, swarm::url_fetcher::request &request)
+	{
+		(void) req;
+		(void) request;
+	}
+
+protected:
+	/*!
+	 * \brief Sets the limit of buffered data in each direction to \a buffer_limit bytes.
+	 *
+	 * It must be called before the request is started, default limit is 1 megabyte.
+	 */
+	void set_buffer_limit(size_t buffer_limit)
+	{
+		m_buffer_limit = buffer_limit;
+	}
+
+	/*!
+	 * \brief Returns the limit of buffered data in each direction.
+	 */
+	size_t buffer_limit() const
+	{
+		return m_buffer_limit;
+	}
+
+private:
+	/*!
+	 * \internal
+	 */
+	void on_headers(swarm::http_request &&req)
+	{
+		swarm::url_fetcher::request request;
+		request.set_url(upstream_url(req));
+		request.set_method(req.method());
+		proxy_copy_headers(req.headers(), request.headers());
+		// Curl sets Host by the upstream's url
+		request.headers().remove("Host");
+
+		prepare_request(req, request);
+
+		m_bridge = std::make_shared<proxy_bridge>(this->get_reply(), m_buffer_limit);
+		m_bridge->start(fetcher(), std::move(request));
+	}
+
+	/*!
+	 * \internal
+	 */
+	size_t on_data(const boost::asio::const_buffer &buffer)
+	{
+		return m_bridge->on_client_data(buffer);
+	}
+
+	/*!
+	 * \internal
+	 */
+	void on_close(const boost::system::error_code &err)
+	{
+		if (auto bridge = std::move(m_bridge))
+			bridge->on_client_close(err);
+	}
+
+	size_t m_buffer_limit;
+	std::shared_ptr<proxy_bridge> m_bridge;
+};
+
+}} // namespace ioremap::thevoid
+
+#endif // IOREMAP_THEVOID_PROXY_STREAM_HPP
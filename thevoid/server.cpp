@@ -21,8 +21,14 @@
 #include <boost/program_options.hpp>
 
 #include <vector>
+#include <limits>
+#include <algorithm>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
 #include <boost/thread.hpp>
 #include <pthread.h>
+#include <sched.h>
 #include <functional>
 #include <iostream>
 
@@ -48,11 +54,33 @@ class server_data;
 
 static std::weak_ptr<signal_handler> global_signal_set;
 
+//! Worker the thread runs, it's set for the whole life of the worker's thread
+struct worker_context
+{
+	server_data *data;
+	size_t index;
+};
+
+static pthread_key_t worker_context_key;
+static pthread_once_t worker_context_key_once = PTHREAD_ONCE_INIT;
+
+static void create_worker_context_key()
+{
+	pthread_key_create(&worker_context_key, NULL);
+}
+
+static std::atomic_size_t local_types_count(0);
+
 server_data::server_data() :
 	connections_counter(0),
 	active_connections_counter(0),
+	stopped(false),
+	watchdog(new worker_watchdog(*this)),
+	snapshot(new monitor_snapshot(*this)),
+	incoming_cpu(false),
 	threads_round_robin(0),
-	threads_count(2),
+	threads_count(0),
+	max_threads_count(0),
 	backlog_size(128),
 	buffer_size(8192),
 	local_acceptors(new acceptors_list<unix_connection>(*this)),
@@ -63,6 +91,10 @@ server_data::server_data() :
 	safe_mode(false),
 	options_parsed(false)
 {
+	std::fill_n(access_log_sample, sizeof(access_log_sample) / sizeof(access_log_sample[0]), 1.0);
+	access_log_slow_time = std::numeric_limits<unsigned long long>::max();
+	slow_log_threshold = std::numeric_limits<unsigned long long>::max();
+
 	if (!signal_set) {
 		signal_set = std::make_shared<signal_handler>();
 		global_signal_set = signal_set;
@@ -72,6 +104,20 @@ server_data::server_data() :
 	signal_set->all_servers.insert(this);
 }
 
+void server_counters::initialize(statistics_segment &segment)
+{
+	const char *status_names[] = { "status-unknown", "status-1xx", "status-2xx", "status-3xx", "status-4xx", "status-5xx" };
+
+	connections_accepted = segment.add_counter("connections-accepted");
+	connections_closed = segment.add_counter("connections-closed");
+	requests = segment.add_counter("requests");
+	for (size_t i = 0; i < sizeof(statuses) / sizeof(statuses[0]); ++i)
+		statuses[i] = segment.add_counter(status_names[i]);
+	bytes_received = segment.add_counter("bytes-received");
+	bytes_sent = segment.add_counter("bytes-sent");
+	request_time = segment.add_histogram("request-time");
+}
+
 server_data::~server_data()
 {
 	std::lock_guard<std::mutex> locker(signal_set->lock);
@@ -80,7 +126,11 @@ server_data::~server_data()
 
 void server_data::handle_stop()
 {
-	worker_works.clear();
+	std::lock_guard<std::mutex> locker(workers_lock);
+	stopped = true;
+	for (auto it = worker_works.begin(); it != worker_works.end(); ++it)
+		it->reset();
+
 	io_service.stop();
 	for (auto it = worker_io_services.begin(); it != worker_io_services.end(); ++it) {
 		(*it)->stop();
@@ -99,6 +149,15 @@ boost::asio::io_service &server_data::get_worker_service()
 	return *worker_io_services[id];
 }
 
+int server_data::worker_index(const boost::asio::io_service &service) const
+{
+	for (size_t i = 0; i < worker_io_services.size(); ++i) {
+		if (worker_io_services[i].get() == &service)
+			return i;
+	}
+	return -1;
+}
+
 void signal_handler::stop_handler(int signal_value)
 {
 	if (auto signal_set = global_signal_set.lock()) {
@@ -219,11 +278,39 @@ std::map<std::string, std::string> base_server::get_statistics() const
 	return std::map<std::string, std::string>();
 }
 
+statistics_segment &base_server::statistics()
+{
+	// Handles taken earlier would point to the segment which doesn't exist yet
+	if (!m_data->statistics)
+		throw std::logic_error("server::statistics is available only once the config is parsed, i.e. in initialize");
+	return *m_data->statistics;
+}
+
 unsigned int base_server::threads_count() const
 {
 	return m_data->threads_count;
 }
 
+size_t base_server::next_local_index()
+{
+	return local_types_count++;
+}
+
+std::shared_ptr<void> &base_server::local_slot(size_t index)
+{
+	pthread_once(&worker_context_key_once, create_worker_context_key);
+
+	auto context = static_cast<worker_context *>(pthread_getspecific(worker_context_key));
+	if (!context || context->data != m_data.get())
+		throw std::logic_error("server::local must be called by the server's worker");
+
+	auto &storage = m_data->local_storages[context->index];
+	if (index >= storage.size())
+		storage.resize(index + 1);
+
+	return storage[index];
+}
+
 bool base_server::initialize_logger(const rapidjson::Value &config)
 {
 	if (!config.HasMember("logger")) {
@@ -251,11 +338,59 @@ bool base_server::initialize_logger(const rapidjson::Value &config)
 		if (logger_config.HasMember("level"))
 			level = logger_config["level"].GetInt();
 
-		set_logger(swarm::logger(file, level));
+		if (logger_config.HasMember("buffered") && logger_config["buffered"].GetBool()) {
+			size_t buffer_size = 64 * 1024;
+			long flush_interval = 100;
+
+			if (logger_config.HasMember("buffer_size"))
+				buffer_size = logger_config["buffer_size"].GetUint();
+
+			if (logger_config.HasMember("flush_interval"))
+				flush_interval = logger_config["flush_interval"].GetInt();
+
+			set_logger(swarm::logger(new swarm::buffered_logger_interface(file, buffer_size, flush_interval), level));
+		} else {
+			set_logger(swarm::logger(file, level));
+		}
 	} else {
 		set_logger(swarm::logger("/dev/stderr", swarm::SWARM_LOG_INFO));
 		logger().log(swarm::SWARM_LOG_ERROR, "unknown logger type \"%s\", use default, possible values are: file", type.c_str());
 	}
+
+	if (logger_config.HasMember("rate_limit")) {
+		const rapidjson::Value &rate_limit = logger_config["rate_limit"];
+
+		double rate = 0;
+		double burst = 100;
+		int max_level = swarm::SWARM_LOG_ERROR;
+
+		if (rate_limit.HasMember("rate"))
+			rate = rate_limit["rate"].GetDouble();
+		if (rate_limit.HasMember("burst"))
+			burst = rate_limit["burst"].GetDouble();
+		if (rate_limit.HasMember("level"))
+			max_level = rate_limit["level"].GetInt();
+
+		m_data->logger.set_rate_limit(rate, burst, max_level);
+	}
+
+	if (logger_config.HasMember("access_log")) {
+		const rapidjson::Value &access_log = logger_config["access_log"];
+
+		if (access_log.HasMember("sample")) {
+			const rapidjson::Value &sample = access_log["sample"];
+			const char *names[] = { "unknown", "1xx", "2xx", "3xx", "4xx", "5xx" };
+
+			for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+				if (sample.HasMember(names[i]))
+					m_data->access_log_sample[i] = sample[names[i]].GetDouble();
+			}
+		}
+
+		if (access_log.HasMember("slow_time"))
+			m_data->access_log_slow_time = access_log["slow_time"].GetUint64() * 1000;
+	}
+
 	return true;
 }
 
@@ -346,20 +481,218 @@ static int read_config(rapidjson::Document &doc, const char *config_path)
 	return 0;
 }
 
+/*
+ * Parses list of CPUs like "0-3,8,10-11".
+ */
+static std::vector<int> parse_cpu_list(const std::string &list)
+{
+	std::vector<int> result;
+
+	std::istringstream in(list);
+	std::string range;
+	while (std::getline(in, range, ',')) {
+		int first = -1;
+		int last = -1;
+		char tail = 0;
+
+		const int count = sscanf(range.c_str(), "%d-%d%c", &first, &last, &tail);
+		if (count == 1)
+			last = first;
+		if ((count != 1 && count != 2) || first < 0 || last < first || last >= CPU_SETSIZE)
+			throw std::invalid_argument("invalid CPU list: \"" + list + "\"");
+
+		for (int cpu = first; cpu <= last; ++cpu)
+			result.push_back(cpu);
+	}
+
+	if (result.empty())
+		throw std::invalid_argument("empty CPU list");
+
+	return result;
+}
+
+/*
+ * Number of CPUs the process may run at, it's limited by affinity mask and cpuset.
+ */
+static unsigned int available_cpus_count()
+{
+#ifdef __linux__
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	if (sched_getaffinity(0, sizeof(cpuset), &cpuset) == 0 && CPU_COUNT(&cpuset) > 0)
+		return CPU_COUNT(&cpuset);
+#endif
+	return std::max(1u, boost::thread::hardware_concurrency());
+}
+
+static long long read_number(const char *path)
+{
+	long long result = -1;
+
+	if (FILE *file = fopen(path, "r")) {
+		if (fscanf(file, "%lld", &result) != 1)
+			result = -1;
+		fclose(file);
+	}
+
+	return result;
+}
+
+/*
+ * Number of CPUs allowed by CPU bandwidth limit of the cgroup, zero if it's not limited.
+ * Container sees it's own cgroup at the root of the hierarchy, so both cgroup v2 and v1 roots are checked.
+ */
+static unsigned int cgroup_cpus_quota()
+{
+	long long quota = -1;
+	long long period = -1;
+
+	if (FILE *file = fopen("/sys/fs/cgroup/cpu.max", "r")) {
+		char limit[32];
+		if (fscanf(file, "%31s %lld", limit, &period) == 2 && strcmp(limit, "max") != 0)
+			quota = atoll(limit);
+		fclose(file);
+	} else {
+		const char *roots[] = { "/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct" };
+
+		for (size_t i = 0; i < sizeof(roots) / sizeof(roots[0]) && quota < 0; ++i) {
+			quota = read_number((std::string(roots[i]) + "/cpu.cfs_quota_us").c_str());
+			period = read_number((std::string(roots[i]) + "/cpu.cfs_period_us").c_str());
+		}
+	}
+
+	if (quota <= 0 || period <= 0)
+		return 0;
+
+	return std::max(1ll, (quota + period - 1) / period);
+}
+
+/*
+ * Default number of workers, it's the number of CPUs the server is allowed to use.
+ */
+static unsigned int default_threads_count()
+{
+	const unsigned int cpus = available_cpus_count();
+	const unsigned int quota = cgroup_cpus_quota();
+
+	return quota ? std::min(quota, cpus) : cpus;
+}
+
 struct io_service_runner
 {
 	boost::asio::io_service *service;
 	const char *name;
+	//! Signal to unblock in the thread, zero if all signals stay blocked
+	int unblocked_signal;
+	//! CPUs the thread is pinned to, it may run anywhere if it's empty
+	std::vector<int> cpus;
+	swarm::logger logger;
+	//! Server the worker belongs to, null if the thread is not a worker
+	server_data *data;
+	size_t worker;
 
 	void operator() () const
 	{
 #ifdef __linux__
 		prctl(PR_SET_NAME, name);
+
+		if (!cpus.empty()) {
+			cpu_set_t cpuset;
+			CPU_ZERO(&cpuset);
+			for (auto it = cpus.begin(); it != cpus.end(); ++it)
+				CPU_SET(*it, &cpuset);
+
+			// Pin the thread before it allocates anything, so it's memory is local to it's NUMA node
+			if (int err = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset))
+				logger.log(swarm::SWARM_LOG_ERROR, "Failed to set CPU affinity of %s: %s", name, strerror(err));
+		}
 #endif
-		service->run();
+		if (unblocked_signal) {
+			sigset_t sigset;
+			sigemptyset(&sigset);
+			sigaddset(&sigset, unblocked_signal);
+			pthread_sigmask(SIG_UNBLOCK, &sigset, NULL);
+		}
+		worker_context context = { data, worker };
+		if (data) {
+			pthread_once(&worker_context_key_once, create_worker_context_key);
+			pthread_setspecific(worker_context_key, &context);
+		}
+
+		do {
+			service->run();
+		} while (data && data->restart_worker(worker));
 	}
 };
 
+void server_data::start_worker(size_t index)
+{
+	io_service_runner runner;
+	runner.service = worker_io_services[index].get();
+	runner.name = "void_worker";
+	runner.unblocked_signal = 0;
+	if (watchdog && watchdog->backtrace())
+		runner.unblocked_signal = worker_watchdog::backtrace_signal();
+	if (!worker_cpus.empty())
+		runner.cpus.push_back(worker_cpus[index % worker_cpus.size()]);
+	runner.logger = logger;
+	runner.data = this;
+	runner.worker = index;
+
+	worker_threads[index].reset(new boost::thread(runner));
+}
+
+bool server_data::restart_worker(size_t index)
+{
+	std::lock_guard<std::mutex> locker(workers_lock);
+
+	// The worker was retired and became active again before it's thread has exited
+	if (!stopped && index < threads_count) {
+		worker_io_services[index]->reset();
+		return true;
+	}
+
+	workers_exited[index] = true;
+	return false;
+}
+
+void server_data::set_threads_count(unsigned int count)
+{
+	if (count < 1 || count > max_threads_count) {
+		throw std::invalid_argument("threads count must be between 1 and "
+			+ boost::lexical_cast<std::string>(max_threads_count));
+	}
+
+	std::lock_guard<std::mutex> locker(workers_lock);
+
+	if (stopped)
+		throw std::invalid_argument("server is stopped");
+
+	const unsigned int previous_count = threads_count;
+
+	for (unsigned int i = previous_count; i < count; ++i) {
+		worker_works[i].reset(new boost::asio::io_service::work(*worker_io_services[i]));
+
+		if (!worker_threads[i]) {
+			start_worker(i);
+		} else if (workers_exited[i]) {
+			worker_threads[i]->join();
+			worker_io_services[i]->reset();
+			workers_exited[i] = false;
+			start_worker(i);
+		}
+		// Otherwise the retired worker is still draining, it's thread keeps running the loop
+	}
+
+	threads_count = count;
+
+	// Loops of retired workers finish once their last connection is closed
+	for (unsigned int i = count; i < previous_count; ++i)
+		worker_works[i].reset();
+
+	logger.log(swarm::SWARM_LOG_INFO, "Number of workers is changed from %u to %u", previous_count, count);
+}
+
 int base_server::run(int argc, char **argv)
 {
 	int err = parse_arguments(argc, argv);
@@ -418,6 +751,25 @@ int base_server::parse_arguments(int argc, char **argv)
 		return -8;
 	}
 
+	m_data->slow_logger = logger();
+
+	if (config.HasMember("slow_log")) {
+		const rapidjson::Value &slow_log = config["slow_log"];
+
+		if (slow_log.HasMember("threshold")) {
+			m_data->slow_log_threshold = std::max<unsigned long long>(1, slow_log["threshold"].GetUint64() * 1000);
+		}
+
+		if (slow_log.HasMember("file")) {
+			try {
+				m_data->slow_logger = swarm::logger(slow_log["file"].GetString(), swarm::SWARM_LOG_INFO, true);
+			} catch (std::exception &exc) {
+				logger().log(swarm::SWARM_LOG_ERROR, "Failed to open slow log: %s", exc.what());
+				return -8;
+			}
+		}
+	}
+
 	if (!config.HasMember("application")) {
 		logger().log(swarm::SWARM_LOG_ERROR, "\"application\" field is missed");
 		return -5;
@@ -441,10 +793,95 @@ int base_server::parse_arguments(int argc, char **argv)
 		}
 	}
 
+	m_data->threads_count = default_threads_count();
 	if (config.HasMember("threads")) {
 		m_data->threads_count = config["threads"].GetUint();
 	}
 
+	m_data->max_threads_count = std::max<unsigned int>(m_data->threads_count, available_cpus_count());
+	if (config.HasMember("max_threads")) {
+		m_data->max_threads_count = config["max_threads"].GetUint();
+	}
+
+	if (m_data->threads_count < 1 || m_data->threads_count > m_data->max_threads_count) {
+		logger().log(swarm::SWARM_LOG_ERROR, "\"threads\" must be between 1 and \"max_threads\": %u",
+			m_data->max_threads_count);
+		return -5;
+	}
+
+	if (config.HasMember("affinity")) {
+		const rapidjson::Value &affinity = config["affinity"];
+
+		try {
+			if (affinity.HasMember("workers"))
+				m_data->worker_cpus = parse_cpu_list(affinity["workers"].GetString());
+			if (affinity.HasMember("acceptor"))
+				m_data->acceptor_cpus = parse_cpu_list(affinity["acceptor"].GetString());
+			if (affinity.HasMember("monitor"))
+				m_data->monitor_cpus = parse_cpu_list(affinity["monitor"].GetString());
+		} catch (std::exception &exc) {
+			logger().log(swarm::SWARM_LOG_ERROR, "\"affinity\" field is invalid: %s", exc.what());
+			return -5;
+		}
+
+		if (affinity.HasMember("incoming_cpu"))
+			m_data->incoming_cpu = affinity["incoming_cpu"].GetBool();
+
+		// The first worker pinned to the CPU receives it's connections
+		for (size_t i = 0; i < m_data->max_threads_count && !m_data->worker_cpus.empty(); ++i) {
+			const int cpu = m_data->worker_cpus[i % m_data->worker_cpus.size()];
+			if (size_t(cpu) >= m_data->cpu_workers.size())
+				m_data->cpu_workers.resize(cpu + 1, -1);
+			if (m_data->cpu_workers[cpu] < 0)
+				m_data->cpu_workers[cpu] = i;
+		}
+	}
+
+	{
+		size_t counters = 1024;
+		size_t histograms = 64;
+		std::string file;
+
+		if (config.HasMember("statistics")) {
+			const rapidjson::Value &statistics = config["statistics"];
+
+			if (statistics.HasMember("counters"))
+				counters = statistics["counters"].GetUint();
+			if (statistics.HasMember("histograms"))
+				histograms = statistics["histograms"].GetUint();
+			if (statistics.HasMember("file"))
+				file = statistics["file"].GetString();
+		}
+
+		// Segment is created only here, so handles taken by the application never dangle.
+		// Every worker updates it's own shard of the server's counters
+		try {
+			if (!file.empty())
+				m_data->statistics.reset(new statistics_segment(file, counters, histograms, m_data->max_threads_count));
+			else
+				m_data->statistics.reset(new statistics_segment(counters, histograms, m_data->max_threads_count));
+			m_data->counters.initialize(*m_data->statistics);
+		} catch (std::exception &exc) {
+			logger().log(swarm::SWARM_LOG_ERROR, "Failed to create statistics segment: %s", exc.what());
+			return -5;
+		}
+	}
+
+	if (config.HasMember("watchdog")) {
+		const rapidjson::Value &watchdog = config["watchdog"];
+
+		if (watchdog.HasMember("enabled") && !watchdog["enabled"].GetBool()) {
+			m_data->watchdog.reset();
+		} else {
+			if (watchdog.HasMember("interval"))
+				m_data->watchdog->set_interval(watchdog["interval"].GetInt());
+			if (watchdog.HasMember("threshold"))
+				m_data->watchdog->set_threshold(watchdog["threshold"].GetInt());
+			if (watchdog.HasMember("backtrace"))
+				m_data->watchdog->set_backtrace(watchdog["backtrace"].GetBool());
+		}
+	}
+
 	try {
 		if (!initialize(config["application"])) {
 			logger().log(swarm::SWARM_LOG_ERROR, "Failed to initialize application");
@@ -471,10 +908,16 @@ int base_server::parse_arguments(int argc, char **argv)
 		m_data->buffer_size = config["buffer_size"].GetUint();
 	}
 
-	for (size_t i = 0; i < m_data->threads_count; ++i) {
+	for (size_t i = 0; i < m_data->max_threads_count; ++i) {
 		m_data->worker_io_services.emplace_back(new boost::asio::io_service(1));
-		m_data->worker_works.emplace_back(new boost::asio::io_service::work(*m_data->worker_io_services[i]));
+		m_data->inflight_registries.emplace_back(new inflight_registry);
 	}
+	m_data->worker_works.resize(m_data->max_threads_count);
+	m_data->worker_threads.resize(m_data->max_threads_count);
+	m_data->workers_exited.resize(m_data->max_threads_count, false);
+	m_data->local_storages.resize(m_data->max_threads_count);
+	for (size_t i = 0; i < m_data->threads_count; ++i)
+		m_data->worker_works[i].reset(new boost::asio::io_service::work(*m_data->worker_io_services[i]));
 
 	try {
 		for (auto it = endpoints.Begin(); it != endpoints.End(); ++it) {
@@ -497,6 +940,10 @@ int base_server::parse_arguments(int argc, char **argv)
 		monitor_port = config["monitor-port"].GetInt();
 	}
 
+	if (config.HasMember("monitor-interval")) {
+		m_data->snapshot->set_interval(config["monitor-interval"].GetInt());
+	}
+
 	if (config.HasMember("backlog"))
 		m_data->backlog_size = config["backlog"].GetInt();
 
@@ -525,33 +972,41 @@ int base_server::run()
 	sigfillset(&sigset);
 	pthread_sigmask(SIG_BLOCK, &sigset, &previous_sigset);
 
-	m_data->worker_works.emplace_back(new boost::asio::io_service::work(m_data->monitor_io_service));
-	m_data->worker_works.emplace_back(new boost::asio::io_service::work(m_data->io_service));
+	boost::asio::io_service::work monitor_work(m_data->monitor_io_service);
+	boost::asio::io_service::work acceptor_work(m_data->io_service);
 
-	std::vector<std::unique_ptr<boost::thread> > threads;
-	io_service_runner runner;
-	runner.name = "void_worker";
+	for (size_t i = 0; i < m_data->threads_count; ++i)
+		m_data->start_worker(i);
 
-	for (size_t i = 0; i < m_data->threads_count; ++i) {
-		runner.service = m_data->worker_io_services[i].get();
-		m_data->worker_threads.emplace_back(new boost::thread(runner));
-	}
+	if (m_data->watchdog)
+		m_data->watchdog->start();
+	m_data->snapshot->start();
 
+	std::vector<std::unique_ptr<boost::thread> > threads;
+	io_service_runner runner;
+	runner.unblocked_signal = 0;
+	runner.logger = m_data->logger;
+	runner.data = NULL;
+	runner.worker = 0;
 	runner.name = "void_monitor";
 	runner.service = &m_data->monitor_io_service;
+	runner.cpus = m_data->monitor_cpus;
 	threads.emplace_back(new boost::thread(runner));
 
 	runner.name = "void_acceptor";
 	runner.service = &m_data->io_service;
+	runner.cpus = m_data->acceptor_cpus;
 	threads.emplace_back(new boost::thread(runner));
 
 	pthread_sigmask(SIG_SETMASK, &previous_sigset, NULL);
 
-	// Wait for all threads in the pool to exit.
+	// Wait for all threads in the pool to exit, monitor is the only one which starts workers.
 	for (std::size_t i = 0; i < threads.size(); ++i)
 		threads[i]->join();
-	for (std::size_t i = 0; i < m_data->worker_threads.size(); ++i)
-		m_data->worker_threads[i]->join();
+	for (std::size_t i = 0; i < m_data->worker_threads.size(); ++i) {
+		if (m_data->worker_threads[i])
+			m_data->worker_threads[i]->join();
+	}
 
 	m_data->local_acceptors.reset();
 	m_data->tcp_acceptors.reset();
@@ -571,10 +1026,11 @@ void base_server::set_server(const std::weak_ptr<base_server> &server)
 	m_data->server = server;
 }
 
-std::shared_ptr<base_stream_factory> base_server::factory(const swarm::http_request &request)
+std::shared_ptr<base_stream_factory> base_server::factory(const swarm::http_request &request, unsigned long long *slow_threshold)
 {
 	for (auto it = m_data->handlers.begin(); it != m_data->handlers.end(); ++it) {
 		if (it->first.check(request)) {
+			*slow_threshold = it->first.effective_slow_request_threshold(m_data->slow_log_threshold);
 			return it->second;
 		}
 	}
@@ -596,11 +1052,13 @@ public:
 		check_all_match         = check_exact_match | check_prefix_match | check_string_match | check_regexp_match
 	};
 
-	server_options_private() : flags(check_nothing)
+	server_options_private() : flags(check_nothing), slow_threshold(0)
 	{
 	}
 
 	uint64_t flags;
+	//! Zero means that server's default is used
+	unsigned long long slow_threshold;
 	std::string match_string;
 	std::vector<std::string> methods;
 	std::vector<swarm::headers_entry> headers;
@@ -626,6 +1084,11 @@ base_server::options::modificator base_server::options::header(const std::string
 	return std::bind(&base_server::options::set_header, std::placeholders::_1, name, value);
 }
 
+base_server::options::modificator base_server::options::slow_request_threshold(unsigned long long milliseconds)
+{
+	return std::bind(&base_server::options::set_slow_request_threshold, std::placeholders::_1, milliseconds);
+}
+
 base_server::options::options() : m_data(new server_options_private)
 {
 }
@@ -674,6 +1137,16 @@ void base_server::options::set_header(const std::string &name, const std::string
 	m_data->headers.emplace_back(name, value);
 }
 
+void base_server::options::set_slow_request_threshold(unsigned long long milliseconds)
+{
+	m_data->slow_threshold = std::max(1ull, milliseconds * 1000);
+}
+
+unsigned long long base_server::options::effective_slow_request_threshold(unsigned long long default_threshold) const
+{
+	return m_data->slow_threshold ? m_data->slow_threshold : default_threshold;
+}
+
 bool base_server::options::check(const swarm::http_request &request) const
 {
 	if (m_data->flags & server_options_private::check_methods) {
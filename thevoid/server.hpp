@@ -18,6 +18,7 @@
 #define IOREMAP_THEVOID_SERVER_HPP
 
 #include "streamfactory.hpp"
+#include "statistics.hpp"
 
 #include <boost/asio.hpp>
 #include <boost/noncopyable.hpp>
@@ -50,6 +51,8 @@ class server_data;
 template <typename T> class connection;
 class monitor_connection;
 class server_options_private;
+class traffic_mirror;
+template <typename Server, typename T> class mirror_stream_factory;
 
 /*!
  * \brief The daemon_exception is thrown in case if daemonization fails.
@@ -142,14 +145,53 @@ public:
 	 * \brief Returns server-specific statistics as a key-value map.
 	 * 
 	 *  Reimplement this if you want your own statistics available.
+	 *
+	 *  It's called from the monitor thread once per "monitor-interval" milliseconds of the config,
+	 *  1000 by default. Counters registered in statistics() are cheaper and are exported
+	 *  to the monitor too.
 	 */
 	virtual std::map<std::string, std::string> get_statistics() const;
+	/*!
+	 * \brief Returns segment of server's counters and histograms.
+	 *
+	 * Application may register it's own counters here, they are updated without any locks
+	 * and are visible to external tools if "statistics" section of the config sets the file.
+	 * The segment is created once the config is parsed, so counters may be registered since
+	 * initialize, calling this earlier (i.e. from the constructor) throws std::logic_error.
+	 *
+	 * \sa statistics_segment
+	 */
+	statistics_segment &statistics();
 
 	/*!
-	 * \brief Returns number of worker threads count. 
+	 * \brief Returns number of active worker threads.
+	 *
+	 * It's the "threads" field of the configuration, the number of CPUs allowed by affinity
+	 * and cgroup's CPU quota by default. It may be changed at runtime by monitor's "t" command.
 	 */
 	unsigned int threads_count() const;
 
+	/*!
+	 * \brief Returns object of type \a T local to the current worker thread.
+	 *
+	 * Object is default-constructed by the first call from every worker and lives until the server
+	 * is destroyed, it's accessed by it's worker only. So handlers may keep per-core caches, counters
+	 * and connection pools in it without atomics and locks:
+	 * \code{.cpp}
+	 * auto &cache = server()->local<lru_cache>();
+	 * \endcode
+	 *
+	 * Throws std::logic_error if it's called not by the server's worker.
+	 */
+	template <typename T>
+	T &local()
+	{
+		std::shared_ptr<void> &slot = local_slot(local_index<T>());
+		if (!slot)
+			slot = std::make_shared<T>();
+		return *static_cast<T *>(slot.get());
+	}
+
 	/*!
 	 * \brief Initialize server by application-specific section \a config from configuration file.
 	 *
@@ -213,6 +255,12 @@ protected:
 		 * \sa set_header
 		 */
 		static modificator header(const std::string &name, const std::string &value);
+		/*!
+		 * \brief Calls options::set_slow_request_threshold
+		 *
+		 * \sa set_slow_request_threshold
+		 */
+		static modificator slow_request_threshold(unsigned long long milliseconds);
 
 		/*!
 		 * \brief Constructs options object.
@@ -244,11 +292,29 @@ protected:
 		 * \brief Makes handler callable if HTTP header \a name is equal to \a value.
 		 */
 		void set_header(const std::string &name, const std::string &value);
+		/*!
+		 * \brief Makes requests of the handler which take at least \a milliseconds to be written to slow log.
+		 *
+		 * Slow log record contains timestamps of all request's phases, headers of the request, number of bytes,
+		 * worker thread and number of active requests at arrival. It's written to the file set by "slow_log"
+		 * section of the config, or to the server's log if there is no one. Values of Authorization,
+		 * Proxy-Authorization, Cookie and Set-Cookie headers are replaced by "<hidden>".
+		 *
+		 * By default threshold from "slow_log" section of the config is used, if it's not set too
+		 * requests of the handler are never written to slow log.
+		 */
+		void set_slow_request_threshold(unsigned long long milliseconds);
 
 		/*!
 		 * \brief Returns true if request satisfies all conditions.
 		 */
 		bool check(const swarm::http_request &request) const;
+		/*!
+		 * \internal
+		 *
+		 * \brief Returns slow request threshold in microseconds, or \a default_threshold if it's not set.
+		 */
+		unsigned long long effective_slow_request_threshold(unsigned long long default_threshold) const;
 
 		/*!
 		 * \brief Swaps this options with \a other.
@@ -286,8 +352,27 @@ private:
 	void set_server(const std::weak_ptr<base_server> &server);
 	/*!
 	 * \internal
+	 *
+	 * Stores slow request threshold of the found handler in microseconds to \a slow_threshold.
+	 */
+	std::shared_ptr<base_stream_factory> factory(const swarm::http_request &request, unsigned long long *slow_threshold);
+
+	/*!
+	 * \internal
+	 *
+	 * Every type stored by local is given it's own index in the worker's storage.
 	 */
-	std::shared_ptr<base_stream_factory> factory(const swarm::http_request &request);
+	template <typename T>
+	static size_t local_index()
+	{
+		static const size_t index = next_local_index();
+		return index;
+	}
+	static size_t next_local_index();
+	/*!
+	 * \internal
+	 */
+	std::shared_ptr<void> &local_slot(size_t index);
 
 	std::unique_ptr<server_data> m_data;
 };
@@ -331,7 +416,32 @@ protected:
 	{
 		options opts;
 		options_pass(apply_option(opts, args)...);
-		base_server::on(std::move(opts), std::make_shared<stream_factory<Server, T>>(this->shared_from_this()));
+		base_server::on(std::move(opts), std::make_shared<stream_factory<Server, T>>());
+	}
+
+	/*!
+	 * \brief Add new handler of type \a T with options \a args, \a rate part of its requests is copied to \a mirror.
+	 *
+	 * Mirrored requests are sent to the shadow upstream in background, their replies are discarded.
+	 * \a rate is a number from 0 to 1, i.e. 0.01 means every hundredth request.
+	 *
+	 * \code{.cpp}
+	 * on_mirrored<on_get>(mirror, 0.01,
+	 *     options::exact_match("/get"),
+	 *     options::methods("GET")
+	 * );
+	 * \endcode
+	 *
+	 * \attention thevoid/mirror.hpp must be included to use this method.
+	 *
+	 * \sa traffic_mirror
+	 */
+	template <typename T, typename... Options>
+	void on_mirrored(const std::shared_ptr<traffic_mirror> &mirror, double rate, Options &&...args)
+	{
+		options opts;
+		options_pass(apply_option(opts, args)...);
+		base_server::on(std::move(opts), std::make_shared<mirror_stream_factory<Server, T>>(mirror, rate));
 	}
 
 private:
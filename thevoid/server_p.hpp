@@ -21,6 +21,8 @@
 #include "acceptorlist_p.hpp"
 #include "connection_p.hpp"
 #include "monitor_connection_p.hpp"
+#include "watchdog_p.hpp"
+#include "monitor_snapshot_p.hpp"
 #include <signal.h>
 
 #include <mutex>
@@ -93,6 +95,22 @@ private:
 
 typedef std::shared_ptr<base_stream_factory> factory_ptr;
 
+//! Counters updated by connections, every connection updates the shard of it's worker
+struct server_counters
+{
+	void initialize(statistics_segment &segment);
+
+	counter connections_accepted;
+	counter connections_closed;
+	counter requests;
+	//! Index 0 is for unknown status, the rest are for 1xx..5xx
+	counter statuses[6];
+	counter bytes_received;
+	counter bytes_sent;
+	//! In microseconds
+	histogram request_time;
+};
+
 class server_data
 {
 public:
@@ -104,25 +122,74 @@ public:
 	void handle_reload();
 
 	boost::asio::io_service &get_worker_service();
+	//! Index of the worker which runs \a service, -1 if it's not a worker's one
+	int worker_index(const boost::asio::io_service &service) const;
+	//! Starts thread of the worker \a index
+	void start_worker(size_t index);
+	//! Called by the worker's thread once it's loop has run out of work, returns true if the loop must be run again
+	bool restart_worker(size_t index);
+	/*!
+	 * Changes number of active workers to \a count, throws std::invalid_argument if it's out of range.
+	 *
+	 * New connections are given only to the active workers. Retired ones keep processing
+	 * their connections and their threads exit once all of them are closed.
+	 */
+	void set_threads_count(unsigned int count);
 
 	//! Logger instance
 	swarm::logger logger;
+	//! Part of access log entries written for every status class (1xx..5xx), index 0 is for unknown status
+	double access_log_sample[6];
+	//! Requests which took at least this number of microseconds are always written to access log
+	unsigned long long access_log_slow_time;
+	//! Slow requests log, it's the server's logger unless "slow_log" section sets the file
+	swarm::logger slow_logger;
+	//! Default slow request threshold in microseconds
+	unsigned long long slow_log_threshold;
 	//! Statistics
 	std::atomic_int connections_counter;
 	std::atomic_int active_connections_counter;
+	//! Created once the config is parsed
+	std::unique_ptr<statistics_segment> statistics;
+	server_counters counters;
 	//! Weak pointer to server itself
 	std::weak_ptr<base_server> server;
 	//! The io_service used to handle new sockets.
 	boost::asio::io_service io_service;
 	//! The io_service used to process monitoring connection.
 	boost::asio::io_service monitor_io_service;
-	//! List of io_services to process connections.
+	//! List of io_services to process connections, there is one for every worker the pool may grow to.
 	std::vector<std::unique_ptr<boost::asio::io_service>> worker_io_services;
+	//! Guards worker_works, worker_threads, workers_exited and stopped once the server is started
+	std::mutex workers_lock;
+	//! Works of active workers, they are null for retired ones
 	std::vector<std::unique_ptr<boost::asio::io_service::work>> worker_works;
+	//! Threads of workers, they are null for workers which were never started
 	std::vector<std::unique_ptr<boost::thread>> worker_threads;
-	//! Size of workers thread pool
+	//! If the worker's thread has left it's loop and may be joined
+	std::vector<bool> workers_exited;
+	bool stopped;
+	//! Requests being processed by every worker
+	std::vector<std::unique_ptr<inflight_registry>> inflight_registries;
+	//! Objects of base_server::local for every worker, each of them is accessed by it's worker only
+	std::vector<std::vector<std::shared_ptr<void>>> local_storages;
+	//! Watchdog of workers' event loops, null if it's disabled
+	std::unique_ptr<worker_watchdog> watchdog;
+	//! Statistics rendered for the monitor
+	std::unique_ptr<monitor_snapshot> snapshot;
+	//! CPUs worker i is pinned to worker_cpus[i % size], empty if workers are not pinned
+	std::vector<int> worker_cpus;
+	std::vector<int> acceptor_cpus;
+	std::vector<int> monitor_cpus;
+	//! Worker pinned to every CPU, -1 if there is no one
+	std::vector<int> cpu_workers;
+	//! If accepted sockets are moved to the worker pinned to their SO_INCOMING_CPU
+	bool incoming_cpu;
 	std::atomic_uint threads_round_robin;
-	unsigned int threads_count;
+	//! Number of active workers, they are the first ones
+	std::atomic_uint threads_count;
+	//! Number of workers the pool may grow to
+	unsigned int max_threads_count;
 	unsigned int backlog_size;
 	size_t buffer_size;
 	//! List of activated acceptors
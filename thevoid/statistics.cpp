@@ -0,0 +1,461 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "statistics.hpp"
+
+#include <mutex>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace ioremap {
+namespace thevoid {
+
+enum {
+	// "THVSTAT1" in little-endian
+	statistics_magic = 0x3154415453564854ULL,
+	statistics_version = 2
+};
+
+/*
+ * Layout of the segment, all entries are 64-bytes aligned so counters
+ * updated by different threads don't share cache lines.
+ *
+ * Entries are followed by shards_count shards of shard_size bytes, every shard
+ * has values of all counters and then values of all histograms.
+ */
+struct statistics_header
+{
+	uint64_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t counter_size;
+	uint32_t histogram_size;
+	uint32_t counters_capacity;
+	uint32_t histograms_capacity;
+	uint32_t buckets_count;
+	std::atomic<uint32_t> counters_count;
+	std::atomic<uint32_t> histograms_count;
+	uint32_t shards_count;
+	uint64_t pid;
+	uint64_t start_time;
+	uint64_t shard_size;
+	char padding[56];
+};
+
+struct statistics_counter
+{
+	char name[statistics_segment::max_name_size];
+	std::atomic_ullong value;
+	char padding[8];
+};
+
+struct statistics_histogram_values
+{
+	std::atomic_ullong count;
+	std::atomic_ullong sum;
+	std::atomic_ullong buckets[histogram::buckets_count];
+};
+
+struct statistics_histogram
+{
+	char name[statistics_segment::max_name_size];
+	statistics_histogram_values values;
+};
+
+static_assert(sizeof(statistics_header) % 64 == 0, "statistics header must be cache aligned");
+static_assert(sizeof(statistics_counter) == 64, "statistics counter must be cache aligned");
+static_assert(sizeof(statistics_histogram) % 64 == 0, "statistics histogram must be cache aligned");
+
+static std::runtime_error make_error(const std::string &message, int err)
+{
+	return std::runtime_error(message + ": " + strerror(err));
+}
+
+static std::atomic_ullong dummy_counter(0);
+static statistics_histogram_values dummy_histogram;
+
+class statistics_segment_private
+{
+public:
+	statistics_segment_private() : memory(MAP_FAILED), size(0), writable(false), header(NULL)
+	{
+	}
+
+	~statistics_segment_private()
+	{
+		if (memory != MAP_FAILED)
+			munmap(memory, size);
+	}
+
+	static size_t shard_size(size_t counters_capacity, size_t histograms_capacity)
+	{
+		// Shards of different workers don't share cache lines
+		const size_t size = counters_capacity * sizeof(std::atomic_ullong)
+			+ histograms_capacity * sizeof(statistics_histogram_values);
+		return (size + 63) / 64 * 64;
+	}
+
+	static size_t segment_size(size_t counters_capacity, size_t histograms_capacity, size_t shards_count)
+	{
+		return sizeof(statistics_header)
+			+ counters_capacity * sizeof(statistics_counter)
+			+ histograms_capacity * sizeof(statistics_histogram)
+			+ shards_count * shard_size(counters_capacity, histograms_capacity);
+	}
+
+	void initialize(size_t counters_capacity, size_t histograms_capacity, size_t shards_count)
+	{
+		// Fresh mapping is zero-filled, so only the header needs to be set
+		header = static_cast<statistics_header *>(memory);
+		header->version = statistics_version;
+		header->header_size = sizeof(statistics_header);
+		header->counter_size = sizeof(statistics_counter);
+		header->histogram_size = sizeof(statistics_histogram);
+		header->counters_capacity = counters_capacity;
+		header->histograms_capacity = histograms_capacity;
+		header->buckets_count = histogram::buckets_count;
+		header->shards_count = shards_count;
+		header->shard_size = shard_size(counters_capacity, histograms_capacity);
+		header->pid = getpid();
+		header->start_time = time(NULL);
+		writable = true;
+
+		// Readers check magic last
+		std::atomic_thread_fence(std::memory_order_release);
+		header->magic = statistics_magic;
+	}
+
+	statistics_counter *counters() const
+	{
+		return reinterpret_cast<statistics_counter *>(static_cast<char *>(memory) + header->header_size);
+	}
+
+	statistics_histogram *histograms() const
+	{
+		return reinterpret_cast<statistics_histogram *>(reinterpret_cast<char *>(counters()) + header->counters_capacity * header->counter_size);
+	}
+
+	char *shards() const
+	{
+		return reinterpret_cast<char *>(histograms()) + header->histograms_capacity * header->histogram_size;
+	}
+
+	//! Value of counter \a index in the first shard
+	char *counter_shards(size_t index) const
+	{
+		return shards() + index * sizeof(std::atomic_ullong);
+	}
+
+	//! Values of histogram \a index in the first shard
+	char *histogram_shards(size_t index) const
+	{
+		return shards() + header->counters_capacity * sizeof(std::atomic_ullong)
+			+ index * sizeof(statistics_histogram_values);
+	}
+
+	void check_name(const std::string &name) const
+	{
+		if (!writable)
+			throw std::runtime_error("statistics segment is opened for reading");
+		if (name.empty() || name.size() >= statistics_segment::max_name_size)
+			throw std::runtime_error("invalid statistics name: \"" + name + "\"");
+	}
+
+	void *memory;
+	size_t size;
+	bool writable;
+	statistics_header *header;
+	//! Serializes registration of new entries
+	std::mutex mutex;
+};
+
+counter::counter() : m_value(&dummy_counter), m_shards(NULL), m_shards_count(0), m_shard_size(0)
+{
+}
+
+counter::counter(std::atomic_ullong *value, char *shards, size_t shards_count, size_t shard_size)
+	: m_value(value), m_shards(shards), m_shards_count(shards_count), m_shard_size(shard_size)
+{
+}
+
+histogram::histogram() : m_data(&dummy_histogram), m_shards(NULL), m_shards_count(0), m_shard_size(0)
+{
+}
+
+histogram::histogram(statistics_histogram_values *value, char *shards, size_t shards_count, size_t shard_size)
+	: m_data(value), m_shards(shards), m_shards_count(shards_count), m_shard_size(shard_size)
+{
+}
+
+void histogram::add(uint64_t value)
+{
+	size_t index = value ? 64 - __builtin_clzll(value) : 0;
+	if (index >= buckets_count)
+		index = buckets_count - 1;
+
+	m_data->count.fetch_add(1, std::memory_order_relaxed);
+	m_data->sum.fetch_add(value, std::memory_order_relaxed);
+	m_data->buckets[index].fetch_add(1, std::memory_order_relaxed);
+}
+
+statistics_segment::statistics_segment(size_t counters_capacity, size_t histograms_capacity, size_t shards_count)
+	: m_data(new statistics_segment_private)
+{
+	m_data->size = statistics_segment_private::segment_size(counters_capacity, histograms_capacity, shards_count);
+	m_data->memory = mmap(NULL, m_data->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (m_data->memory == MAP_FAILED)
+		throw make_error("failed to allocate statistics segment", errno);
+
+	m_data->initialize(counters_capacity, histograms_capacity, shards_count);
+}
+
+statistics_segment::statistics_segment(const std::string &path, size_t counters_capacity, size_t histograms_capacity,
+		size_t shards_count)
+	: m_data(new statistics_segment_private)
+{
+	m_data->size = statistics_segment_private::segment_size(counters_capacity, histograms_capacity, shards_count);
+
+	/*
+	 * Readers may still map the file of the previous server, truncating it would kill them by SIGBUS.
+	 * So new segment is created at temporary file and replaces the old one by rename.
+	 */
+	std::vector<char> tmp_path(path.begin(), path.end());
+	const char suffix[] = ".XXXXXX";
+	tmp_path.insert(tmp_path.end(), suffix, suffix + sizeof(suffix));
+
+	int fd = mkostemp(tmp_path.data(), O_CLOEXEC);
+	if (fd < 0)
+		throw make_error("failed to create statistics segment \"" + path + "\"", errno);
+
+	if (fchmod(fd, 0644) != 0 || ftruncate(fd, m_data->size) != 0) {
+		int err = errno;
+		::close(fd);
+		unlink(tmp_path.data());
+		throw make_error("failed to resize statistics segment \"" + path + "\"", err);
+	}
+
+	m_data->memory = mmap(NULL, m_data->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	int err = errno;
+	::close(fd);
+
+	if (m_data->memory == MAP_FAILED) {
+		unlink(tmp_path.data());
+		throw make_error("failed to map statistics segment \"" + path + "\"", err);
+	}
+
+	m_data->initialize(counters_capacity, histograms_capacity, shards_count);
+
+	if (rename(tmp_path.data(), path.c_str()) != 0) {
+		err = errno;
+		unlink(tmp_path.data());
+		throw make_error("failed to replace statistics segment \"" + path + "\"", err);
+	}
+}
+
+statistics_segment::statistics_segment(std::unique_ptr<statistics_segment_private> &&data) : m_data(std::move(data))
+{
+}
+
+statistics_segment::~statistics_segment()
+{
+}
+
+std::unique_ptr<statistics_segment> statistics_segment::open(const std::string &path)
+{
+	std::unique_ptr<statistics_segment_private> data(new statistics_segment_private);
+
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		throw make_error("failed to open statistics segment \"" + path + "\"", errno);
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		int err = errno;
+		::close(fd);
+		throw make_error("failed to stat statistics segment \"" + path + "\"", err);
+	}
+
+	data->size = st.st_size;
+	if (data->size < sizeof(statistics_header)) {
+		::close(fd);
+		throw std::runtime_error("statistics segment \"" + path + "\" is too small");
+	}
+
+	data->memory = mmap(NULL, data->size, PROT_READ, MAP_SHARED, fd, 0);
+	int err = errno;
+	::close(fd);
+
+	if (data->memory == MAP_FAILED)
+		throw make_error("failed to map statistics segment \"" + path + "\"", err);
+
+	data->header = static_cast<statistics_header *>(data->memory);
+	const statistics_header &header = *data->header;
+
+	if (header.magic != statistics_magic || header.version != statistics_version)
+		throw std::runtime_error("statistics segment \"" + path + "\" has unsupported format");
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	if (header.counter_size != sizeof(statistics_counter)
+		|| header.histogram_size != sizeof(statistics_histogram)
+		|| header.buckets_count != histogram::buckets_count
+		|| header.shard_size != statistics_segment_private::shard_size(header.counters_capacity, header.histograms_capacity)
+		|| data->size < header.header_size + header.counters_capacity * header.counter_size
+			+ header.histograms_capacity * header.histogram_size + header.shards_count * header.shard_size) {
+		throw std::runtime_error("statistics segment \"" + path + "\" is corrupted");
+	}
+
+	return std::unique_ptr<statistics_segment>(new statistics_segment(std::move(data)));
+}
+
+counter statistics_segment::make_counter(size_t index)
+{
+	const statistics_header &header = *m_data->header;
+	return counter(&m_data->counters()[index].value, m_data->counter_shards(index), header.shards_count, header.shard_size);
+}
+
+histogram statistics_segment::make_histogram(size_t index)
+{
+	const statistics_header &header = *m_data->header;
+	return histogram(&m_data->histograms()[index].values, m_data->histogram_shards(index), header.shards_count, header.shard_size);
+}
+
+counter statistics_segment::add_counter(const std::string &name)
+{
+	m_data->check_name(name);
+
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+
+	statistics_header &header = *m_data->header;
+	statistics_counter *counters = m_data->counters();
+	const uint32_t count = header.counters_count.load(std::memory_order_relaxed);
+
+	for (uint32_t i = 0; i < count; ++i) {
+		if (name == counters[i].name)
+			return make_counter(i);
+	}
+
+	if (count >= header.counters_capacity)
+		throw std::runtime_error("statistics segment is full, can not add counter \"" + name + "\"");
+
+	memcpy(counters[count].name, name.c_str(), name.size() + 1);
+	header.counters_count.store(count + 1, std::memory_order_release);
+
+	return make_counter(count);
+}
+
+histogram statistics_segment::add_histogram(const std::string &name)
+{
+	m_data->check_name(name);
+
+	std::lock_guard<std::mutex> lock(m_data->mutex);
+
+	statistics_header &header = *m_data->header;
+	statistics_histogram *histograms = m_data->histograms();
+	const uint32_t count = header.histograms_count.load(std::memory_order_relaxed);
+
+	for (uint32_t i = 0; i < count; ++i) {
+		if (name == histograms[i].name)
+			return make_histogram(i);
+	}
+
+	if (count >= header.histograms_capacity)
+		throw std::runtime_error("statistics segment is full, can not add histogram \"" + name + "\"");
+
+	memcpy(histograms[count].name, name.c_str(), name.size() + 1);
+	header.histograms_count.store(count + 1, std::memory_order_release);
+
+	return make_histogram(count);
+}
+
+uint64_t statistics_segment::pid() const
+{
+	return m_data->header->pid;
+}
+
+uint64_t statistics_segment::start_time() const
+{
+	return m_data->header->start_time;
+}
+
+size_t statistics_segment::shards_count() const
+{
+	return m_data->header->shards_count;
+}
+
+size_t statistics_segment::counters_count() const
+{
+	return std::min(m_data->header->counters_count.load(std::memory_order_acquire), m_data->header->counters_capacity);
+}
+
+std::string statistics_segment::counter_name(size_t index) const
+{
+	const char *name = m_data->counters()[index].name;
+	return std::string(name, strnlen(name, max_name_size));
+}
+
+uint64_t statistics_segment::counter_value(size_t index) const
+{
+	uint64_t value = m_data->counters()[index].value.load(std::memory_order_relaxed);
+
+	const statistics_header &header = *m_data->header;
+	const char *shard = m_data->counter_shards(index);
+	for (size_t i = 0; i < header.shards_count; ++i, shard += header.shard_size)
+		value += reinterpret_cast<const std::atomic_ullong *>(shard)->load(std::memory_order_relaxed);
+
+	return value;
+}
+
+size_t statistics_segment::histograms_count() const
+{
+	return std::min(m_data->header->histograms_count.load(std::memory_order_acquire), m_data->header->histograms_capacity);
+}
+
+statistics_segment::histogram_info statistics_segment::histogram_value(size_t index) const
+{
+	const statistics_histogram &data = m_data->histograms()[index];
+
+	histogram_info info;
+	info.name.assign(data.name, strnlen(data.name, max_name_size));
+	info.count = 0;
+	info.sum = 0;
+	info.buckets.assign(histogram::buckets_count, 0);
+
+	const statistics_header &header = *m_data->header;
+	const char *shard = m_data->histogram_shards(index);
+	for (size_t i = 0; i <= header.shards_count; ++i) {
+		// The histogram's own values go first, then the ones of every shard
+		const statistics_histogram_values &values = i == 0 ? data.values
+			: *reinterpret_cast<const statistics_histogram_values *>(shard + (i - 1) * header.shard_size);
+
+		info.count += values.count.load(std::memory_order_relaxed);
+		info.sum += values.sum.load(std::memory_order_relaxed);
+		for (size_t j = 0; j < histogram::buckets_count; ++j)
+			info.buckets[j] += values.buckets[j].load(std::memory_order_relaxed);
+	}
+
+	return info;
+}
+
+}} // namespace ioremap::thevoid
@@ -0,0 +1,278 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOREMAP_THEVOID_STATISTICS_HPP
+#define IOREMAP_THEVOID_STATISTICS_HPP
+
+#include <swarm/c++config.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#ifdef SWARM_CSTDATOMIC
+#  include <cstdatomic>
+#else
+#  include <atomic>
+#endif
+
+namespace ioremap {
+namespace thevoid {
+
+class statistics_segment_private;
+struct statistics_histogram_values;
+
+/*!
+ * \brief The counter class is a handle of 64-bit counter in statistics_segment.
+ *
+ * Updates are single relaxed atomic operations on the shared memory, so the counter may be
+ * updated from any thread. Default constructed counter is valid and is not exported anywhere.
+ *
+ * Counters updated by every request should be updated through the shard of the current worker,
+ * so workers don't fight for the same cache line. Readers sum all shards of the counter.
+ * \code{.cpp}
+ * requests.shard(worker).increment();
+ * \endcode
+ */
+class counter
+{
+public:
+	counter();
+
+	/*!
+	 * \brief Returns handle of the counter's shard \a index.
+	 *
+	 * Any thread may update any shard, they are just not shared by workers if every worker
+	 * uses it's own one. The counter itself is returned if the segment has no such shard.
+	 */
+	counter shard(size_t index) const
+	{
+		if (index >= m_shards_count)
+			return *this;
+		return counter(reinterpret_cast<std::atomic_ullong *>(m_shards + index * m_shard_size));
+	}
+
+	/*!
+	 * \brief Adds \a value to the counter.
+	 */
+	void increment(uint64_t value = 1)
+	{
+		m_value->fetch_add(value, std::memory_order_relaxed);
+	}
+	/*!
+	 * \brief Subtracts \a value from the counter.
+	 */
+	void decrement(uint64_t value = 1)
+	{
+		m_value->fetch_sub(value, std::memory_order_relaxed);
+	}
+	/*!
+	 * \brief Sets the counter to \a value, it's useful for gauges.
+	 */
+	void set(uint64_t value)
+	{
+		m_value->store(value, std::memory_order_relaxed);
+	}
+	/*!
+	 * \brief Returns current value of the counter, shards are not included.
+	 */
+	uint64_t value() const
+	{
+		return m_value->load(std::memory_order_relaxed);
+	}
+
+private:
+	friend class statistics_segment;
+
+	explicit counter(std::atomic_ullong *value, char *shards = NULL, size_t shards_count = 0, size_t shard_size = 0);
+
+	std::atomic_ullong *m_value;
+	//! The counter's value in the first shard, the next ones are m_shard_size bytes apart
+	char *m_shards;
+	size_t m_shards_count;
+	size_t m_shard_size;
+};
+
+/*!
+ * \brief The histogram class is a handle of histogram in statistics_segment.
+ *
+ * Values are counted by power of two buckets: bucket \a i contains values less than 2^i,
+ * the last one contains all the rest. Sum and count of the values are kept too.
+ */
+class histogram
+{
+public:
+	enum {
+		buckets_count = 32
+	};
+
+	histogram();
+
+	/*!
+	 * \brief Returns handle of the histogram's shard \a index.
+	 *
+	 * Shards are used the same way as counter's ones.
+	 *
+	 * \sa counter::shard
+	 */
+	histogram shard(size_t index) const
+	{
+		if (index >= m_shards_count)
+			return *this;
+		return histogram(reinterpret_cast<statistics_histogram_values *>(m_shards + index * m_shard_size));
+	}
+
+	/*!
+	 * \brief Adds \a value to the histogram.
+	 */
+	void add(uint64_t value);
+
+private:
+	friend class statistics_segment;
+
+	explicit histogram(statistics_histogram_values *value, char *shards = NULL, size_t shards_count = 0, size_t shard_size = 0);
+
+	statistics_histogram_values *m_data;
+	char *m_shards;
+	size_t m_shards_count;
+	size_t m_shard_size;
+};
+
+/*!
+ * \brief The statistics_segment class is a memory mapped set of named counters and histograms.
+ *
+ * If the segment is created by a file path, other processes may read it by mmap without any
+ * interaction with the server, i.e. it costs nothing for the server to poll it even every second.
+ * Put the file to tmpfs (like /dev/shm) to avoid writeback of the pages.
+ *
+ * The segment has a fixed header and two arrays of fixed size entries: counters and histograms.
+ * Names are written before the entry is published by the header's count, so readers
+ * always see complete entries. Capacity is fixed at creation.
+ *
+ * Every shard is a separate block of values of all counters and histograms, server creates
+ * one for every worker. Values returned by the segment are sums of the entry and all it's shards.
+ *
+ * \code{.cpp}
+ * thevoid::counter requests = server->statistics().add_counter("requests");
+ * requests.increment();
+ * \endcode
+ */
+class statistics_segment
+{
+public:
+	enum {
+		//! Maximal length of the name, including terminating zero
+		max_name_size = 48
+	};
+
+	/*!
+	 * \brief Snapshot of the histogram.
+	 */
+	struct histogram_info
+	{
+		std::string name;
+		uint64_t count;
+		uint64_t sum;
+		std::vector<uint64_t> buckets;
+	};
+
+	/*!
+	 * \brief Constructs anonymous segment with \a shards_count shards, it's not visible to other processes.
+	 */
+	statistics_segment(size_t counters_capacity = 1024, size_t histograms_capacity = 64, size_t shards_count = 0);
+	/*!
+	 * \brief Creates segment with \a shards_count shards at file \a path.
+	 *
+	 * The segment is created at temporary file which replaces \a path once it's ready,
+	 * so readers which still map the previous file are not affected.
+	 *
+	 * Throws std::runtime_error if the file can not be created.
+	 */
+	statistics_segment(const std::string &path, size_t counters_capacity = 1024, size_t histograms_capacity = 64,
+		size_t shards_count = 0);
+	statistics_segment(const statistics_segment &other) = delete;
+	~statistics_segment();
+
+	statistics_segment &operator =(const statistics_segment &other) = delete;
+
+	/*!
+	 * \brief Opens existing segment at \a path for reading.
+	 *
+	 * Throws std::runtime_error if the file can not be opened or has unsupported format.
+	 */
+	static std::unique_ptr<statistics_segment> open(const std::string &path);
+
+	/*!
+	 * \brief Returns counter \a name, it's registered if there is no such counter yet.
+	 *
+	 * Throws std::runtime_error if the segment is full or is opened for reading.
+	 */
+	counter add_counter(const std::string &name);
+	/*!
+	 * \brief Returns histogram \a name, it's registered if there is no such histogram yet.
+	 *
+	 * Throws std::runtime_error if the segment is full or is opened for reading.
+	 */
+	histogram add_histogram(const std::string &name);
+
+	/*!
+	 * \brief Returns process id of the segment's owner.
+	 */
+	uint64_t pid() const;
+	/*!
+	 * \brief Returns the time segment was created at, in seconds since epoch.
+	 */
+	uint64_t start_time() const;
+	/*!
+	 * \brief Returns number of shards.
+	 */
+	size_t shards_count() const;
+
+	/*!
+	 * \brief Returns number of registered counters.
+	 */
+	size_t counters_count() const;
+	/*!
+	 * \brief Returns name of counter \a index.
+	 */
+	std::string counter_name(size_t index) const;
+	/*!
+	 * \brief Returns value of counter \a index summed over all shards.
+	 */
+	uint64_t counter_value(size_t index) const;
+
+	/*!
+	 * \brief Returns number of registered histograms.
+	 */
+	size_t histograms_count() const;
+	/*!
+	 * \brief Returns snapshot of histogram \a index summed over all shards.
+	 */
+	histogram_info histogram_value(size_t index) const;
+
+private:
+	statistics_segment(std::unique_ptr<statistics_segment_private> &&data);
+
+	counter make_counter(size_t index);
+	histogram make_histogram(size_t index);
+
+	std::unique_ptr<statistics_segment_private> m_data;
+};
+
+}} // namespace ioremap::thevoid
+
+#endif // IOREMAP_THEVOID_STATISTICS_HPP
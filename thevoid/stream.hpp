@@ -226,16 +226,22 @@ public:
 	/*!
 	 * \internal
 	 */
-	void set_server(const std::shared_ptr<Server> &server)
+	void set_server(std::shared_ptr<Server> &&server)
 	{
-		m_server = server;
+		m_server = std::move(server);
 	}
 
 protected:
 	/*!
 	 * \brief Returns the pointer to the server.
+	 *
+	 * Stream keeps the server alive, so it may be used by callbacks which outlive
+	 * the request, like the ones of url_fetcher. Reference is returned, so calls like
+	 * server()->local<T>() don't touch the reference counter.
+	 *
+	 * \sa base_server::local
 	 */
-	std::shared_ptr<Server> server()
+	const std::shared_ptr<Server> &server()
 	{
 		if (__builtin_expect(!m_server, false))
 			throw std::logic_error("request_stream::m_server must be initialized");
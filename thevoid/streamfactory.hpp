@@ -22,35 +22,34 @@
 namespace ioremap {
 namespace thevoid {
 
+class base_server;
+
 class base_stream_factory
 {
 public:
     base_stream_factory();
     virtual ~base_stream_factory();
 
-    virtual std::shared_ptr<base_request_stream> create() = 0;
+    /*
+     * The stream is given the server of the connection, so there is no need to lock
+     * a weak pointer to the server for every request.
+     */
+    virtual std::shared_ptr<base_request_stream> create(const std::shared_ptr<base_server> &server) = 0;
 };
 
 template <typename Server, typename T>
 class stream_factory : public base_stream_factory
 {
 public:
-    stream_factory(const std::shared_ptr<Server> &server) : m_server(server) {}
+    stream_factory() {}
     ~stream_factory() /*override*/ {}
 
-    std::shared_ptr<base_request_stream> create() /*override*/
+    std::shared_ptr<base_request_stream> create(const std::shared_ptr<base_server> &server) /*override*/
     {
-        if (auto server = m_server.lock()) {
-            auto stream = std::make_shared<T>();
-            stream->set_server(server);
-            return stream;
-        }
-
-        throw std::logic_error("stream_factory::m_server is null pointer");
+        auto stream = std::make_shared<T>();
+        stream->set_server(std::static_pointer_cast<Server>(server));
+        return stream;
     }
-
-private:
-    std::weak_ptr<Server> m_server;
 };
 
 }} // namespace ioremap::thevoid
@@ -0,0 +1,239 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "watchdog_p.hpp"
+#include "server_p.hpp"
+
+#include <execinfo.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+
+namespace ioremap {
+namespace thevoid {
+
+static const char *histogram_names[worker_watchdog::histogram_size] = {
+	"100us", "1ms", "10ms", "100ms", "1s", "inf"
+};
+
+static unsigned long long now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static size_t histogram_index(unsigned long long lag)
+{
+	size_t index = 0;
+	for (unsigned long long limit = 100; index + 1 < worker_watchdog::histogram_size && lag >= limit; limit *= 10)
+		++index;
+	return index;
+}
+
+static void print_backtrace(int)
+{
+	void *frames[64];
+	const int count = ::backtrace(frames, sizeof(frames) / sizeof(frames[0]));
+
+	const char header[] = "thevoid: backtrace of the stuck worker:\n";
+	if (::write(STDERR_FILENO, header, sizeof(header) - 1) < 0)
+		return;
+	::backtrace_symbols_fd(frames, count, STDERR_FILENO);
+}
+
+worker_watchdog::worker_state::worker_state() : posted_at(0), last_lag(0), max_lag(0), reported(false), retired(false)
+{
+	for (size_t i = 0; i < histogram_size; ++i)
+		histogram[i] = 0;
+}
+
+worker_watchdog::worker_watchdog(server_data &data) :
+	m_data(data),
+	m_timer(data.monitor_io_service),
+	m_states_count(0),
+	m_interval(100),
+	m_threshold(1000000),
+	m_backtrace(false)
+{
+}
+
+worker_watchdog::~worker_watchdog()
+{
+}
+
+void worker_watchdog::set_interval(long milliseconds)
+{
+	m_interval = std::max(1l, milliseconds);
+}
+
+void worker_watchdog::set_threshold(long milliseconds)
+{
+	m_threshold = std::max(1l, milliseconds) * 1000ull;
+}
+
+void worker_watchdog::set_backtrace(bool backtrace)
+{
+	m_backtrace = backtrace;
+}
+
+bool worker_watchdog::backtrace() const
+{
+	return m_backtrace;
+}
+
+int worker_watchdog::backtrace_signal()
+{
+	return SIGRTMIN + 1;
+}
+
+void worker_watchdog::start()
+{
+	m_states_count = m_data.worker_io_services.size();
+	m_states.reset(new worker_state[m_states_count]);
+
+	if (m_backtrace) {
+		// The first call of backtrace loads libgcc, which is not allowed in signal handler
+		void *frame;
+		::backtrace(&frame, 1);
+
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = print_backtrace;
+		sigemptyset(&action.sa_mask);
+		action.sa_flags = SA_RESTART;
+		if (sigaction(backtrace_signal(), &action, NULL) != 0) {
+			m_data.logger.log(swarm::SWARM_LOG_ERROR, "watchdog: failed to set backtrace signal handler: %s", strerror(errno));
+			m_backtrace = false;
+		}
+	}
+
+	schedule();
+}
+
+void worker_watchdog::fill_information(rapidjson::Value &information, rapidjson::MemoryPoolAllocator<> &allocator) const
+{
+	const unsigned long long now = now_us();
+
+	rapidjson::Value workers;
+	workers.SetArray();
+
+	const size_t count = std::min<size_t>(m_states_count, m_data.threads_count);
+
+	for (size_t i = 0; i < count; ++i) {
+		const worker_state &state = m_states[i];
+		const unsigned long long posted_at = state.posted_at;
+
+		rapidjson::Value worker;
+		worker.SetObject();
+		worker.AddMember("lag", uint64_t(state.last_lag), allocator);
+		worker.AddMember("max-lag", uint64_t(state.max_lag), allocator);
+		worker.AddMember("pending", uint64_t(posted_at && now > posted_at ? now - posted_at : 0), allocator);
+
+		rapidjson::Value histogram;
+		histogram.SetObject();
+		for (size_t j = 0; j < histogram_size; ++j)
+			histogram.AddMember(histogram_names[j], uint64_t(state.histogram[j]), allocator);
+		worker.AddMember("histogram", histogram, allocator);
+
+		workers.PushBack(worker, allocator);
+	}
+
+	information.AddMember("workers", workers, allocator);
+}
+
+void worker_watchdog::schedule()
+{
+	m_timer.expires_from_now(boost::posix_time::milliseconds(m_interval));
+	m_timer.async_wait(std::bind(&worker_watchdog::on_timer, this, std::placeholders::_1));
+}
+
+void worker_watchdog::on_timer(const boost::system::error_code &err)
+{
+	if (err)
+		return;
+
+	const unsigned long long now = now_us();
+
+	const size_t count = m_data.threads_count;
+
+	for (size_t i = 0; i < m_states_count; ++i) {
+		worker_state &state = m_states[i];
+
+		if (i >= count) {
+			state.retired = true;
+			continue;
+		}
+
+		if (state.retired) {
+			// Probe posted before retirement has waited for the loop to be restarted, so it's timed from now on
+			state.retired = false;
+			unsigned long long posted_at = state.posted_at;
+			if (posted_at)
+				state.posted_at.compare_exchange_strong(posted_at, now);
+		}
+
+		if (state.posted_at) {
+			check(i, now);
+			continue;
+		}
+
+		if (state.reported) {
+			state.reported = false;
+			m_data.logger.log(swarm::SWARM_LOG_ERROR, "watchdog: worker %zu recovered, lag: %llu us",
+				i, static_cast<unsigned long long>(state.last_lag));
+		}
+
+		state.posted_at = now;
+		m_data.worker_io_services[i]->post(std::bind(&worker_watchdog::on_probe, this, i));
+	}
+
+	schedule();
+}
+
+void worker_watchdog::on_probe(size_t index)
+{
+	worker_state &state = m_states[index];
+
+	const unsigned long long now = now_us();
+	const unsigned long long posted_at = state.posted_at;
+	const unsigned long long lag = now > posted_at ? now - posted_at : 0;
+
+	state.last_lag = lag;
+	if (lag > state.max_lag)
+		state.max_lag = lag;
+	++state.histogram[histogram_index(lag)];
+
+	state.posted_at = 0;
+}
+
+void worker_watchdog::check(size_t index, unsigned long long now)
+{
+	worker_state &state = m_states[index];
+	const unsigned long long posted_at = state.posted_at;
+
+	if (state.reported || !posted_at || now < posted_at + m_threshold)
+		return;
+
+	state.reported = true;
+	m_data.logger.log(swarm::SWARM_LOG_ERROR, "watchdog: worker %zu has not processed events for %llu ms",
+		index, (now - posted_at) / 1000);
+
+	if (m_backtrace && index < m_data.worker_threads.size() && m_data.worker_threads[index])
+		pthread_kill(m_data.worker_threads[index]->native_handle(), backtrace_signal());
+}
+
+}} // namespace ioremap::thevoid
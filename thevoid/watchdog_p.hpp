@@ -0,0 +1,105 @@
+/*
+ * Copyright 2013+ Ruslan Nigmatullin <euroelessar@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOREMAP_THEVOID_WATCHDOG_P_HPP
+#define IOREMAP_THEVOID_WATCHDOG_P_HPP
+
+#include "server.hpp"
+#include <boost/asio/deadline_timer.hpp>
+#include <swarm/c++config.hpp>
+
+#ifdef SWARM_CSTDATOMIC
+#  include <cstdatomic>
+#else
+#  include <atomic>
+#endif
+
+namespace ioremap {
+namespace thevoid {
+
+class server_data;
+
+/*!
+ * \internal
+ *
+ * Watches for event loops of workers from the monitor thread.
+ *
+ * Every interval a probe is posted to each worker's io_service, time between posting
+ * and execution of the probe is the loop's lag. If the probe is not executed during
+ * the threshold the worker is reported as stuck, it's backtrace may be printed to stderr.
+ * At most one probe per worker is in flight, so stuck worker's queue never grows.
+ * Retired workers are not watched.
+ */
+class worker_watchdog
+{
+public:
+	enum {
+		// Buckets are 100us, 1ms, 10ms, 100ms, 1s and more
+		histogram_size = 6
+	};
+
+	worker_watchdog(server_data &data);
+	~worker_watchdog();
+
+	void set_interval(long milliseconds);
+	void set_threshold(long milliseconds);
+	void set_backtrace(bool backtrace);
+	bool backtrace() const;
+
+	/*!
+	 * Signal sent to the stuck worker if backtrace is enabled, it must be unblocked in worker threads.
+	 */
+	static int backtrace_signal();
+
+	void start();
+
+	/*!
+	 * Adds "workers" array to \a information.
+	 */
+	void fill_information(rapidjson::Value &information, rapidjson::MemoryPoolAllocator<> &allocator) const;
+
+private:
+	struct worker_state
+	{
+		worker_state();
+
+		//! Time the outstanding probe was posted at, zero if there is no one
+		std::atomic_ullong posted_at;
+		std::atomic_ullong last_lag;
+		std::atomic_ullong max_lag;
+		std::atomic_ullong histogram[histogram_size];
+		//! Accessed by the monitor thread only
+		bool reported;
+		bool retired;
+	};
+
+	void schedule();
+	void on_timer(const boost::system::error_code &err);
+	void on_probe(size_t index);
+	void check(size_t index, unsigned long long now);
+
+	server_data &m_data;
+	boost::asio::deadline_timer m_timer;
+	std::unique_ptr<worker_state[]> m_states;
+	size_t m_states_count;
+	long m_interval;
+	unsigned long long m_threshold;
+	bool m_backtrace;
+};
+
+}} // namespace ioremap::thevoid
+
+#endif // IOREMAP_THEVOID_WATCHDOG_P_HPP